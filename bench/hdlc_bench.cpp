@@ -0,0 +1,140 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "hdlc.h"
+
+// Frames, deframes and checksums PPP traffic the way ppp_server does for the
+// dial-up ISP path, comparing the table/SIMD kernels in hdlc.cpp with the
+// byte-at-a-time loops they replaced.
+
+static size_t reference_encode(uint32_t accm, const uint8_t *data, size_t length, uint8_t *out)
+{
+    size_t out_length = 0;
+    uint16_t fcs = FCS16_INIT;
+    auto put = [&](uint8_t c) {
+        if (c == HDLC_FLAG || c == HDLC_ESCAPE || (c < 0x20 && (accm & (1U << c)))) {
+            out[out_length++] = HDLC_ESCAPE;
+            c ^= 0x20;
+        }
+        out[out_length++] = c;
+    };
+    out[out_length++] = HDLC_FLAG;
+    for (size_t i = 0; i < length; i++) {
+        fcs = hdlc_fcs16_bytewise(fcs, &data[i], 1);
+        put(data[i]);
+    }
+    fcs ^= 0xffff;
+    put(fcs & 0xff);
+    put(fcs >> 8);
+    out[out_length++] = HDLC_FLAG;
+    return out_length;
+}
+
+static size_t reference_decode(const uint8_t *data, size_t length, uint8_t *frame, size_t &frames)
+{
+    size_t frame_length = 0, total = 0;
+    bool escaped = false;
+    for (size_t i = 0; i < length; i++) {
+        auto c = data[i];
+        if (c == HDLC_FLAG) {
+            if (frame_length > 2 && hdlc_fcs16_bytewise(FCS16_INIT, frame, frame_length) == FCS16_GOOD) {
+                frames++;
+                total += frame_length - 2;
+            }
+            frame_length = 0;
+            escaped = false;
+            continue;
+        }
+        if (c == HDLC_ESCAPE) {escaped = true; continue;}
+        if (escaped) {c ^= 0x20; escaped = false;}
+        frame[frame_length++] = c;
+    }
+    return total;
+}
+
+template <typename F>
+static double measure(size_t bytes_per_round, size_t total_bytes, F &&round)
+{
+    const size_t rounds = total_bytes / bytes_per_round + 1;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < rounds; i++) {round();}
+    const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return rounds * bytes_per_round / elapsed / (1024 * 1024);
+}
+
+int main(int argc, char *argv[])
+{
+    const size_t total_mb = (argc > 1) ? atoi(argv[1]) : 256;
+    const size_t total_bytes = total_mb * 1024 * 1024;
+    const size_t frame_sizes[] = {64, 1500};
+    const uint32_t accms[] = {0xffffffff, 0};
+    const size_t frames_per_stream = 256;
+
+    std::mt19937 rng(1);
+    printf("process %zu MB per case, random payload\n", total_mb);
+    for (const auto frame_size : frame_sizes) {
+        std::vector<uint8_t> payload(frame_size * frames_per_stream);
+        for (auto &c : payload) {c = rng();}
+
+        volatile uint16_t sink = 0;
+        printf("frame %4zu bytes: fcs16 bytewise %8.1f MB/s, slice-by-8 %8.1f MB/s\n", frame_size,
+            measure(payload.size(), total_bytes, [&]{sink = hdlc_fcs16_bytewise(FCS16_INIT, payload.data(), payload.size());}),
+            measure(payload.size(), total_bytes, [&]{sink = hdlc_fcs16(FCS16_INIT, payload.data(), payload.size());}));
+
+        for (const auto accm : accms) {
+            hdlc_encoder encoder;
+            encoder.set_accm(accm);
+            std::vector<uint8_t> stream(hdlc_encoder::max_encoded_length(frame_size) * frames_per_stream);
+            std::vector<uint8_t> reference(stream.size());
+            size_t stream_length = 0, reference_length = 0;
+            auto encode_all = [&]{
+                stream_length = 0;
+                for (size_t i = 0; i < frames_per_stream; i++) {
+                    stream_length += encoder.encode(nullptr, 0, &payload[i * frame_size], frame_size, &stream[stream_length]);
+                }
+            };
+            auto reference_encode_all = [&]{
+                reference_length = 0;
+                for (size_t i = 0; i < frames_per_stream; i++) {
+                    reference_length += reference_encode(accm, &payload[i * frame_size], frame_size, &reference[reference_length]);
+                }
+            };
+            const auto reference_encode_rate = measure(payload.size(), total_bytes, reference_encode_all);
+            const auto encode_rate = measure(payload.size(), total_bytes, encode_all);
+            if (stream_length != reference_length || memcmp(stream.data(), reference.data(), stream_length) != 0) {
+                printf("  warning: encoder output mismatch\n");
+            }
+
+            hdlc_decoder decoder(frame_size + 8);
+            size_t decoded = 0, mismatches = 0;
+            auto decode_all = [&]{
+                size_t index = 0;
+                decoder.input(stream.data(), stream_length, [&](const uint8_t *frame, size_t length) {
+                    if (length != frame_size || memcmp(frame, &payload[index * frame_size], length) != 0) {mismatches++;}
+                    index++;
+                    decoded++;
+                });
+            };
+            std::vector<uint8_t> frame(frame_size + 8);
+            size_t reference_frames = 0;
+            const auto reference_decode_rate = measure(payload.size(), total_bytes, [&]{
+                sink = reference_decode(stream.data(), stream_length, frame.data(), reference_frames);
+            });
+            const auto decode_rate = measure(payload.size(), total_bytes, decode_all);
+            if (mismatches != 0 || decoded != reference_frames || decoder.get_bad_frames() != 0) {
+                printf("  warning: decoder output mismatch\n");
+            }
+
+            printf("frame %4zu bytes, ACCM %08x: encode bytewise %8.1f MB/s, vectorized %8.1f MB/s; "
+                "decode bytewise %8.1f MB/s, vectorized %8.1f MB/s\n",
+                frame_size, accm, reference_encode_rate, encode_rate, reference_decode_rate, decode_rate);
+        }
+        (void) sink;
+    }
+
+    return 0;
+}
@@ -0,0 +1,472 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "host_sim.h"
+#include "loopback_host_port.h"
+#include "sim_runner.h"
+#include "tcp_peer.h"
+#include "usbdevfs_host_port.h"
+
+// Throughput, latency and CPU cost of each Modem subclass's data path, in
+// both directions, with the PS2 side played by host_sim. By default the
+// emulator runs in-process on the loopback gadget, unpaced, so the figures
+// are those of the endpoint threads and framing themselves. With -d the
+// host side drives a real device through usbdevfs instead: a modem, or the
+// emulator on a UDC dialing back to this machine. The results are JSON.
+//
+// In-process, each model also gets an idle record: the emulator's threads,
+// the process RSS and size and the emulator's CPU time while on-line without data,
+// with the host polling the status endpoints. Compare runs with and without
+// -S for the cost of the endpoint threads.
+
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+
+static const char * const models[] = {"Omron", "SmartSCM", "OnlineStation", "Lucent"};
+
+constexpr auto BENCH_IO_TIMEOUT = milliseconds(1000);
+
+struct bench_options {
+    sim_options sim;
+    const char *device = nullptr;  // usbdevfs node for real hardware
+    const char *peer_addr = nullptr; // address the device dials to reach us
+};
+
+struct direction_result {
+    const char *direction;
+    uint64_t bytes = 0;      // delivered to the other side
+    uint64_t lost_bytes = 0; // sent but dropped by the emulator's queues
+    double seconds = 0;
+    std::vector<double> latencies_us;
+    double cpu_ns = -1; // emulator CPU time during the transfer, -1 if not measurable
+};
+
+struct idle_result {
+    double seconds = 0;
+    int threads = 0;      // the emulator's, without the host side ones
+    long rss_kb = 0;      // whole process
+    long vm_kb = 0;       // whole process; each thread reserves its stack here
+    double cpu_ns = 0;
+};
+
+static double elapsed_s(const steady_clock::time_point &start)
+{
+    return std::chrono::duration<double>(steady_clock::now() - start).count();
+}
+
+static double clock_ns(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// CPU time of the emulator's threads: everything but the host side on this
+// thread, its status poller and the TCP peer.
+static double emulator_cpu_ns(host_sim *host, tcp_peer &peer)
+{
+    return clock_ns(CLOCK_PROCESS_CPUTIME_ID) - clock_ns(CLOCK_THREAD_CPUTIME_ID)
+        - host->get_poller_cpu_time().count() - peer.get_cpu_time().count();
+}
+
+// A field of /proc/self/status, such as Threads or VmRSS (in kB); -1 if missing.
+static long proc_status(const char *field)
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    const auto prefix = std::string(field) + ":";
+    while (std::getline(status, line)) {
+        if (line.compare(0, prefix.length(), prefix) == 0) {
+            return atol(line.c_str() + prefix.length());
+        }
+    }
+    return -1;
+}
+
+static void fill_probe(std::vector<char> &probe, int seed)
+{
+    // letters only, so the data never looks like the +++ escape
+    for (size_t i = 0; i < probe.size(); i++) {
+        probe[i] = 'a' + (seed + i) % 26;
+    }
+}
+
+// On-line without data: what the endpoint threads cost by just being there.
+// The data IN endpoint is read throughout, as the driver keeps a transfer
+// pending on it while the port is open.
+static void bench_idle(host_sim *host, tcp_peer &peer, const bench_options &options, idle_result &result)
+{
+    char data[HOST_SIM_MAX_PACKET];
+    const auto cpu_start = emulator_cpu_ns(host, peer);
+    const auto start = steady_clock::now();
+    while (elapsed_s(start) < options.sim.duration) {
+        host->read(data, sizeof(data), milliseconds(10));
+    }
+    result.seconds = elapsed_s(start);
+    // the clocks are read one after another; a near idle emulator can come out below zero
+    result.cpu_ns = std::max(0.0, emulator_cpu_ns(host, peer) - cpu_start);
+    // this thread, the TCP peer and the status poller belong to the host side
+    result.threads = proc_status("Threads") - 2 - (host->has_status_poller() ? 1 : 0);
+    result.rss_kb = proc_status("VmRSS");
+    result.vm_kb = proc_status("VmSize");
+}
+
+// Host to network: probe latency is write until the peer has all of it.
+static bool bench_uplink(host_sim *host, tcp_peer &peer, const bench_options &options, bool measure_cpu,
+    direction_result &result, std::string &error)
+{
+    std::vector<char> probe(options.sim.probe_size);
+    for (int i = 0; i < options.sim.probes; i++) {
+        fill_probe(probe, i);
+        const auto target = peer.get_rx_bytes() + probe.size();
+        const auto start = steady_clock::now();
+        if (host->write(probe.data(), probe.size(), BENCH_IO_TIMEOUT) < 0) {
+            error = host->get_error();
+            return false;
+        }
+        while (peer.get_rx_bytes() < target) {
+            if (elapsed_s(start) > BENCH_IO_TIMEOUT.count() / 1000.0) {
+                error = "uplink probe " + std::to_string(i) + " lost";
+                return false;
+            }
+            std::this_thread::yield();
+        }
+        result.latencies_us.push_back(elapsed_s(start) * 1e6);
+    }
+
+    std::vector<char> block(4096);
+    fill_probe(block, 0);
+    const auto rx_start = peer.get_rx_bytes();
+    const auto cpu_start = emulator_cpu_ns(host, peer);
+    const auto start = steady_clock::now();
+    uint64_t sent = 0;
+    while (elapsed_s(start) < options.sim.duration) {
+        const auto n = host->write(block.data(), block.size(), BENCH_IO_TIMEOUT);
+        if (n < 0) {
+            error = host->get_error();
+            return false;
+        }
+        sent += n;
+    }
+    while (peer.get_rx_bytes() - rx_start < sent && elapsed_s(start) < options.sim.duration + 1.0) {
+        std::this_thread::sleep_for(milliseconds(1));
+    }
+    result.seconds = elapsed_s(start);
+    result.bytes = peer.get_rx_bytes() - rx_start;
+    result.lost_bytes = sent - std::min<uint64_t>(sent, result.bytes);
+    if (measure_cpu) {result.cpu_ns = emulator_cpu_ns(host, peer) - cpu_start;}
+    return true;
+}
+
+// Network to host: probe latency is the peer's send until the host read all
+// of it.
+static bool bench_downlink(host_sim *host, tcp_peer &peer, const bench_options &options, bool measure_cpu,
+    direction_result &result, std::string &error)
+{
+    std::vector<char> probe(options.sim.probe_size), received(options.sim.probe_size);
+    for (int i = 0; i < options.sim.probes; i++) {
+        fill_probe(probe, i);
+        const auto start = steady_clock::now();
+        if (peer.send(probe.data(), probe.size()) != static_cast<int>(probe.size())) {
+            error = "peer send failed";
+            return false;
+        }
+        if (!host->read_exactly(received.data(), received.size(), BENCH_IO_TIMEOUT) || received != probe) {
+            error = "downlink probe " + std::to_string(i) + " lost or corrupted";
+            return false;
+        }
+        result.latencies_us.push_back(elapsed_s(start) * 1e6);
+    }
+
+    char data[HOST_SIM_MAX_PACKET];
+    const auto cpu_start = emulator_cpu_ns(host, peer);
+    const auto start = steady_clock::now();
+    peer.set_mode(tcp_peer::mode::stream);
+    while (elapsed_s(start) < options.sim.duration) {
+        const auto n = host->read(data, sizeof(data), BENCH_IO_TIMEOUT);
+        if (n < 0) {
+            error = "downlink stalled";
+            return false;
+        }
+        result.bytes += n;
+    }
+    result.seconds = elapsed_s(start);
+    if (measure_cpu) {result.cpu_ns = emulator_cpu_ns(host, peer) - cpu_start;}
+    peer.set_mode(tcp_peer::mode::idle);
+    return true;
+}
+
+static void print_json_string(FILE *fp, const std::string &s)
+{
+    fputc('"', fp);
+    for (const auto c : s) {
+        if (c == '"' || c == '\\') {
+            fprintf(fp, "\\%c", c);
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            fprintf(fp, "\\u%04x", c);
+        } else {
+            fputc(c, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+static double percentile(std::vector<double> samples, size_t percent)
+{
+    if (samples.empty()) {return 0;}
+    std::sort(samples.begin(), samples.end());
+    return samples[std::min(samples.size() - 1, samples.size() * percent / 100)];
+}
+
+static void print_result(FILE *fp, const char *model, const std::string &product, const direction_result &result)
+{
+    fprintf(fp, "    {\"model\": \"%s\", \"product\": ", model);
+    print_json_string(fp, product);
+    fprintf(fp, ", \"direction\": \"%s\", \"bytes\": %llu, \"lost_bytes\": %llu, \"seconds\": %.3f, \"bytes_per_sec\": %.0f, "
+        "\"latency_p50_us\": %.1f, \"latency_p99_us\": %.1f, \"cpu_ns_per_byte\": ",
+        result.direction, (unsigned long long) result.bytes, (unsigned long long) result.lost_bytes, result.seconds,
+        result.seconds > 0 ? result.bytes / result.seconds : 0,
+        percentile(result.latencies_us, 50), percentile(result.latencies_us, 99));
+    if (result.cpu_ns >= 0 && result.bytes > 0) {
+        fprintf(fp, "%.1f}", result.cpu_ns / result.bytes);
+    } else {
+        fprintf(fp, "null}");
+    }
+}
+
+static void print_idle(FILE *fp, const char *model, const std::string &product, const idle_result &result)
+{
+    fprintf(fp, "    {\"model\": \"%s\", \"product\": ", model);
+    print_json_string(fp, product);
+    fprintf(fp, ", \"direction\": \"idle\", \"seconds\": %.3f, \"threads\": %d, \"rss_kb\": %ld, \"vm_kb\": %ld, \"cpu_us_per_sec\": %.1f}",
+        result.seconds, result.threads, result.rss_kb, result.vm_kb, result.seconds > 0 ? result.cpu_ns / 1e3 / result.seconds : 0);
+}
+
+static void print_error(FILE *fp, const char *model, const std::string &error)
+{
+    fprintf(fp, "    {\"model\": \"%s\", \"error\": ", model);
+    print_json_string(fp, error);
+    fprintf(fp, "}");
+}
+
+// Runs in a child process per model; writes its JSON objects to report.
+static bool bench_model(const bench_options &options, FILE *report)
+{
+    const auto model = options.sim.model;
+    const bool loopback = (options.device == nullptr);
+    tcp_peer peer(loopback ? "127.0.0.1" : "0.0.0.0");
+
+    std::unique_ptr<host_port> port;
+    std::string number;
+    if (loopback) {
+        auto usb = sim_start_emulator(options.sim, peer.get_port());
+        if (usb == nullptr) {
+            print_error(report, model, "unknown model");
+            return false;
+        }
+        port.reset(new loopback_host_port(usb));
+        number = "127-0-0-1#" + std::to_string(peer.get_port());
+    } else {
+        port.reset(new usbdevfs_host_port(options.device));
+        number = options.peer_addr;
+        std::replace(number.begin(), number.end(), '.', '-');
+        number += "#" + std::to_string(peer.get_port());
+    }
+    std::unique_ptr<host_sim> host(host_sim::create(model, port.get()));
+    if (host == nullptr) {
+        print_error(report, model, "no host driver");
+        return false;
+    }
+
+    sim_result session;
+    if (!sim_dial(host.get(), number, session)) {
+        print_error(report, model, session.error);
+        return false;
+    }
+    const auto accept_start = steady_clock::now();
+    while (!peer.is_accepted() && elapsed_s(accept_start) < 1.0) {
+        std::this_thread::sleep_for(milliseconds(1));
+    }
+
+    idle_result idle;
+    if (loopback) {
+        bench_idle(host.get(), peer, options, idle);
+    }
+
+    direction_result up, down;
+    up.direction = "up";
+    down.direction = "down";
+    std::string error;
+    if (!bench_uplink(host.get(), peer, options, loopback, up, error)
+        || !bench_downlink(host.get(), peer, options, loopback, down, error)) {
+        print_error(report, model, error);
+        host->on_hook();
+        return false;
+    }
+    host->on_hook();
+
+    if (loopback) {
+        print_idle(report, model, session.product, idle);
+        fprintf(report, ",\n");
+    }
+    print_result(report, model, session.product, up);
+    fprintf(report, ",\n");
+    print_result(report, model, session.product, down);
+    return true;
+}
+
+// One model per child process, as in me56ps2-sim: the emulator's state is
+// global and its endpoint threads never exit. Returns the child's output.
+static bool run_model(const bench_options &options, int verbose, std::string &output)
+{
+    int fds[2];
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        return false;
+    }
+    fflush(stdout);
+    const auto pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return false;
+    }
+    if (pid == 0) {
+        ::close(fds[0]);
+        const auto report = fdopen(fds[1], "w");
+        // the emulator logs to stdout; keep it off the JSON
+        if (verbose) {
+            dup2(STDERR_FILENO, STDOUT_FILENO);
+        } else if (freopen("/dev/null", "w", stdout) == nullptr) {
+            _exit(1);
+        }
+        const auto ok = bench_model(options, report);
+        fflush(report);
+        fflush(stdout);
+        _exit(ok ? 0 : 1);
+    }
+    ::close(fds[1]);
+    char buffer[4096];
+    ssize_t length;
+    while ((length = read(fds[0], buffer, sizeof(buffer))) > 0) {
+        output.append(buffer, length);
+    }
+    ::close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    if (output.empty()) {
+        output = "    {\"model\": \"" + std::string(options.sim.model) + "\", \"error\": \"benchmark process died\"}";
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static void show_usage(char *prog_name)
+{
+    printf("Usage: %s [-Sv] [-m model|all] [-b bps] [-t seconds] [-n probes] [-s bytes] [-o file]\n", prog_name);
+    printf("       %s -d /dev/bus/usb/BBB/DDD -a ip_addr -m model [...]\n", prog_name);
+    printf("  -b    line rate paced by the in-process emulator (default: 0, unpaced)\n");
+    printf("  -S    run the in-process emulator with -S (shared endpoint scheduler threads)\n");
+    printf("  -d    drive a real device through usbdevfs instead of the in-process emulator;\n");
+    printf("        it dials back to ip_addr (-a), where this benchmark listens\n");
+    printf("  -o    write the JSON results to file instead of stdout\n");
+}
+
+int main(int argc, char *argv[])
+{
+    bench_options options;
+    options.sim.line_rate = 0;
+    const char *model = "all";
+    const char *output_path = nullptr;
+    int verbose = 0;
+
+    int opt;
+    while((opt = getopt(argc, argv, "m:b:t:n:s:Sd:a:o:vh")) != -1) {
+        switch(opt) {
+            case 'm':
+                model = optarg;
+                break;
+            case 'b':
+                options.sim.line_rate = atoi(optarg);
+                break;
+            case 't':
+                options.sim.duration = atoi(optarg);
+                break;
+            case 'n':
+                options.sim.probes = atoi(optarg);
+                break;
+            case 's':
+                options.sim.probe_size = atoi(optarg);
+                break;
+            case 'S':
+                options.sim.endpoint_scheduler = true;
+                break;
+            case 'd':
+                options.device = optarg;
+                break;
+            case 'a':
+                options.peer_addr = optarg;
+                break;
+            case 'o':
+                output_path = optarg;
+                break;
+            case 'v':
+                verbose++;
+                break;
+            case 'h':
+                show_usage(argv[0]);
+                exit(0);
+            default:
+                show_usage(argv[0]);
+                exit(1);
+        }
+    }
+    if (options.sim.probe_size < 1 || options.sim.probe_size > 4096) {
+        fprintf(stderr, "Probe size must be 1 to 4096 bytes\n");
+        exit(1);
+    }
+    if (options.device != nullptr && (options.peer_addr == nullptr || strcmp(model, "all") == 0)) {
+        fprintf(stderr, "-d needs -a and a single model\n");
+        exit(1);
+    }
+    options.sim.debug_level = (verbose > 0) ? verbose - 1 : 0;
+
+    bool ok = true;
+    std::vector<std::string> outputs;
+    for (const auto name : models) {
+        if (strcmp(model, "all") != 0 && strcmp(model, name) != 0) {continue;}
+        options.sim.model = name;
+        outputs.emplace_back();
+        ok &= run_model(options, verbose, outputs.back());
+    }
+    if (outputs.empty()) {
+        fprintf(stderr, "Unknown modem model: %s\n", model);
+        exit(1);
+    }
+
+    auto fp = (output_path != nullptr) ? fopen(output_path, "w") : stdout;
+    if (fp == nullptr) {
+        perror(output_path);
+        exit(1);
+    }
+    fprintf(fp, "{\n  \"benchmark\": \"modem_bench\",\n  \"transport\": \"%s\",\n",
+        options.device != nullptr ? "usbdevfs" : "loopback");
+    fprintf(fp, "  \"endpoint_scheduler\": %s,\n", options.sim.endpoint_scheduler ? "true" : "false");
+    fprintf(fp, "  \"line_rate\": %d,\n  \"duration\": %d,\n  \"probes\": %d,\n  \"probe_size\": %d,\n  \"results\": [\n",
+        options.sim.line_rate, options.sim.duration, options.sim.probes, options.sim.probe_size);
+    for (size_t i = 0; i < outputs.size(); i++) {
+        fprintf(fp, "%s%s\n", outputs[i].c_str(), (i + 1 < outputs.size()) ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+    if (fp != stdout) {fclose(fp);}
+    return ok ? 0 : 1;
+}
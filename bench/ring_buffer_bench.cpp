@@ -0,0 +1,71 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include "ring_buffer.h"
+#include "spsc_ring_buffer.h"
+
+// Moves total_bytes from a producer thread to a consumer thread the way
+// recv_callback and the bulk IN threads do: the producer pushes network-sized
+// chunks, the consumer pulls one USB packet worth of payload at a time.
+template <typename Buffer>
+static double run(Buffer &rb, size_t total_bytes, size_t chunk_size, size_t packet_size)
+{
+    char *src = new char[chunk_size];
+    for (size_t i = 0; i < chunk_size; i++) {src[i] = static_cast<char>(i);}
+
+    const auto start = std::chrono::steady_clock::now();
+
+    std::thread producer([&]{
+        size_t sent = 0;
+        while (sent < total_bytes) {
+            const auto offset = sent % chunk_size;
+            const auto len = std::min(chunk_size - offset, total_bytes - sent);
+            const auto ret = rb.enqueue(&src[offset], len);
+            if (ret == 0) {std::this_thread::yield();}
+            sent += ret;
+        }
+    });
+
+    char dst[64];
+    size_t received = 0;
+    bool corrupted = false;
+    while (received < total_bytes) {
+        const auto ret = rb.dequeue(dst, packet_size);
+        if (ret == 0) {std::this_thread::yield(); continue;}
+        if (!corrupted && static_cast<unsigned char>(dst[0]) != static_cast<unsigned char>((received % chunk_size) & 0xff)) {
+            corrupted = true;
+        }
+        received += ret;
+    }
+    producer.join();
+
+    const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    delete[] src;
+
+    if (corrupted) {printf("  warning: data mismatch detected\n");}
+    return total_bytes / elapsed / (1024 * 1024);
+}
+
+int main(int argc, char *argv[])
+{
+    const size_t total_mb = (argc > 1) ? atoi(argv[1]) : 256;
+    const size_t total_bytes = total_mb * 1024 * 1024;
+    const size_t buffer_size = 524288;
+    const size_t chunk_sizes[] = {64, 1448};
+    const size_t packet_size = 62;
+
+    printf("transfer %zu MB, buffer %zu bytes, consumer reads %zu bytes per packet\n", total_mb, buffer_size, packet_size);
+    for (const auto chunk_size : chunk_sizes) {
+        ring_buffer<char> locked(buffer_size);
+        spsc_ring_buffer<char> lock_free(buffer_size);
+        printf("producer chunk %4zu bytes: ring_buffer %8.1f MB/s, spsc_ring_buffer %8.1f MB/s\n",
+            chunk_size,
+            run(locked, total_bytes, chunk_size, packet_size),
+            run(lock_free, total_bytes, chunk_size, packet_size));
+    }
+
+    return 0;
+}
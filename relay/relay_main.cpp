@@ -0,0 +1,80 @@
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <thread>
+#include <unistd.h>
+
+#include "relay_server.h"
+
+constexpr auto RELAY_DEFAULT_PORT = 10023;
+
+void show_usage(char *prog_name, bool verbose)
+{
+    printf("Usage: %s [-vh] [-t threads] [-w timeout] [ip_addr] [port]\n", prog_name);
+    if (!verbose) {return;}
+
+    printf("\n");
+    printf("Options:\n");
+    printf("  -t    number of worker threads (default: number of CPUs)\n");
+    printf("  -w    seconds a client waits for its partner before it is closed (default: 300)\n");
+    printf("  -v    verbose. increment log level\n");
+    printf("  -h    show this help message.\n");
+    printf("\n");
+    printf("Parameters:\n");
+    printf("  ip_addr       IPv4 address to listen on (default: 0.0.0.0)\n");
+    printf("  port          port number (default: %d)\n", RELAY_DEFAULT_PORT);
+    printf("\n");
+    printf("Both emulators dial the relay with the same session code,\n");
+    printf("e.g. ATD203-0-113-1#%d*1234\n", RELAY_DEFAULT_PORT);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    int debug_level = 0;
+    int worker_count = std::thread::hardware_concurrency();
+    const char *ip_addr = "0.0.0.0";
+    int port = RELAY_DEFAULT_PORT;
+    int wait_timeout = 300;
+
+    while ((opt = getopt(argc, argv, "t:w:vh")) != -1) {
+        switch (opt) {
+            case 't':
+                worker_count = atoi(optarg);
+                break;
+            case 'w':
+                wait_timeout = atoi(optarg);
+                break;
+            case 'v':
+                debug_level++;
+                break;
+            case 'h':
+                show_usage(argv[0], true);
+                exit(0);
+            default:
+                show_usage(argv[0], false);
+                exit(1);
+        }
+    }
+    if (optind < argc) {ip_addr = argv[optind++];}
+    if (optind < argc) {port = atoi(argv[optind++]);}
+    if (port < 1 || port > 65535) {
+        show_usage(argv[0], false);
+        exit(1);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    try {
+        relay_server relay(ip_addr, port, worker_count);
+        relay.set_debug_level(debug_level);
+        relay.set_wait_timeout(std::chrono::seconds(wait_timeout));
+        relay.run();
+    } catch (const std::exception &e) {
+        printf("%s\n", e.what());
+        return 1;
+    }
+
+    return 0;
+}
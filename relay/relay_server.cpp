@@ -0,0 +1,533 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+
+#include "relay_server.h"
+
+constexpr auto RELAY_MAX_EVENTS = 64;
+constexpr auto RELAY_READ_SIZE = 16384U;
+constexpr auto RELAY_MAX_HELLO = 64U;
+constexpr auto RELAY_MAX_CODE = 32U;
+constexpr auto RELAY_MAX_PENDING = 65536U;   // buffered while waiting for the partner
+constexpr auto RELAY_HIGH_WATERMARK = 262144U; // stop reading while the partner's output is this large
+constexpr auto RELAY_HELLO_TIMEOUT = std::chrono::seconds(10);
+constexpr auto RELAY_DEFAULT_WAIT_TIMEOUT = std::chrono::seconds(300);
+
+// epoll data holds a connection id; these values are not connections
+constexpr uint64_t RELAY_EVENT_LISTEN = 0;
+constexpr uint64_t RELAY_EVENT_HANDOFF = ~(uint64_t)0;
+constexpr uint64_t RELAY_EVENT_SWEEP = ~(uint64_t)1;
+
+struct relay_server::connection {
+    uint64_t id;
+    int fd;
+    worker *owner;
+    connection *peer = nullptr;
+    std::string code;          // empty until the hello line has been received
+    std::string hello;
+    std::vector<char> pending; // data received before pairing
+    std::vector<char> out;     // data waiting to be written to fd
+    size_t out_offset = 0;
+    bool paused = false;       // not reading because the partner is backed up
+    bool closing = false;      // close once out has been flushed
+    uint32_t events = 0;
+    // closed by the sweep after this unless paired by then
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+};
+
+struct relay_server::worker {
+    int epoll_fd = -1;
+    int listen_fd = -1;
+    int handoff_fd = -1;
+    int sweep_fd = -1;
+    std::mutex handoff_mtx;
+    std::vector<std::pair<connection *, uint64_t>> handoffs; // newcomer, id of the waiting client
+    std::unordered_map<uint64_t, connection *> connections;
+};
+
+int relay_server::open_listen_socket(void)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr(ip_addr.c_str());
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        throw std::runtime_error((std::string) "relay_server: socket(): " + std::strerror(errno));
+    }
+    const int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+
+    if (bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0) {
+        ::close(fd);
+        throw std::runtime_error((std::string) "relay_server: bind(): " + std::strerror(errno));
+    }
+    if (listen(fd, SOMAXCONN) < 0) {
+        ::close(fd);
+        throw std::runtime_error((std::string) "relay_server: listen(): " + std::strerror(errno));
+    }
+    return fd;
+}
+
+relay_server::relay_server(const char *ip_addr, uint16_t port, int worker_count)
+{
+    relay_server::ip_addr = ip_addr;
+    relay_server::port = port;
+    wait_timeout = RELAY_DEFAULT_WAIT_TIMEOUT;
+
+    for (int i = 0; i < std::max(worker_count, 1); i++) {
+        auto w = new worker();
+        w->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        w->handoff_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        w->sweep_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (w->epoll_fd < 0 || w->handoff_fd < 0 || w->sweep_fd < 0) {
+            throw std::runtime_error((std::string) "relay_server: epoll/eventfd/timerfd: " + std::strerror(errno));
+        }
+        struct itimerspec interval;
+        memset(&interval, 0, sizeof(interval));
+        interval.it_value.tv_sec = 1;
+        interval.it_interval.tv_sec = 1;
+        timerfd_settime(w->sweep_fd, 0, &interval, nullptr);
+        w->listen_fd = open_listen_socket();
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u64 = RELAY_EVENT_LISTEN;
+        epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->listen_fd, &ev);
+        ev.data.u64 = RELAY_EVENT_HANDOFF;
+        epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->handoff_fd, &ev);
+        ev.data.u64 = RELAY_EVENT_SWEEP;
+        epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->sweep_fd, &ev);
+
+        workers.push_back(w);
+    }
+}
+
+relay_server::~relay_server()
+{
+    stop();
+    for (auto w : workers) {
+        for (auto &entry : w->connections) {
+            ::close(entry.second->fd);
+            delete entry.second;
+        }
+        ::close(w->listen_fd);
+        ::close(w->handoff_fd);
+        ::close(w->sweep_fd);
+        ::close(w->epoll_fd);
+        delete w;
+    }
+}
+
+void relay_server::set_debug_level(const int level)
+{
+    debug_level = level;
+}
+
+// How long a client that sent its hello waits for the partner before it is closed.
+void relay_server::set_wait_timeout(const std::chrono::seconds &timeout)
+{
+    wait_timeout = timeout;
+}
+
+void relay_server::run(void)
+{
+    printf("relay_server: listening on %s:%d with %ld worker(s).\n", ip_addr.c_str(), port, (long) workers.size());
+    for (size_t i = 1; i < workers.size(); i++) {
+        threads.push_back(new std::thread(&relay_server::worker_thread, this, workers[i]));
+    }
+    worker_thread(workers[0]);
+}
+
+void relay_server::stop(void)
+{
+    running.store(false);
+    const uint64_t value = 1;
+    for (auto w : workers) {
+        if (write(w->handoff_fd, &value, sizeof(value)) < 0) {(void)value;}
+    }
+    for (auto t : threads) {
+        if (t->joinable() && t->get_id() != std::this_thread::get_id()) {
+            t->join();
+        }
+        delete t;
+    }
+    threads.clear();
+}
+
+void* relay_server::worker_thread(worker *w)
+{
+    struct epoll_event events[RELAY_MAX_EVENTS];
+
+    while (running.load()) {
+        auto ret = epoll_wait(w->epoll_fd, events, RELAY_MAX_EVENTS, -1);
+        if (ret < 0) {
+            if (errno == EINTR) {continue;}
+            printf("relay_server: epoll_wait(): %s\n", std::strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < ret; i++) {
+            const auto data = events[i].data.u64;
+            if (data == RELAY_EVENT_LISTEN) {
+                handle_accept(w);
+                continue;
+            }
+            if (data == RELAY_EVENT_HANDOFF) {
+                handle_handoff(w);
+                continue;
+            }
+            if (data == RELAY_EVENT_SWEEP) {
+                handle_sweep(w);
+                continue;
+            }
+
+            // a connection closed earlier in this batch is no longer in the table
+            auto it = w->connections.find(data);
+            if (it != w->connections.end() && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                handle_read(w, it->second);
+                it = w->connections.find(data);
+            }
+            if (it != w->connections.end() && (events[i].events & EPOLLOUT)) {
+                handle_write(w, it->second);
+            }
+        }
+    }
+
+    return nullptr;
+}
+
+void relay_server::handle_accept(worker *w)
+{
+    while (true) {
+        auto fd = accept4(w->listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                printf("relay_server: accept(): %s\n", std::strerror(errno));
+            }
+            return;
+        }
+        const int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        auto c = new connection();
+        c->id = next_id++;
+        c->fd = fd;
+        c->owner = w;
+        c->events = EPOLLIN;
+        c->deadline = std::chrono::steady_clock::now() + RELAY_HELLO_TIMEOUT;
+        w->connections[c->id] = c;
+
+        struct epoll_event ev;
+        ev.events = c->events;
+        ev.data.u64 = c->id;
+        epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+
+        if (debug_level >= 2) {printf("relay_server: client %lu connected.\n", (unsigned long) c->id);}
+    }
+}
+
+void relay_server::handle_handoff(worker *w)
+{
+    uint64_t value;
+    if (read(w->handoff_fd, &value, sizeof(value)) < 0) {(void)value;}
+
+    std::vector<std::pair<connection *, uint64_t>> handoffs;
+    {
+        std::lock_guard<std::mutex> lock(w->handoff_mtx);
+        handoffs.swap(w->handoffs);
+    }
+
+    for (auto &entry : handoffs) {
+        auto c = entry.first;
+        w->connections[c->id] = c;
+
+        struct epoll_event ev;
+        ev.events = c->events;
+        ev.data.u64 = c->id;
+        epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, c->fd, &ev);
+
+        const auto it = w->connections.find(entry.second);
+        if (it == w->connections.end()) {
+            // the waiting client hung up meanwhile
+            close_connection(w, c);
+            continue;
+        }
+        link(w, c, it->second);
+    }
+}
+
+// Closes the clients whose hello or partner did not arrive in time.
+void relay_server::handle_sweep(worker *w)
+{
+    uint64_t expirations;
+    if (read(w->sweep_fd, &expirations, sizeof(expirations)) < 0) {(void)expirations;}
+
+    const auto now = std::chrono::steady_clock::now();
+    std::vector<connection *> expired;
+    for (auto &entry : w->connections) {
+        if (entry.second->deadline <= now) {
+            expired.push_back(entry.second);
+        }
+    }
+    for (auto c : expired) {
+        if (debug_level >= 1) {
+            if (c->code.empty()) {
+                printf("relay_server: client %lu: no hello in time.\n", (unsigned long) c->id);
+            } else {
+                printf("relay_server: client %lu: no partner in session %s in time.\n", (unsigned long) c->id, c->code.c_str());
+            }
+        }
+        // unpaired, so closing it does not touch any other connection
+        close_connection(w, c);
+    }
+}
+
+void relay_server::handle_read(worker *w, connection *c)
+{
+    char buf[RELAY_READ_SIZE];
+    auto len = recv(c->fd, buf, sizeof(buf), 0);
+    if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return;
+    }
+    if (len <= 0) {
+        close_connection(w, c);
+        return;
+    }
+
+    const char *data = buf;
+    size_t length = len;
+    if (c->code.empty()) {
+        const auto newline = static_cast<const char *>(memchr(data, '\n', length));
+        const auto used = newline ? static_cast<size_t>(newline - data + 1) : length;
+        c->hello.append(data, used);
+        data += used;
+        length -= used;
+        if (newline == nullptr) {
+            if (c->hello.size() > RELAY_MAX_HELLO) {close_connection(w, c);}
+            return;
+        }
+        // the rest of this read is payload: keep it until the pair exists
+        c->pending.insert(c->pending.end(), data, data + length);
+        handle_hello(w, c);
+        return;
+    }
+
+    if (c->peer == nullptr) {
+        c->pending.insert(c->pending.end(), data, data + length);
+        if (c->pending.size() >= RELAY_MAX_PENDING) {
+            c->paused = true;
+            update_events(w, c);
+        }
+        return;
+    }
+    forward(w, c, data, length);
+}
+
+void relay_server::handle_write(worker *w, connection *c)
+{
+    if (!flush(w, c)) {
+        return;
+    }
+    update_events(w, c);
+}
+
+void relay_server::handle_hello(worker *w, connection *c)
+{
+    // "RELAY <code>\r\n"
+    std::string line = c->hello;
+    while (!line.empty() && (line.back() == '\n' || line.back() == '\r')) {line.pop_back();}
+    if (line.compare(0, 6, "RELAY ") != 0 || line.size() == 6 || line.size() - 6 > RELAY_MAX_CODE) {
+        if (debug_level >= 1) {printf("relay_server: client %lu: bad hello.\n", (unsigned long) c->id);}
+        close_connection(w, c);
+        return;
+    }
+    c->code = line.substr(6);
+    c->hello.clear();
+
+    // the partner may belong to another worker: only touch it under waiting_mtx
+    connection *partner = nullptr;
+    worker *target = nullptr;
+    uint64_t partner_id = 0;
+    {
+        std::lock_guard<std::mutex> lock(waiting_mtx);
+        const auto it = waiting.find(c->code);
+        if (it == waiting.end()) {
+            waiting[c->code] = c;
+        } else {
+            partner = it->second;
+            target = partner->owner;
+            partner_id = partner->id;
+            waiting.erase(it);
+        }
+    }
+
+    if (partner == nullptr) {
+        c->deadline = std::chrono::steady_clock::now() + wait_timeout;
+        if (debug_level >= 2) {printf("relay_server: client %lu waits in session %s.\n", (unsigned long) c->id, c->code.c_str());}
+        if (!c->pending.empty() && c->pending.size() >= RELAY_MAX_PENDING) {
+            c->paused = true;
+            update_events(w, c);
+        }
+        return;
+    }
+
+    if (target == w) {
+        link(w, c, partner);
+        return;
+    }
+
+    // move the newcomer to the worker that owns the waiting client
+    epoll_ctl(w->epoll_fd, EPOLL_CTL_DEL, c->fd, nullptr);
+    w->connections.erase(c->id);
+    c->owner = target;
+    {
+        std::lock_guard<std::mutex> lock(target->handoff_mtx);
+        target->handoffs.emplace_back(c, partner_id);
+    }
+    const uint64_t value = 1;
+    if (write(target->handoff_fd, &value, sizeof(value)) < 0) {(void)value;}
+}
+
+void relay_server::link(worker *w, connection *a, connection *b)
+{
+    a->peer = b;
+    b->peer = a;
+    a->deadline = b->deadline = std::chrono::steady_clock::time_point::max();
+    const auto count = ++session_count;
+    if (debug_level >= 1) {
+        printf("relay_server: session %s paired (clients %lu, %lu), %ld active.\n",
+            a->code.c_str(), (unsigned long) a->id, (unsigned long) b->id, count);
+    }
+
+    for (auto c : {a, b}) {
+        std::vector<char> pending;
+        pending.swap(c->pending);
+        c->paused = false;
+        if (!pending.empty()) {
+            forward(w, c, pending.data(), pending.size());
+        }
+        update_events(w, c);
+    }
+}
+
+void relay_server::forward(worker *w, connection *from, const char *data, size_t length)
+{
+    auto to = from->peer;
+    if (to->out_offset == to->out.size()) {
+        // nothing queued: try to write straight away
+        auto ret = send(to->fd, data, length, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            // the error is reported again as EPOLLERR on to->fd, which closes it
+            return;
+        }
+        if (ret > 0) {
+            data += ret;
+            length -= ret;
+        }
+        to->out.clear();
+        to->out_offset = 0;
+    }
+    if (length == 0) {
+        return;
+    }
+
+    to->out.insert(to->out.end(), data, data + length);
+    update_events(w, to);
+    if (to->out.size() - to->out_offset >= RELAY_HIGH_WATERMARK && !from->paused) {
+        from->paused = true;
+        update_events(w, from);
+    }
+}
+
+// Writes queued output. Returns false if the connection was closed.
+bool relay_server::flush(worker *w, connection *c)
+{
+    while (c->out_offset < c->out.size()) {
+        auto ret = send(c->fd, c->out.data() + c->out_offset, c->out.size() - c->out_offset, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (ret < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            close_connection(w, c);
+            return false;
+        }
+        c->out_offset += ret;
+    }
+    c->out.clear();
+    c->out_offset = 0;
+
+    if (c->closing) {
+        close_connection(w, c);
+        return false;
+    }
+    if (c->peer != nullptr && c->peer->paused) {
+        c->peer->paused = false;
+        update_events(w, c->peer);
+    }
+    return true;
+}
+
+void relay_server::update_events(worker *w, connection *c)
+{
+    uint32_t events = 0;
+    if (!c->paused && !c->closing) {events |= EPOLLIN;}
+    if (c->out_offset < c->out.size()) {events |= EPOLLOUT;}
+    if (events == c->events) {
+        return;
+    }
+    c->events = events;
+
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.u64 = c->id;
+    epoll_ctl(w->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+void relay_server::close_connection(worker *w, connection *c)
+{
+    if (!c->code.empty() && c->peer == nullptr) {
+        std::lock_guard<std::mutex> lock(waiting_mtx);
+        const auto it = waiting.find(c->code);
+        if (it != waiting.end() && it->second == c) {
+            waiting.erase(it);
+        }
+    }
+
+    auto peer = c->peer;
+    if (peer != nullptr) {
+        const auto count = --session_count;
+        if (debug_level >= 1) {printf("relay_server: session %s closed, %ld active.\n", c->code.c_str(), count);}
+        // let the partner drain what it still has queued, then hang up
+        peer->peer = nullptr;
+        peer->closing = true;
+        c->peer = nullptr;
+    }
+
+    epoll_ctl(w->epoll_fd, EPOLL_CTL_DEL, c->fd, nullptr);
+    ::close(c->fd);
+    w->connections.erase(c->id);
+    if (debug_level >= 2) {printf("relay_server: client %lu disconnected.\n", (unsigned long) c->id);}
+    delete c;
+
+    if (peer != nullptr) {
+        if (peer->out_offset == peer->out.size()) {
+            close_connection(w, peer);
+        } else {
+            update_events(w, peer);
+        }
+    }
+}
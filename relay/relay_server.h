@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Rendezvous relay for me56ps2 emulators. Each client connects over TCP and
+// sends "RELAY <session code>\r\n"; the first two clients with the same code
+// are paired and every byte is forwarded between them.
+//
+// Each worker thread runs its own epoll loop with a SO_REUSEPORT listen
+// socket. When the two halves of a pair were accepted by different workers,
+// the newcomer is handed over to the worker that owns the waiting client.
+//
+// A client that sends no hello or finds no partner in time is closed by a
+// once-a-second sweep of each worker's connections.
+class relay_server {
+    public:
+        struct connection;
+        struct worker;
+    private:
+        std::string ip_addr;
+        uint16_t port;
+        int debug_level = 0;
+        std::chrono::seconds wait_timeout;
+        std::atomic<bool> running{true};
+        std::vector<worker *> workers;
+        std::vector<std::thread *> threads;
+        std::mutex waiting_mtx;
+        std::unordered_map<std::string, connection *> waiting; // guarded by waiting_mtx
+        std::atomic<uint64_t> next_id{1}; // 0 is the listen socket
+        std::atomic<long> session_count{0};
+        int open_listen_socket(void);
+        void* worker_thread(worker *w);
+        void handle_accept(worker *w);
+        void handle_read(worker *w, connection *c);
+        void handle_write(worker *w, connection *c);
+        void handle_handoff(worker *w);
+        void handle_sweep(worker *w);
+        void handle_hello(worker *w, connection *c);
+        void link(worker *w, connection *a, connection *b);
+        void forward(worker *w, connection *from, const char *data, size_t length);
+        bool flush(worker *w, connection *c);
+        void update_events(worker *w, connection *c);
+        void close_connection(worker *w, connection *c);
+    public:
+        relay_server(const char *ip_addr, uint16_t port, int worker_count);
+        ~relay_server();
+        void set_debug_level(const int level);
+        void set_wait_timeout(const std::chrono::seconds &timeout);
+        void run(void);
+        void stop(void);
+};
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <linux/usb/ch9.h>
+
+// The USB host controller under host_sim: the loopback gadget in-process, or
+// a real modem (or an emulator on a UDC) through usbdevfs. Transfers move
+// one packet and return its length, or -1 on timeout, stall or error.
+class host_port {
+    public:
+        virtual ~host_port() {}
+        virtual bool open(void) = 0;
+        virtual int control(const struct usb_ctrlrequest &ctrl, void *data, const std::chrono::milliseconds &timeout) = 0;
+        virtual bool set_configuration(uint8_t value, const std::vector<uint8_t> &interfaces, const std::chrono::milliseconds &timeout) = 0;
+        virtual int bulk_write(uint8_t address, const void *data, size_t length, const std::chrono::milliseconds &timeout) = 0;
+        virtual int bulk_read(uint8_t address, void *data, size_t max_length, const std::chrono::milliseconds &timeout) = 0;
+};
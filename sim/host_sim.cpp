@@ -0,0 +1,301 @@
+#include <algorithm>
+#include <cstring>
+#include <pthread.h>
+#include <time.h>
+
+#include "host_sim.h"
+
+constexpr auto HOST_SIM_CONTROL_TIMEOUT = std::chrono::milliseconds(1000);
+constexpr auto HOST_SIM_STATUS_TIMEOUT = std::chrono::milliseconds(10);
+
+host_sim::host_sim(host_port *port)
+{
+    host_sim::port = port;
+}
+
+host_sim::~host_sim()
+{
+    polling.store(false);
+    if (status_poller.joinable()) {
+        status_poller.join();
+    }
+}
+
+host_sim *host_sim::create(const char *model, host_port *port)
+{
+    if (strcmp(model, "Omron") == 0) {return new omron_sim(port);}
+    if (strcmp(model, "SmartSCM") == 0) {return new smartscm_sim(port);}
+    if (strcmp(model, "OnlineStation") == 0) {return new onlinestation_sim(port);}
+    if (strcmp(model, "Lucent") == 0) {return new lucent_sim(port);}
+    return nullptr;
+}
+
+bool host_sim::fail(const std::string &message)
+{
+    error = message;
+    return false;
+}
+
+int host_sim::control(uint8_t request_type, uint8_t request, uint16_t value, uint16_t index, void *data, uint16_t length)
+{
+    struct usb_ctrlrequest ctrl;
+    ctrl.bRequestType = request_type;
+    ctrl.bRequest = request;
+    ctrl.wValue = __cpu_to_le16(value);
+    ctrl.wIndex = __cpu_to_le16(index);
+    ctrl.wLength = __cpu_to_le16(length);
+    return port->control(ctrl, data, HOST_SIM_CONTROL_TIMEOUT);
+}
+
+// Reads the device, configuration and product string descriptors, checks
+// that the endpoints this driver uses are declared, then selects the
+// configuration and runs the model's setup.
+bool host_sim::enumerate(std::string *product)
+{
+    if (!port->open()) {
+        return fail("cannot open the device");
+    }
+
+    struct usb_device_descriptor device;
+    if (control(USB_DIR_IN, USB_REQ_GET_DESCRIPTOR, USB_DT_DEVICE << 8, 0, &device, sizeof(device)) != sizeof(device)
+        || device.bDescriptorType != USB_DT_DEVICE) {
+        return fail("GET_DESCRIPTOR(DEVICE) failed");
+    }
+
+    uint8_t config[HOST_SIM_MAX_PACKET];
+    if (control(USB_DIR_IN, USB_REQ_GET_DESCRIPTOR, USB_DT_CONFIG << 8 | config_index(), 0, config, USB_DT_CONFIG_SIZE) != USB_DT_CONFIG_SIZE) {
+        return fail("GET_DESCRIPTOR(CONFIG) failed");
+    }
+    const auto total_length = std::min<size_t>(config[2] | config[3] << 8, sizeof(config));
+    if (control(USB_DIR_IN, USB_REQ_GET_DESCRIPTOR, USB_DT_CONFIG << 8 | config_index(), 0, config, total_length) != static_cast<int>(total_length)) {
+        return fail("GET_DESCRIPTOR(CONFIG) failed");
+    }
+    bool has_out = false, has_in = false;
+    std::vector<uint8_t> interfaces;
+    for (size_t pos = 0; pos + 2 <= total_length && config[pos] != 0; pos += config[pos]) {
+        if (config[pos + 1] == USB_DT_INTERFACE && pos + 2 < total_length
+            && std::find(interfaces.begin(), interfaces.end(), config[pos + 2]) == interfaces.end()) {
+            interfaces.push_back(config[pos + 2]);
+        }
+        if (config[pos + 1] == USB_DT_ENDPOINT && pos + 2 < total_length) {
+            has_out |= (config[pos + 2] == out_address());
+            has_in |= (config[pos + 2] == in_address());
+        }
+    }
+    if (!has_out || !has_in) {
+        return fail("data endpoints missing from the configuration descriptor");
+    }
+
+    uint8_t string[HOST_SIM_MAX_PACKET];
+    const auto length = control(USB_DIR_IN, USB_REQ_GET_DESCRIPTOR, USB_DT_STRING << 8 | device.iProduct, 0x0409, string, 255);
+    product->clear();
+    for (int i = 2; i + 1 < length; i += 2) {
+        // ASCII is all the modems use
+        product->push_back(static_cast<char>(string[i]));
+    }
+
+    if (!port->set_configuration(config[5], interfaces, HOST_SIM_CONTROL_TIMEOUT)) {
+        return fail("SET_CONFIGURATION failed");
+    }
+    if (!setup()) {
+        return fail("setup requests failed");
+    }
+    if (!status_addresses().empty() && !polling.exchange(true)) {
+        status_poller = std::thread(&host_sim::poll_status, this);
+    }
+    return true;
+}
+
+// Reads and discards the status packets; a timeout just moves on to the
+// next endpoint.
+void host_sim::poll_status(void)
+{
+    const auto addresses = status_addresses();
+    uint8_t packet[HOST_SIM_MAX_PACKET];
+    while (polling.load()) {
+        for (const auto address : addresses) {
+            port->bulk_read(address, packet, sizeof(packet), HOST_SIM_STATUS_TIMEOUT);
+        }
+    }
+}
+
+// CPU time of the status poller, so benchmarks can leave it out.
+std::chrono::nanoseconds host_sim::get_poller_cpu_time(void)
+{
+    clockid_t clock;
+    struct timespec ts;
+    if (!status_poller.joinable() || pthread_getcpuclockid(status_poller.native_handle(), &clock) != 0
+        || clock_gettime(clock, &ts) != 0) {
+        return std::chrono::nanoseconds(0);
+    }
+    return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+
+size_t host_sim::frame(const char *data, size_t length, uint8_t *packet) const
+{
+    memcpy(packet, data, length);
+    return length;
+}
+
+size_t host_sim::unframe(const uint8_t *packet, size_t length, char *data) const
+{
+    memcpy(data, packet, length);
+    return length;
+}
+
+// Splits data into OUT packets; returns the bytes sent, or -1 if the
+// emulator stopped reading.
+int host_sim::write(const char *data, size_t length, const std::chrono::milliseconds &timeout)
+{
+    uint8_t packet[HOST_SIM_MAX_PACKET];
+    size_t sent = 0;
+    while (sent < length) {
+        const auto chunk = std::min(length - sent, max_payload());
+        const auto packet_length = frame(&data[sent], chunk, packet);
+        if (port->bulk_write(out_address(), packet, packet_length, timeout) < 0) {
+            fail("bulk OUT timed out");
+            return -1;
+        }
+        sent += chunk;
+    }
+    return sent;
+}
+
+// Payload of one IN packet (0 for a packet without data), -1 on timeout.
+int host_sim::read(char *data, size_t max_length, const std::chrono::milliseconds &timeout)
+{
+    uint8_t packet[HOST_SIM_MAX_PACKET];
+    char payload[HOST_SIM_MAX_PACKET];
+    const auto length = port->bulk_read(in_address(), packet, sizeof(packet), timeout);
+    if (length < 0) {
+        return -1;
+    }
+    const auto payload_length = std::min(unframe(packet, length, payload), max_length);
+    memcpy(data, payload, payload_length);
+    return payload_length;
+}
+
+// Reads exactly length bytes within timeout. The idle IN packets some models
+// send keep read() from timing out on its own.
+bool host_sim::read_exactly(char *data, size_t length, const std::chrono::milliseconds &timeout)
+{
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    size_t received = 0;
+    while (received < length) {
+        if (std::chrono::steady_clock::now() >= deadline) {
+            return fail("read timed out");
+        }
+        const auto n = read(&data[received], length - received, timeout);
+        if (n < 0) {
+            return fail("read timed out");
+        }
+        received += n;
+    }
+    return true;
+}
+
+// Sends one command line and collects the response up to its result code.
+bool host_sim::command(const std::string &line, std::string *response, const std::chrono::milliseconds &timeout)
+{
+    static const char * const final_results[] = {"OK", "ERROR", "NO CARRIER", "BUSY", "NO DIALTONE", "NO ANSWER"};
+
+    const auto text = line + "\r";
+    if (write(text.data(), text.length(), timeout) < 0) {
+        return false;
+    }
+    response->clear();
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (std::chrono::steady_clock::now() < deadline) {
+        char data[HOST_SIM_MAX_PACKET];
+        const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        const auto length = read(data, sizeof(data), std::max(remaining, std::chrono::milliseconds(1)));
+        if (length > 0) {
+            response->append(data, length);
+        }
+        const auto size = response->size();
+        if (size < 2 || response->compare(size - 2, 2, "\r\n") != 0) {
+            continue;
+        }
+        const auto start = (size > 2) ? response->rfind("\r\n", size - 3) : std::string::npos;
+        const auto last = response->substr((start == std::string::npos) ? 0 : start + 2, size - 2 - ((start == std::string::npos) ? 0 : start + 2));
+        if (last.compare(0, 7, "CONNECT") == 0) {
+            return true;
+        }
+        for (const auto result : final_results) {
+            if (last == result) {return true;}
+        }
+    }
+    return fail("no result code for " + line);
+}
+
+bool omron_sim::setup(void)
+{
+    // the driver reads the status register before anything else
+    uint8_t status;
+    return control(USB_DIR_IN | USB_TYPE_VENDOR, 0x05, 0, 0, &status, 1) == 1;
+}
+
+bool omron_sim::set_dtr(bool on)
+{
+    return control(USB_DIR_OUT | USB_TYPE_VENDOR, 0x01, on ? 0x0101 : 0x0100, 0, nullptr, 0) == 0;
+}
+
+size_t omron_sim::frame(const char *data, size_t length, uint8_t *packet) const
+{
+    packet[0] = length << 2;
+    memcpy(&packet[1], data, length);
+    return 1 + length;
+}
+
+size_t omron_sim::unframe(const uint8_t *packet, size_t length, char *data) const
+{
+    if (length < 2) {
+        return 0;
+    }
+    memcpy(data, &packet[2], length - 2);
+    return length - 2;
+}
+
+bool smartscm_sim::set_dtr(bool on)
+{
+    const uint8_t triplet[3] = {0x40, 0x04, static_cast<uint8_t>(on ? 0x01 : 0x00)};
+    return port->bulk_write(USB_DIR_OUT | 1, triplet, sizeof(triplet), std::chrono::milliseconds(1000)) == sizeof(triplet);
+}
+
+size_t smartscm_sim::unframe(const uint8_t *packet, size_t length, char *data) const
+{
+    size_t data_length = 0;
+    for (size_t i = 1; i + 1 < length && packet[i] == 0x61; i += 2) {
+        data[data_length++] = packet[i + 1];
+    }
+    return data_length;
+}
+
+bool onlinestation_sim::setup(void)
+{
+    uint8_t status[2];
+    return control(USB_DIR_IN | USB_TYPE_VENDOR, 0xd0, 0, 0, status, sizeof(status)) == sizeof(status)
+        && control(USB_DIR_OUT | USB_TYPE_VENDOR, 0x10, 10, 0, nullptr, 0) == 0    // 115200 bps
+        && control(USB_DIR_OUT | USB_TYPE_VENDOR, 0x12, 0x03, 0, nullptr, 0) == 0; // 8N1
+}
+
+bool onlinestation_sim::set_dtr(bool on)
+{
+    return control(USB_DIR_OUT | USB_TYPE_VENDOR, 0x11, on ? 0x03 : 0x02, 0, nullptr, 0) == 0;
+}
+
+enum {
+    SET_LINE_CODING        = 0x20,
+    SET_CONTROL_LINE_STATE = 0x22
+};
+
+bool lucent_sim::setup(void)
+{
+    uint8_t coding[7] = {0x00, 0xc2, 0x01, 0x00, 0, 0, 8}; // 115200 bps 8N1
+    return control(USB_DIR_OUT | USB_TYPE_CLASS | USB_RECIP_INTERFACE, SET_LINE_CODING, 0, 0, coding, sizeof(coding)) == 0;
+}
+
+bool lucent_sim::set_dtr(bool on)
+{
+    return control(USB_DIR_OUT | USB_TYPE_CLASS | USB_RECIP_INTERFACE, SET_CONTROL_LINE_STATE, on ? 0x03 : 0x02, 0, nullptr, 0) == 0;
+}
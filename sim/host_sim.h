@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+#include "host_port.h"
+
+constexpr size_t HOST_SIM_MAX_PACKET = 256;
+
+// Host side of one modem model, driving the emulator through a host_port the
+// way the PS2 driver drives the real modem: enumeration through the model's descriptors,
+// its requests for DTR and the line settings, and its framing of the bulk
+// data. One instance per process, like the emulator it talks to.
+//
+// Once configured, a poller thread keeps reading the model's status
+// endpoints, as the host controller does while the driver has the port open.
+class host_sim {
+    private:
+        std::thread status_poller;
+        std::atomic<bool> polling{false};
+        void poll_status(void);
+    protected:
+        host_port *port;
+        std::string error;
+        int control(uint8_t request_type, uint8_t request, uint16_t value, uint16_t index, void *data, uint16_t length);
+        bool fail(const std::string &message);
+        virtual uint8_t config_index() const {return 0;}
+        virtual uint8_t out_address() const = 0;
+        virtual uint8_t in_address() const = 0;
+        virtual std::vector<uint8_t> status_addresses() const {return {};}
+        virtual size_t max_payload() const {return 64;}
+        virtual bool setup(void) {return true;}
+        virtual bool set_dtr(bool on) = 0;
+        virtual size_t frame(const char *data, size_t length, uint8_t *packet) const;
+        virtual size_t unframe(const uint8_t *packet, size_t length, char *data) const;
+    public:
+        host_sim(host_port *port);
+        virtual ~host_sim();
+        static host_sim *create(const char *model, host_port *port);
+        const std::string &get_error() const {return error;}
+        bool enumerate(std::string *product);
+        bool off_hook() {return set_dtr(true) || fail("DTR on failed");}
+        bool on_hook() {return set_dtr(false) || fail("DTR off failed");}
+        int write(const char *data, size_t length, const std::chrono::milliseconds &timeout);
+        int read(char *data, size_t max_length, const std::chrono::milliseconds &timeout);
+        bool read_exactly(char *data, size_t length, const std::chrono::milliseconds &timeout);
+        bool command(const std::string &line, std::string *response, const std::chrono::milliseconds &timeout);
+        bool has_status_poller(void) const {return status_poller.joinable();}
+        std::chrono::nanoseconds get_poller_cpu_time(void);
+};
+
+// Omron: one length byte (payload length << 2) before the OUT payload, two
+// status bytes (0x31 | DCD 0x80, 0x60) before the IN payload.
+class omron_sim : public host_sim {
+    protected:
+        uint8_t out_address() const override {return USB_DIR_OUT | 2;}
+        uint8_t in_address() const override {return USB_DIR_IN | 2;}
+        size_t max_payload() const override {return 63;}
+        bool setup(void) override;
+        bool set_dtr(bool on) override;
+        size_t frame(const char *data, size_t length, uint8_t *packet) const override;
+        size_t unframe(const uint8_t *packet, size_t length, char *data) const override;
+    public:
+        using host_sim::host_sim;
+};
+
+// SmartSCM: DTR as 0x40 command triplets on ep1 OUT, raw data on ep3 OUT,
+// IN data as an MSR byte followed by LSR/data pairs.
+class smartscm_sim : public host_sim {
+    protected:
+        uint8_t out_address() const override {return USB_DIR_OUT | 3;}
+        uint8_t in_address() const override {return USB_DIR_IN | 3;}
+        std::vector<uint8_t> status_addresses() const override {return {USB_DIR_IN | 1, USB_DIR_IN | 4};}
+        bool set_dtr(bool on) override;
+        size_t unframe(const uint8_t *packet, size_t length, char *data) const override;
+    public:
+        using host_sim::host_sim;
+};
+
+// OnlineStation: vendor requests for reset, baud rate, data bits and line
+// state; raw bulk data.
+class onlinestation_sim : public host_sim {
+    protected:
+        uint8_t out_address() const override {return USB_DIR_OUT | 2;}
+        uint8_t in_address() const override {return USB_DIR_IN | 1;}
+        std::vector<uint8_t> status_addresses() const override {return {USB_DIR_IN | 3};}
+        bool setup(void) override;
+        bool set_dtr(bool on) override;
+    public:
+        using host_sim::host_sim;
+};
+
+// Lucent: CDC-ACM class requests in the second configuration; raw bulk data.
+class lucent_sim : public host_sim {
+    protected:
+        uint8_t config_index() const override {return 1;}
+        uint8_t out_address() const override {return USB_DIR_OUT | 2;}
+        uint8_t in_address() const override {return USB_DIR_IN | 6;}
+        std::vector<uint8_t> status_addresses() const override {return {USB_DIR_IN | 4};}
+        bool setup(void) override;
+        bool set_dtr(bool on) override;
+    public:
+        using host_sim::host_sim;
+};
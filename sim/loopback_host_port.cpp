@@ -0,0 +1,29 @@
+#include "loopback_host_port.h"
+
+bool loopback_host_port::open(void)
+{
+    usb->connect();
+    return true;
+}
+
+int loopback_host_port::control(const struct usb_ctrlrequest &ctrl, void *data, const std::chrono::milliseconds &timeout)
+{
+    return usb->control(ctrl, data, timeout);
+}
+
+bool loopback_host_port::set_configuration(uint8_t value, const std::vector<uint8_t> &interfaces, const std::chrono::milliseconds &timeout)
+{
+    (void)interfaces;
+    struct usb_ctrlrequest ctrl = {USB_DIR_OUT, USB_REQ_SET_CONFIGURATION, __cpu_to_le16(value), 0, 0};
+    return usb->control(ctrl, nullptr, timeout) == 0 && usb->wait_configured(timeout);
+}
+
+int loopback_host_port::bulk_write(uint8_t address, const void *data, size_t length, const std::chrono::milliseconds &timeout)
+{
+    return usb->bulk_write(address, data, length, timeout);
+}
+
+int loopback_host_port::bulk_read(uint8_t address, void *data, size_t max_length, const std::chrono::milliseconds &timeout)
+{
+    return usb->bulk_read(address, data, max_length, timeout);
+}
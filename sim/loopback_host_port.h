@@ -0,0 +1,16 @@
+#pragma once
+
+#include "host_port.h"
+#include "usb_loopback_gadget.h"
+
+class loopback_host_port : public host_port {
+    private:
+        usb_loopback_gadget *usb;
+    public:
+        loopback_host_port(usb_loopback_gadget *usb) : usb(usb) {}
+        bool open(void) override;
+        int control(const struct usb_ctrlrequest &ctrl, void *data, const std::chrono::milliseconds &timeout) override;
+        bool set_configuration(uint8_t value, const std::vector<uint8_t> &interfaces, const std::chrono::milliseconds &timeout) override;
+        int bulk_write(uint8_t address, const void *data, size_t length, const std::chrono::milliseconds &timeout) override;
+        int bulk_read(uint8_t address, void *data, size_t max_length, const std::chrono::milliseconds &timeout) override;
+};
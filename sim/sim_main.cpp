@@ -0,0 +1,122 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "sim_runner.h"
+
+static const char * const models[] = {"Omron", "SmartSCM", "OnlineStation", "Lucent"};
+
+static void show_usage(char *prog_name, bool verbose)
+{
+    printf("Usage: %s [-Svh] [-m model] [-b bps] [-t seconds] [-n probes] [-s bytes]\n", prog_name);
+    if (!verbose) {return;}
+
+    printf("\n");
+    printf("Runs the emulator on an in-memory USB gadget and drives it like the PS2\n");
+    printf("driver of the model: enumeration, AT commands, a dial to a local TCP peer,\n");
+    printf("echo probes and a bulk transfer in each direction.\n");
+    printf("\n");
+    printf("Options:\n");
+    printf("  -m    modem model, or all (default: all)\n");
+    printf("  -b    line rate in bps, as -b of the emulator (default: 57600)\n");
+    printf("  -t    seconds of bulk transfer in each direction (default: 3)\n");
+    printf("  -n    number of echo probes (default: 200)\n");
+    printf("  -s    bytes per echo probe (default: 16)\n");
+    printf("  -S    run the emulator with -S (shared endpoint scheduler threads)\n");
+    printf("  -v    verbose. show the emulator's log; repeat to raise its log level\n");
+    printf("  -h    show this help message.\n");
+}
+
+// One model per child process: the emulator keeps its state in globals and
+// its endpoint threads never exit.
+static bool run_model(const sim_options &options, int verbose)
+{
+    fflush(stdout);
+    const auto pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return false;
+    }
+    if (pid == 0) {
+        const auto report = fdopen(dup(STDOUT_FILENO), "w");
+        if (!verbose) {
+            freopen("/dev/null", "w", stdout);
+        }
+        const auto result = sim_run(options);
+        if (result.ok) {
+            fprintf(report, "%-14s ok   connect %7.1f ms  rtt p50 %6.2f ms p99 %6.2f ms  up %9.0f B/s  down %8.0f B/s  errors %lu  (%s)\n",
+                options.model, result.connect_ms, result.latency_p50_ms, result.latency_p99_ms,
+                result.up_bytes_per_sec, result.down_bytes_per_sec, result.down_errors, result.product.c_str());
+        } else {
+            fprintf(report, "%-14s FAIL %s\n", options.model, result.error.c_str());
+        }
+        fflush(report);
+        fflush(stdout);
+        _exit(result.ok && result.down_errors == 0 ? 0 : 1);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char *argv[])
+{
+    sim_options options;
+    const char *model = "all";
+    int verbose = 0;
+
+    int opt;
+    while((opt = getopt(argc, argv, "m:b:t:n:s:Svh")) != -1) {
+        switch(opt) {
+            case 'm':
+                model = optarg;
+                break;
+            case 'b':
+                options.line_rate = atoi(optarg);
+                break;
+            case 't':
+                options.duration = atoi(optarg);
+                break;
+            case 'n':
+                options.probes = atoi(optarg);
+                break;
+            case 's':
+                options.probe_size = atoi(optarg);
+                break;
+            case 'S':
+                options.endpoint_scheduler = true;
+                break;
+            case 'v':
+                verbose++;
+                break;
+            case 'h':
+                show_usage(argv[0], true);
+                exit(0);
+            default:
+                show_usage(argv[0], false);
+                exit(1);
+        }
+    }
+    if (options.probe_size < 1 || options.probe_size > 4096) {
+        fprintf(stderr, "Probe size must be 1 to 4096 bytes\n");
+        exit(1);
+    }
+    options.debug_level = (verbose > 0) ? verbose - 1 : 0;
+
+    bool ok = true;
+    bool found = false;
+    for (const auto name : models) {
+        if (strcmp(model, "all") != 0 && strcmp(model, name) != 0) {continue;}
+        found = true;
+        options.model = name;
+        ok &= run_model(options, verbose);
+    }
+    if (!found) {
+        fprintf(stderr, "Unknown modem model: %s\n", model);
+        show_usage(argv[0], false);
+        exit(1);
+    }
+    return ok ? 0 : 1;
+}
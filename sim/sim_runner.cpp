@@ -0,0 +1,222 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "host_sim.h"
+#include "loopback_host_port.h"
+#include "sim_runner.h"
+#include "tcp_peer.h"
+
+#include "app_context.h"
+#include "io_reactor.h"
+#include "main_app.h"
+#include "modem.h"
+#include "pppd_supervisor.h"
+#include "pty_dev.h"
+#include "tcp_sock.h"
+
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+
+constexpr auto SIM_COMMAND_TIMEOUT = milliseconds(2000);
+constexpr auto SIM_DIAL_TIMEOUT = milliseconds(10000);
+constexpr auto SIM_IO_TIMEOUT = milliseconds(1000);
+constexpr size_t SIM_FLOW_CONTROL_HEADROOM = 4096; // as in main_app.cpp
+
+static double elapsed_ms(const steady_clock::time_point &start)
+{
+    return std::chrono::duration<double, std::milli>(steady_clock::now() - start).count();
+}
+
+usb_loopback_gadget *sim_start_emulator(const sim_options &options, uint16_t port)
+{
+    ctx.current_modem = Modem::getInstance(options.model);
+    if (ctx.current_modem == nullptr) {
+        return nullptr;
+    }
+    ctx.debug_level = options.debug_level;
+    ctx.endpoint_scheduler = options.endpoint_scheduler;
+    ctx.usb_tx_pacer.set_line_rate(options.line_rate);
+    ctx.usb_tx_buffer.set_data_notifier([]{ctx.usb_events.post(EVENT_DATA);});
+    const auto high_watermark = ctx.usb_tx_buffer.get_buffer_size() - SIM_FLOW_CONTROL_HEADROOM;
+    const auto low_watermark = ctx.usb_tx_buffer.get_buffer_size() / 2;
+
+    auto usb = new usb_loopback_gadget();
+    usb->set_debug_level(options.debug_level);
+    ctx.usb = usb;
+
+    ctx.reactor = new io_reactor();
+    ctx.reactor->set_debug_level(options.debug_level);
+    ctx.pty = new pty_dev(ctx.reactor);
+    ctx.pppd = new pppd_supervisor(ctx.reactor);
+
+    ctx.sock = new tcp_sock(ctx.reactor, false, "127.0.0.1", port);
+    ctx.sock->set_debug_level(options.debug_level);
+    ctx.sock->set_ring_callback(ring_callback);
+    ctx.sock->set_recv_buffer(&ctx.usb_tx_buffer);
+    ctx.sock->set_recv_callback(recv_callback);
+    ctx.sock->set_hangup_callback(hangup_callback);
+    ctx.sock->set_flow_control(high_watermark, low_watermark);
+
+    std::thread([]{
+        try {
+            while (event_usb_control_loop());
+        } catch (const std::exception &) {
+            // the gadget was closed
+        }
+    }).detach();
+    return usb;
+}
+
+static bool measure_latency(host_sim *host, tcp_peer &peer, const sim_options &options, sim_result &result)
+{
+    peer.set_mode(tcp_peer::mode::echo);
+    std::vector<char> probe(options.probe_size), echo(options.probe_size);
+    std::vector<double> samples;
+    for (int i = 0; i < options.probes; i++) {
+        for (int j = 0; j < options.probe_size; j++) {
+            probe[j] = 'a' + (i + j) % 26;
+        }
+        const auto start = steady_clock::now();
+        if (host->write(probe.data(), probe.size(), SIM_IO_TIMEOUT) < 0) {
+            result.error = host->get_error();
+            return false;
+        }
+        if (!host->read_exactly(echo.data(), echo.size(), SIM_IO_TIMEOUT) || echo != probe) {
+            result.error = "echo probe " + std::to_string(i) + " lost or corrupted";
+            return false;
+        }
+        samples.push_back(elapsed_ms(start));
+    }
+    peer.set_mode(tcp_peer::mode::idle);
+    if (samples.empty()) {
+        return true;
+    }
+    std::sort(samples.begin(), samples.end());
+    result.latency_p50_ms = samples[samples.size() / 2];
+    result.latency_p99_ms = samples[std::min(samples.size() - 1, samples.size() * 99 / 100)];
+    return true;
+}
+
+static bool measure_uplink(host_sim *host, tcp_peer &peer, const sim_options &options, sim_result &result)
+{
+    // letters only, so the data never looks like the +++ escape
+    char block[4096];
+    for (size_t i = 0; i < sizeof(block); i++) {
+        block[i] = 'A' + i % 26;
+    }
+    const auto rx_start = peer.get_rx_bytes();
+    const auto start = steady_clock::now();
+    uint64_t sent = 0;
+    while (elapsed_ms(start) < options.duration * 1000.0) {
+        const auto n = host->write(block, sizeof(block), SIM_IO_TIMEOUT);
+        if (n < 0) {
+            result.error = host->get_error();
+            return false;
+        }
+        sent += n;
+    }
+    // count what made it to the peer, not what sits in the emulator's queues
+    const auto drain_start = steady_clock::now();
+    while (peer.get_rx_bytes() - rx_start < sent && elapsed_ms(drain_start) < SIM_IO_TIMEOUT.count()) {
+        std::this_thread::sleep_for(milliseconds(1));
+    }
+    result.up_bytes_per_sec = (peer.get_rx_bytes() - rx_start) / (elapsed_ms(start) / 1000.0);
+    return true;
+}
+
+static bool measure_downlink(host_sim *host, tcp_peer &peer, const sim_options &options, sim_result &result)
+{
+    peer.set_mode(tcp_peer::mode::stream);
+    char data[HOST_SIM_MAX_PACKET];
+    uint64_t received = 0;
+    uint8_t expected = 0;
+    const auto start = steady_clock::now();
+    while (elapsed_ms(start) < options.duration * 1000.0) {
+        const auto n = host->read(data, sizeof(data), SIM_IO_TIMEOUT);
+        if (n < 0) {
+            result.error = "downlink stalled";
+            return false;
+        }
+        for (int i = 0; i < n; i++) {
+            const auto byte = static_cast<uint8_t>(data[i]);
+            if (byte != expected) {
+                result.down_errors++;
+            }
+            expected = byte + 1;
+        }
+        received += n;
+    }
+    result.down_bytes_per_sec = received / (elapsed_ms(start) / 1000.0);
+    peer.set_mode(tcp_peer::mode::idle);
+    return true;
+}
+
+bool sim_dial(host_sim *host, const std::string &number, sim_result &result)
+{
+    if (!host->enumerate(&result.product) || !host->off_hook()) {
+        result.error = host->get_error();
+        return false;
+    }
+
+    std::string response;
+    for (const auto line : {"ATZ", "ATE0", "ATI3", "ATS7=60"}) {
+        if (!host->command(line, &response, SIM_COMMAND_TIMEOUT)) {
+            result.error = host->get_error();
+            return false;
+        }
+        if (response.find("OK") == std::string::npos) {
+            result.error = std::string(line) + " was not accepted";
+            return false;
+        }
+    }
+
+    const auto dial_start = steady_clock::now();
+    if (!host->command("ATD" + number, &response, SIM_DIAL_TIMEOUT)) {
+        result.error = host->get_error();
+        return false;
+    }
+    if (response.find("CONNECT") == std::string::npos) {
+        result.error = "dial failed";
+        return false;
+    }
+    result.connect_ms = elapsed_ms(dial_start);
+    return true;
+}
+
+sim_result sim_run(const sim_options &options)
+{
+    sim_result result;
+    tcp_peer peer;
+    auto usb = sim_start_emulator(options, peer.get_port());
+    if (usb == nullptr) {
+        result.error = std::string("unknown model ") + options.model;
+        return result;
+    }
+    loopback_host_port port(usb);
+    std::unique_ptr<host_sim> host(host_sim::create(options.model, &port));
+    if (host == nullptr) {
+        result.error = std::string("no host driver for ") + options.model;
+        return result;
+    }
+
+    if (!sim_dial(host.get(), "127-0-0-1#" + std::to_string(peer.get_port()), result)) {
+        return result;
+    }
+
+    if (!measure_latency(host.get(), peer, options, result)
+        || !measure_uplink(host.get(), peer, options, result)
+        || !measure_downlink(host.get(), peer, options, result)) {
+        return result;
+    }
+
+    if (!host->on_hook()) {
+        result.error = host->get_error();
+        return result;
+    }
+    result.ok = true;
+    return result;
+}
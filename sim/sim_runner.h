@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "host_sim.h"
+
+class usb_loopback_gadget;
+
+struct sim_options {
+    const char *model = "Omron";
+    int duration = 3;        // seconds for each throughput direction
+    int probes = 200;        // echo round trips for the latency figures
+    int probe_size = 16;     // bytes per probe
+    int line_rate = 57600;   // -b of the emulator; paces the downlink
+    bool endpoint_scheduler = false; // -S of the emulator
+    int debug_level = 0;
+};
+
+struct sim_result {
+    bool ok = false;
+    std::string error;
+    std::string product;
+    double connect_ms = 0;         // ATD to CONNECT
+    double up_bytes_per_sec = 0;   // host to network
+    double down_bytes_per_sec = 0; // network to host
+    unsigned long down_errors = 0; // bytes missing or out of order in the downlink stream
+    double latency_p50_ms = 0;     // echo round trip through the emulator
+    double latency_p99_ms = 0;
+};
+
+// The part of main() that -m model -b bps -f 127.0.0.1 port runs, with the
+// loopback gadget instead of raw-gadget and the control loop on a thread of
+// its own. nullptr for an unknown model.
+usb_loopback_gadget *sim_start_emulator(const sim_options &options, uint16_t port);
+
+// Enumeration, off-hook, AT setup and ATD number; fills in product and
+// connect_ms, or error.
+bool sim_dial(host_sim *host, const std::string &number, sim_result &result);
+
+// Brings up the emulator for options.model on the loopback gadget, then
+// plays the PS2 side of a session against it: enumeration, AT setup, a dial
+// to a local TCP peer, echo probes, a bulk transfer each way and a hang-up.
+// The emulator state is process-global, so this runs once per process.
+sim_result sim_run(const sim_options &options);
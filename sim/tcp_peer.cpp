@@ -0,0 +1,124 @@
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "tcp_peer.h"
+
+tcp_peer::tcp_peer(const char *bind_addr)
+{
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        throw std::runtime_error("tcp_peer: socket failed");
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr(bind_addr);
+    addr.sin_port = 0;
+    socklen_t addr_length = sizeof(addr);
+    if (bind(listen_fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0
+        || listen(listen_fd, 1) < 0
+        || getsockname(listen_fd, reinterpret_cast<struct sockaddr *>(&addr), &addr_length) < 0) {
+        ::close(listen_fd);
+        throw std::runtime_error("tcp_peer: bind failed");
+    }
+    port = ntohs(addr.sin_port);
+    worker = std::thread(&tcp_peer::run, this);
+}
+
+tcp_peer::~tcp_peer()
+{
+    running.store(false);
+    worker.join();
+    ::close(listen_fd);
+}
+
+void tcp_peer::run(void)
+{
+    int fd = -1;
+    while (running.load() && fd < 0) {
+        struct pollfd pfd = {listen_fd, POLLIN, 0};
+        if (poll(&pfd, 1, 100) > 0) {
+            fd = accept(listen_fd, nullptr, nullptr);
+        }
+    }
+    if (fd < 0) {
+        return;
+    }
+    const int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    comm_fd.store(fd);
+    accepted.store(true);
+
+    char buffer[16384];
+    char pattern[4096];
+    uint64_t stream_offset = 0;
+    while (running.load()) {
+        const auto streaming = (current_mode.load() == mode::stream);
+        struct pollfd pfd = {fd, static_cast<short>(POLLIN | (streaming ? POLLOUT : 0)), 0};
+        if (poll(&pfd, 1, 10) <= 0) {
+            continue;
+        }
+        if (pfd.revents & (POLLHUP | POLLERR)) {
+            break;
+        }
+        if (pfd.revents & POLLIN) {
+            const auto length = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+            if (length == 0) {
+                break;
+            }
+            if (length > 0) {
+                rx_bytes += length;
+                if (current_mode.load() == mode::echo) {
+                    // small probes; blocking on a full socket here is fine
+                    if (::send(fd, buffer, length, MSG_NOSIGNAL) > 0) {tx_bytes += length;}
+                }
+            }
+        }
+        if (streaming && (pfd.revents & POLLOUT)) {
+            for (size_t i = 0; i < sizeof(pattern); i++) {
+                pattern[i] = static_cast<char>((stream_offset + i) & 0xff);
+            }
+            const auto length = ::send(fd, pattern, sizeof(pattern), MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (length > 0) {
+                stream_offset += length;
+                tx_bytes += length;
+            } else if (length < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                break;
+            }
+        }
+    }
+    comm_fd.store(-1);
+    ::close(fd);
+}
+
+// Sends data right away, on the caller's thread; for probes while idle.
+int tcp_peer::send(const char *data, size_t length)
+{
+    const auto fd = comm_fd.load();
+    if (fd < 0) {
+        return -1;
+    }
+    const auto sent = ::send(fd, data, length, MSG_NOSIGNAL);
+    if (sent > 0) {tx_bytes += sent;}
+    return sent;
+}
+
+// CPU time of the peer thread, so benchmarks can leave it out.
+std::chrono::nanoseconds tcp_peer::get_cpu_time(void)
+{
+    clockid_t clock;
+    struct timespec ts;
+    if (pthread_getcpuclockid(worker.native_handle(), &clock) != 0 || clock_gettime(clock, &ts) != 0) {
+        return std::chrono::nanoseconds(0);
+    }
+    return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
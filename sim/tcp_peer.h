@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+// The far end of the simulated call: a TCP listener (on the loopback
+// interface unless told otherwise) that takes the emulator's dial and either echoes what it
+// receives, streams a counting pattern back (byte n is n & 0xff) while
+// sinking the uplink, or just sinks it.
+class tcp_peer {
+    public:
+        enum class mode {idle, echo, stream};
+    private:
+        int listen_fd = -1;
+        uint16_t port = 0;
+        std::atomic<mode> current_mode{mode::idle};
+        std::atomic<bool> running{true};
+        std::atomic<bool> accepted{false};
+        std::atomic<int> comm_fd{-1};
+        std::atomic<uint64_t> rx_bytes{0};
+        std::atomic<uint64_t> tx_bytes{0};
+        std::thread worker;
+        void run(void);
+    public:
+        tcp_peer(const char *bind_addr = "127.0.0.1");
+        ~tcp_peer();
+        uint16_t get_port(void) const {return port;}
+        bool is_accepted(void) const {return accepted.load();}
+        void set_mode(mode m) {current_mode.store(m);}
+        uint64_t get_rx_bytes(void) const {return rx_bytes.load();}
+        uint64_t get_tx_bytes(void) const {return tx_bytes.load();}
+        int send(const char *data, size_t length);
+        std::chrono::nanoseconds get_cpu_time(void);
+};
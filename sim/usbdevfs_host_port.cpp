@@ -0,0 +1,104 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <linux/usbdevice_fs.h>
+
+#include "usbdevfs_host_port.h"
+
+usbdevfs_host_port::usbdevfs_host_port(const char *path) : path(path)
+{
+}
+
+usbdevfs_host_port::~usbdevfs_host_port()
+{
+    if (fd < 0) {
+        return;
+    }
+    for (auto interface : claimed) {
+        unsigned int number = interface;
+        ioctl(fd, USBDEVFS_RELEASEINTERFACE, &number);
+        // hand the interface back to its kernel driver
+        struct usbdevfs_ioctl command = {static_cast<int>(interface), USBDEVFS_CONNECT, nullptr};
+        ioctl(fd, USBDEVFS_IOCTL, &command);
+    }
+    ::close(fd);
+}
+
+bool usbdevfs_host_port::open(void)
+{
+    fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "usbdevfs_host_port: open %s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+int usbdevfs_host_port::control(const struct usb_ctrlrequest &ctrl, void *data, const std::chrono::milliseconds &timeout)
+{
+    struct usbdevfs_ctrltransfer transfer;
+    transfer.bRequestType = ctrl.bRequestType;
+    transfer.bRequest = ctrl.bRequest;
+    transfer.wValue = __le16_to_cpu(ctrl.wValue);
+    transfer.wIndex = __le16_to_cpu(ctrl.wIndex);
+    transfer.wLength = __le16_to_cpu(ctrl.wLength);
+    transfer.timeout = timeout.count();
+    transfer.data = data;
+    const auto length = ioctl(fd, USBDEVFS_CONTROL, &transfer);
+    if (length < 0) {
+        return -1;
+    }
+    // OUT requests report 0 like the loopback gadget does
+    return (ctrl.bRequestType & USB_DIR_IN) ? length : 0;
+}
+
+bool usbdevfs_host_port::set_configuration(uint8_t value, const std::vector<uint8_t> &interfaces, const std::chrono::milliseconds &timeout)
+{
+    (void)timeout;
+    // the kernel refuses to switch configurations while drivers are bound
+    for (auto interface : interfaces) {
+        struct usbdevfs_ioctl command = {static_cast<int>(interface), USBDEVFS_DISCONNECT, nullptr};
+        ioctl(fd, USBDEVFS_IOCTL, &command);
+    }
+    unsigned int configuration = value;
+    if (ioctl(fd, USBDEVFS_SETCONFIGURATION, &configuration) < 0) {
+        fprintf(stderr, "usbdevfs_host_port: set configuration %u: %s\n", configuration, strerror(errno));
+        return false;
+    }
+    for (auto interface : interfaces) {
+        unsigned int number = interface;
+        if (ioctl(fd, USBDEVFS_CLAIMINTERFACE, &number) < 0) {
+            fprintf(stderr, "usbdevfs_host_port: claim interface %u: %s\n", number, strerror(errno));
+            return false;
+        }
+        claimed.push_back(interface);
+    }
+    return true;
+}
+
+int usbdevfs_host_port::bulk_write(uint8_t address, const void *data, size_t length, const std::chrono::milliseconds &timeout)
+{
+    struct usbdevfs_bulktransfer transfer;
+    transfer.ep = address;
+    transfer.len = length;
+    transfer.timeout = timeout.count();
+    transfer.data = const_cast<void *>(data);
+    const auto sent = ioctl(fd, USBDEVFS_BULK, &transfer);
+    return (sent < 0) ? -1 : sent;
+}
+
+// Also serves the interrupt endpoints; usbdevfs picks the transfer type from
+// the endpoint descriptor.
+int usbdevfs_host_port::bulk_read(uint8_t address, void *data, size_t max_length, const std::chrono::milliseconds &timeout)
+{
+    struct usbdevfs_bulktransfer transfer;
+    transfer.ep = address;
+    transfer.len = max_length;
+    transfer.timeout = timeout.count();
+    transfer.data = data;
+    const auto received = ioctl(fd, USBDEVFS_BULK, &transfer);
+    return (received < 0) ? -1 : received;
+}
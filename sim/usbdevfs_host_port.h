@@ -0,0 +1,24 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "host_port.h"
+
+// A device on this machine's host controller, e.g. the emulator on a Pi
+// plugged into the PC running the simulator, opened as
+// /dev/bus/usb/BBB/DDD. Kernel drivers bound to the modem's interfaces
+// (ftdi_sio, cdc_acm, ...) are detached while it is in use.
+class usbdevfs_host_port : public host_port {
+    private:
+        std::string path;
+        int fd = -1;
+        std::vector<uint8_t> claimed;
+    public:
+        usbdevfs_host_port(const char *path);
+        ~usbdevfs_host_port();
+        bool open(void) override;
+        int control(const struct usb_ctrlrequest &ctrl, void *data, const std::chrono::milliseconds &timeout) override;
+        bool set_configuration(uint8_t value, const std::vector<uint8_t> &interfaces, const std::chrono::milliseconds &timeout) override;
+        int bulk_write(uint8_t address, const void *data, size_t length, const std::chrono::milliseconds &timeout) override;
+        int bulk_read(uint8_t address, void *data, size_t max_length, const std::chrono::milliseconds &timeout) override;
+};
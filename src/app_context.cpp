@@ -0,0 +1,62 @@
+#include <algorithm>
+#include <cstdio>
+
+#include "app_context.h"
+
+// Result codes, echo and RING. They go through usb_ctrl_buffer, which the IN
+// endpoints drain first, so they never wait behind received payload.
+void AppContext::send_to_host(const char *message, size_t length)
+{
+    if (length == 0) {
+        return;
+    }
+    const auto enqueued = usb_ctrl_buffer.enqueue(message, length);
+    if (enqueued < length) {
+        printf("usb_ctrl_buffer: buffer is full! (dropped %ld bytes.)\n", (long) (length - enqueued));
+    }
+    usb_events.post(EVENT_DATA);
+}
+
+// Fills an IN packet: modem output first, then received payload as far as
+// the line rate allows. CoDel decides on dequeue, so a burst that went stale
+// while draining is dropped even if nothing new arrives behind it.
+size_t AppContext::read_for_host(char *data, size_t max_length)
+{
+    auto length = usb_ctrl_buffer.dequeue(data, max_length);
+    if (length < max_length) {
+        usb_tx_codel.control();
+        const auto payload_length = usb_tx_buffer.dequeue(data + length, usb_tx_pacer.limit(max_length - length));
+        usb_tx_pacer.consume(payload_length);
+        length += payload_length;
+    }
+    return length;
+}
+
+bool AppContext::has_data_for_host(void)
+{
+    return !usb_ctrl_buffer.is_empty() || (!usb_tx_buffer.is_empty() && usb_tx_pacer.limit(1) > 0);
+}
+
+// Blocks an IN endpoint thread until an event arrives, timeout_at passes, or
+// paced payload may be sent again.
+void AppContext::wait_for_host(event_channel &events, std::chrono::steady_clock::time_point timeout_at)
+{
+    if (!usb_tx_buffer.is_empty()) {
+        timeout_at = std::min(timeout_at, usb_tx_pacer.ready_at(usb_tx_buffer.get_count()));
+    }
+    if (timeout_at == std::chrono::steady_clock::time_point::max()) {
+        events.wait();
+    } else {
+        events.wait_until(timeout_at);
+    }
+}
+
+// Drops payload that is still queued when the call ends, so it does not
+// reach the host after NO CARRIER.
+void AppContext::discard_received_data(void)
+{
+    const auto length = usb_tx_buffer.discard(usb_tx_buffer.get_buffer_size());
+    if (length > 0 && debug_level >= 1) {
+        printf("usb_tx_buffer: discarded %ld bytes after hangup.\n", (long) length);
+    }
+}
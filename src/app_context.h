@@ -1,21 +1,55 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
+#include <string>
 #include "ring_buffer.h"
+#include "codel_controller.h"
+#include "event_hub.h"
+#include "line_pacer.h"
 
-class tcp_sock;
+class io_reactor;
+class net_sock;
 class pty_dev;
+class pppd_supervisor;
+class ppp_server;
+class dns_server;
 class Modem;
-class usb_raw_gadget;
+class usb_gadget;
 
 struct AppContext {
     ring_buffer<char> usb_tx_buffer{524288};
-    tcp_sock *sock = nullptr;
+    ring_buffer<char> usb_ctrl_buffer{4096}; // modem output, drained before usb_tx_buffer
+    codel_controller usb_tx_codel{usb_tx_buffer};
+    line_pacer usb_tx_pacer; // releases usb_tx_buffer at the line rate
+    event_hub usb_events; // wakes the IN endpoint threads
+    io_reactor *reactor = nullptr;
+    net_sock *sock = nullptr;
     pty_dev *pty = nullptr;
-    usb_raw_gadget *usb = nullptr;
+    pppd_supervisor *pppd = nullptr; // pppd on the PTY slave
+    ppp_server *ppp = nullptr; // in-process PPP instead of the PTY and pppd
+    dns_server *dns = nullptr; // resolver for the dial-up clients
+    usb_gadget *usb = nullptr;
     int debug_level = 0;
     std::atomic<bool> connected{false};
+    std::chrono::milliseconds dial_timeout{30000};
+    bool endpoint_scheduler = false; // IN endpoints share endpoint_scheduler lanes instead of a thread each
     Modem *current_modem = nullptr;
+
+    // Returns the previous state; a change wakes the threads reporting DCD.
+    bool set_connected(bool value) {
+        const auto previous = connected.exchange(value);
+        if (previous != value) {usb_events.post(EVENT_LINE_STATUS);}
+        return previous;
+    }
+
+    void send_to_host(const char *message, size_t length);
+    void send_to_host(const std::string &message) {send_to_host(message.c_str(), message.length());}
+    size_t read_for_host(char *data, size_t max_length);
+    bool has_data_for_host(void);
+    void wait_for_host(event_channel &events,
+        std::chrono::steady_clock::time_point timeout_at = std::chrono::steady_clock::time_point::max());
+    void discard_received_data(void);
 };
 
 extern AppContext ctx;
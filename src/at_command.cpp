@@ -0,0 +1,118 @@
+#include <cctype>
+
+#include "at_command.h"
+
+// Verbose result codes, indexed by the numeric code. CONNECT, RING and BUSY
+// keep the exact form the host drivers were tested against. They are printf
+// formats: CONNECT takes the line rate.
+static const char * const result_texts[] = {
+    "\r\nOK\r\n",
+    "CONNECT %u V42\r\n",
+    "RING\r\n",
+    "\r\nNO CARRIER\r\n",
+    "\r\nERROR\r\n",
+    "\r\nCONNECT 1200\r\n",
+    "\r\nNO DIALTONE\r\n",
+    "BUSY\r\n",
+    "\r\nNO ANSWER\r\n",
+};
+
+const char *at_result_text(at_result result)
+{
+    if (result < 0 || result >= (int) (sizeof(result_texts) / sizeof(result_texts[0]))) {
+        return "";
+    }
+    return result_texts[result];
+}
+
+// Consumes bytes up to and including the next CR and returns how many were
+// used. is_complete() tells whether a whole line is now in the buffer.
+size_t at_line_buffer::feed(const char *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        const char c = data[i];
+        if (c == '\r') {
+            line[length] = '\r';
+            complete = true;
+            return i + 1;
+        }
+        if (c == '\0' || (c == '\n' && length == 0)) {continue;}
+        if (c == '\b') {
+            if (length > 0) {length--;}
+            continue;
+        }
+        if (length < AT_LINE_MAX) {
+            line[length++] = c;
+        } else {
+            overflow = true;
+        }
+    }
+    return size;
+}
+
+void at_line_buffer::clear(void)
+{
+    length = 0;
+    complete = false;
+    overflow = false;
+}
+
+at_tokenizer::at_tokenizer(const char *body, size_t length) : pos(body), end(body + length)
+{
+}
+
+static int parse_number(const char *&pos, const char *end)
+{
+    if (pos == end || !isdigit((unsigned char) *pos)) {return -1;}
+    int number = 0;
+    while (pos != end && isdigit((unsigned char) *pos)) {
+        if (number < 100000) {number = number * 10 + (*pos - '0');}
+        pos++;
+    }
+    return number;
+}
+
+// Returns false at the end of the line or on a syntax error (see has_error()).
+// The line is expected in upper case.
+bool at_tokenizer::next(at_command &cmd)
+{
+    while (pos != end && (*pos == ' ' || *pos == ';')) {pos++;}
+    if (pos == end || error) {return false;}
+
+    cmd = at_command{pos, 0, '\0', '\0', -1, '\0', 0, nullptr, 0};
+    const char c = *pos;
+
+    if (c == '+' || c == '#') {
+        // extended command: runs up to the next ';'
+        cmd.prefix = c;
+        while (pos != end && *pos != ';') {pos++;}
+        while (pos - 1 > cmd.text && pos[-1] == ' ') {pos--;}
+    } else {
+        if (c == '&' || c == '\\' || c == '%') {
+            cmd.prefix = c;
+            pos++;
+        }
+        if (pos == end || !isupper((unsigned char) *pos)) {
+            error = true;
+            return false;
+        }
+        cmd.name = *pos++;
+        if (cmd.prefix == '\0' && cmd.name == 'D') {
+            // the dial string takes the rest of the line
+            cmd.arg = pos;
+            cmd.arg_length = end - pos;
+            pos = end;
+        } else {
+            cmd.number = parse_number(pos, end);
+            if (cmd.prefix == '\0' && cmd.name == 'S' && pos != end && (*pos == '=' || *pos == '?')) {
+                cmd.op = *pos++;
+                if (cmd.op == '=') {
+                    const auto value = parse_number(pos, end);
+                    cmd.value = value < 0 ? 0 : value;
+                }
+            }
+        }
+    }
+    cmd.length = pos - cmd.text;
+    return true;
+}
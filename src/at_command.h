@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+
+constexpr size_t AT_LINE_MAX = 255;
+
+// Hayes result codes; the value is the numeric form sent in ATV0 mode.
+enum at_result {
+    RESULT_NONE = -1, // the result code is sent later (e.g. by the dial)
+    RESULT_OK = 0,
+    RESULT_CONNECT = 1,
+    RESULT_RING = 2,
+    RESULT_NO_CARRIER = 3,
+    RESULT_ERROR = 4,
+    RESULT_NO_DIALTONE = 6,
+    RESULT_BUSY = 7,
+    RESULT_NO_ANSWER = 8,
+};
+
+const char *at_result_text(at_result result);
+
+// Model specific reply to a single command, e.g. {"I3", "\r\nREV 1.0\r\n"}.
+// A null text makes the command fail with ERROR.
+struct at_reply {
+    const char *command;
+    const char *text;
+};
+
+// Collects one command line from the host's byte stream in a fixed buffer.
+// NULs and line feeds in front of a command are dropped and backspace edits
+// the line, as on a real modem. The terminating CR is kept right after the
+// line so that it can be echoed together with it.
+class at_line_buffer {
+    private:
+        char line[AT_LINE_MAX + 1];
+        size_t length = 0;
+        bool complete = false;
+        bool overflow = false;
+    public:
+        size_t feed(const char *data, size_t size);
+        void clear(void);
+        bool is_complete(void) const {return complete;}
+        bool is_overflow(void) const {return overflow;}
+        bool is_empty(void) const {return length == 0;}
+        char *get_line(void) {return line;}
+        size_t get_length(void) const {return length;}
+};
+
+// One command out of a chained command line such as "ATE0V1&C1S0=1".
+struct at_command {
+    const char *text;   // the whole command, e.g. "&C1", "S7=60", "+GCI?"
+    size_t length;
+    char prefix;        // '&', '\\', '%', '+', '#' or '\0'
+    char name;          // command letter ('\0' for extended commands)
+    int number;         // numeric parameter or S-register number, -1 if none
+    char op;            // S-registers: '=', '?' or '\0'
+    int value;          // S-registers: the value after '='
+    const char *arg;    // D: the dial string
+    size_t arg_length;
+};
+
+// Splits the part of a command line after "AT" into commands in place.
+class at_tokenizer {
+    private:
+        const char *pos;
+        const char *end;
+        bool error = false;
+    public:
+        at_tokenizer(const char *body, size_t length);
+        bool next(at_command &cmd);
+        bool has_error(void) const {return error;}
+};
@@ -0,0 +1,130 @@
+#include <cmath>
+#include <cstdio>
+
+#include "codel_controller.h"
+
+constexpr auto CODEL_MIN_INTERVAL = std::chrono::milliseconds(100);
+
+codel_controller::codel_controller(ring_buffer<char> &buffer) : buffer(buffer)
+{
+}
+
+void codel_controller::set_debug_level(const int level)
+{
+    debug_level = level;
+}
+
+void codel_controller::set_target(const std::chrono::milliseconds &target)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    codel_controller::target = target;
+    interval = std::max<std::chrono::microseconds>(CODEL_MIN_INTERVAL, target);
+}
+
+bool codel_controller::is_enabled(void)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return target.count() > 0;
+}
+
+// Must be called by the producer before the chunk is committed to the buffer,
+// while it still holds the buffer's write side, so the write total is stable.
+void codel_controller::on_enqueue(size_t length)
+{
+    const auto end = buffer.get_write_total() + length;
+    const auto now = std::chrono::steady_clock::now();
+
+    std::lock_guard<std::mutex> lock(mtx);
+    marks.push_back({end, now});
+}
+
+void codel_controller::update_sojourn_time_without_lock(const std::chrono::steady_clock::time_point &now)
+{
+    const auto read_total = buffer.get_read_total();
+    while (!marks.empty() && marks.front().end <= read_total) {
+        marks.pop_front();
+    }
+
+    if (marks.empty()) {
+        sojourn_time = std::chrono::microseconds(0);
+        return;
+    }
+    sojourn_time = std::chrono::duration_cast<std::chrono::microseconds>(now - marks.front().enqueued_at);
+}
+
+size_t codel_controller::drop_head_without_lock(void)
+{
+    if (marks.empty()) {
+        return 0;
+    }
+    const auto queued = marks.front().end - buffer.get_read_total();
+    marks.pop_front();
+
+    const auto length = buffer.discard(queued);
+    dropped_bytes += length;
+    return length;
+}
+
+// Runs the CoDel state machine against the current head of the queue and
+// returns the number of bytes dropped.
+size_t codel_controller::control(void)
+{
+    const auto now = std::chrono::steady_clock::now();
+
+    std::lock_guard<std::mutex> lock(mtx);
+    update_sojourn_time_without_lock(now);
+    if (target.count() <= 0) {
+        return 0;
+    }
+
+    if (sojourn_time < target || marks.size() <= 1) {
+        // below target, or a single chunk in flight: leave the dropping state
+        first_above_time = {};
+        dropping = false;
+        return 0;
+    }
+
+    if (first_above_time == std::chrono::steady_clock::time_point{}) {
+        first_above_time = now + interval;
+        return 0;
+    }
+
+    size_t dropped = 0;
+    if (!dropping) {
+        if (now < first_above_time) {
+            return 0;
+        }
+        dropping = true;
+        drop_count = (drop_count > 2) ? drop_count - 2 : 1;
+        dropped += drop_head_without_lock();
+        drop_next = now + std::chrono::duration_cast<std::chrono::microseconds>(interval / std::sqrt(drop_count));
+    }
+
+    // control law: the gap between drops shrinks with the square root of the drop count
+    while (dropping && now >= drop_next && marks.size() > 1) {
+        drop_count++;
+        dropped += drop_head_without_lock();
+        drop_next += std::chrono::duration_cast<std::chrono::microseconds>(interval / std::sqrt(drop_count));
+    }
+
+    if (dropped > 0 && debug_level >= 1) {
+        printf("usb_tx_buffer: queue delay %ld ms exceeds target %ld ms, dropped %ld bytes.\n",
+            (long) std::chrono::duration_cast<std::chrono::milliseconds>(sojourn_time).count(),
+            (long) std::chrono::duration_cast<std::chrono::milliseconds>(target).count(),
+            (long) dropped);
+    }
+    return dropped;
+}
+
+std::chrono::microseconds codel_controller::get_sojourn_time(void)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    update_sojourn_time_without_lock(std::chrono::steady_clock::now());
+    return sojourn_time;
+}
+
+uint64_t codel_controller::get_dropped_bytes(void)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return dropped_bytes;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include "ring_buffer.h"
+
+// Sojourn-time based queue management (CoDel) for a byte ring buffer.
+// Each received chunk is timestamped on enqueue; once the oldest queued chunk
+// has waited longer than the target for a whole interval, whole chunks are
+// dropped from the head at an increasing rate until the delay recovers.
+class codel_controller {
+    private:
+        struct mark {
+            uint64_t end; // ring write total just past the chunk
+            std::chrono::steady_clock::time_point enqueued_at;
+        };
+        ring_buffer<char> &buffer;
+        std::mutex mtx;
+        std::deque<mark> marks;
+        std::chrono::microseconds target{0};
+        std::chrono::microseconds interval{0};
+        std::chrono::microseconds sojourn_time{0};
+        std::chrono::steady_clock::time_point first_above_time;
+        std::chrono::steady_clock::time_point drop_next;
+        bool dropping = false;
+        unsigned int drop_count = 0;
+        uint64_t dropped_bytes = 0;
+        int debug_level = 0;
+        void update_sojourn_time_without_lock(const std::chrono::steady_clock::time_point &now);
+        size_t drop_head_without_lock(void);
+    public:
+        codel_controller(ring_buffer<char> &buffer);
+        void set_debug_level(const int level);
+        void set_target(const std::chrono::milliseconds &target);
+        bool is_enabled(void);
+        void on_enqueue(size_t length);
+        size_t control(void);
+        std::chrono::microseconds get_sojourn_time(void);
+        uint64_t get_dropped_bytes(void);
+};
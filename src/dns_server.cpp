@@ -0,0 +1,474 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "dns_server.h"
+
+constexpr size_t DNS_HEADER_SIZE = 12;
+constexpr size_t DNS_MAX_MESSAGE = 4096; // EDNS sized upstream answers
+constexpr uint32_t DNS_OVERRIDE_TTL = 60;
+constexpr uint32_t DNS_NEGATIVE_TTL = 30;
+constexpr uint32_t DNS_MAX_TTL = 3600;
+constexpr size_t DNS_MAX_PENDING = 256;
+constexpr size_t DNS_MAX_CACHE = 1024;
+constexpr auto DNS_UPSTREAM_TIMEOUT = std::chrono::seconds(5);
+
+enum : uint16_t {
+    DNS_TYPE_A    = 1,
+    DNS_TYPE_OPT  = 41,
+    DNS_TYPE_ANY  = 255,
+    DNS_CLASS_IN  = 1,
+};
+
+enum : uint16_t {
+    DNS_FLAG_QR = 0x8000,
+    DNS_FLAG_AA = 0x0400,
+    DNS_FLAG_TC = 0x0200,
+    DNS_FLAG_RD = 0x0100,
+    DNS_FLAG_RA = 0x0080,
+    DNS_RCODE_MASK = 0x000f,
+};
+
+enum {DNS_RCODE_NOERROR = 0, DNS_RCODE_SERVFAIL = 2, DNS_RCODE_NXDOMAIN = 3};
+
+static inline uint16_t get_u16(const uint8_t *p)
+{
+    return p[0] << 8 | p[1];
+}
+
+static inline uint32_t get_u32(const uint8_t *p)
+{
+    return static_cast<uint32_t>(p[0]) << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static inline void put_u16(uint8_t *p, uint16_t value)
+{
+    p[0] = value >> 8;
+    p[1] = value & 0xff;
+}
+
+static inline void put_u32(uint8_t *p, uint32_t value)
+{
+    put_u16(&p[0], value >> 16);
+    put_u16(&p[2], value & 0xffff);
+}
+
+// Advances pos past a possibly compressed name; false if it runs off the end.
+static bool skip_name(const uint8_t *data, size_t length, size_t &pos)
+{
+    while (pos < length) {
+        const auto label = data[pos];
+        if ((label & 0xc0) == 0xc0) {
+            pos += 2;
+            return pos <= length;
+        }
+        pos += 1 + label;
+        if (label == 0) {
+            return pos <= length;
+        }
+    }
+    return false;
+}
+
+// Reads the question name (never compressed) in lower case and dotted form.
+static bool read_qname(const uint8_t *data, size_t length, size_t &pos, std::string &name)
+{
+    name.clear();
+    while (pos < length) {
+        const auto label = data[pos++];
+        if (label == 0) {
+            return true;
+        }
+        if ((label & 0xc0) != 0 || pos + label > length) {
+            return false;
+        }
+        if (!name.empty()) {name += '.';}
+        for (size_t i = 0; i < label; i++) {
+            name += static_cast<char>(std::tolower(data[pos + i]));
+        }
+        pos += label;
+    }
+    return false;
+}
+
+static std::string question_key(const std::string &name, uint16_t qtype, uint16_t qclass)
+{
+    return name + '/' + std::to_string(qtype) + '/' + std::to_string(qclass);
+}
+
+void dns_server::query_handler(uint32_t events)
+{
+    (void)events;
+
+    uint8_t query[DNS_MAX_MESSAGE];
+    struct sockaddr_in client;
+    socklen_t client_len = sizeof(client);
+    const auto len = recvfrom(sock_fd, query, sizeof(query), MSG_DONTWAIT, reinterpret_cast<struct sockaddr *>(&client), &client_len);
+    if (len < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            printf("dns_server: recvfrom(): %s\n", std::strerror(errno));
+        }
+        return;
+    }
+
+    size_t pos = DNS_HEADER_SIZE;
+    std::string name;
+    if (len < static_cast<ssize_t>(DNS_HEADER_SIZE) || (get_u16(&query[2]) & DNS_FLAG_QR) || get_u16(&query[4]) != 1
+        || !read_qname(query, len, pos, name) || pos + 4 > static_cast<size_t>(len)) {
+        if (debug_level >= 1) {printf("dns_server: ignored a malformed query (%ld bytes).\n", (long) len);}
+        return;
+    }
+    const auto id = get_u16(&query[0]);
+    const auto qtype = get_u16(&query[pos]);
+    const auto qclass = get_u16(&query[pos + 2]);
+    const auto question_end = pos + 4;
+
+    in_addr_t addr;
+    if (find_override(name, &addr)) {
+        // the header and question of the query, then at most one A record
+        uint8_t response[DNS_MAX_MESSAGE];
+        memcpy(response, query, question_end);
+        const bool has_answer = (qclass == DNS_CLASS_IN && (qtype == DNS_TYPE_A || qtype == DNS_TYPE_ANY));
+        put_u16(&response[2], DNS_FLAG_QR | DNS_FLAG_AA | (get_u16(&query[2]) & DNS_FLAG_RD) | DNS_FLAG_RA);
+        put_u16(&response[6], has_answer ? 1 : 0);
+        put_u16(&response[8], 0);
+        put_u16(&response[10], 0);
+        size_t response_length = question_end;
+        if (has_answer) {
+            auto rr = &response[response_length];
+            put_u16(&rr[0], 0xc000 | DNS_HEADER_SIZE); // the name in the question
+            put_u16(&rr[2], DNS_TYPE_A);
+            put_u16(&rr[4], DNS_CLASS_IN);
+            put_u32(&rr[6], DNS_OVERRIDE_TTL);
+            put_u16(&rr[10], 4);
+            memcpy(&rr[12], &addr, 4);
+            response_length += 16;
+        }
+        if (debug_level >= 1) {
+            char text[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &addr, text, sizeof(text));
+            printf("dns_server: %s type %u -> %s (override).\n", name.c_str(), qtype, has_answer ? text : "no data");
+        }
+        reply(&client, response, response_length);
+        return;
+    }
+
+    const auto key = question_key(name, qtype, qclass);
+    if (answer_from_cache(key, id, &client)) {
+        return;
+    }
+    if (upstream_fd < 0) {
+        // no upstream resolver: SERVFAIL right away rather than a timeout
+        put_u16(&query[2], DNS_FLAG_QR | (get_u16(&query[2]) & DNS_FLAG_RD) | DNS_FLAG_RA | DNS_RCODE_SERVFAIL);
+        put_u16(&query[6], 0);
+        put_u16(&query[8], 0);
+        put_u16(&query[10], 0);
+        reply(&client, query, question_end);
+        return;
+    }
+    forward(query, len, key, &client);
+}
+
+bool dns_server::find_override(const std::string &name, in_addr_t *addr) const
+{
+    if (overrides.empty()) {
+        return false;
+    }
+    auto it = overrides.find(name);
+    if (it != overrides.end()) {
+        *addr = it->second.addr;
+        return true;
+    }
+    // parent domains of address=/name/ entries
+    for (auto dot = name.find('.'); dot != std::string::npos; dot = name.find('.', dot + 1)) {
+        it = overrides.find(name.substr(dot + 1));
+        if (it != overrides.end() && it->second.subdomains) {
+            *addr = it->second.addr;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool dns_server::answer_from_cache(const std::string &key, uint16_t id, const struct sockaddr_in *client)
+{
+    const auto it = cache.find(key);
+    if (it == cache.end()) {
+        return false;
+    }
+    const auto now = std::chrono::steady_clock::now();
+    if (now >= it->second.expires_at) {
+        cache.erase(it);
+        return false;
+    }
+
+    // the stored answer with the query's id and the TTLs counted down
+    auto response = it->second.response;
+    const auto age = std::chrono::duration_cast<std::chrono::seconds>(now - it->second.stored_at).count();
+    put_u16(&response[0], id);
+    for (const auto offset : it->second.ttl_offsets) {
+        const auto ttl = get_u32(&response[offset]);
+        put_u32(&response[offset], (ttl > age) ? ttl - age : 0);
+    }
+    if (debug_level >= 2) {printf("dns_server: %s answered from the cache.\n", key.c_str());}
+    reply(client, response.data(), response.size());
+    return true;
+}
+
+void dns_server::forward(const uint8_t *query, size_t length, const std::string &key, const struct sockaddr_in *client)
+{
+    const auto now = std::chrono::steady_clock::now();
+    if (pending.size() >= DNS_MAX_PENDING / 2) {
+        // queries the upstream never answered
+        for (auto it = pending.begin(); it != pending.end();) {
+            it = (now - it->second.sent_at > DNS_UPSTREAM_TIMEOUT) ? pending.erase(it) : std::next(it);
+        }
+    }
+    if (pending.size() >= DNS_MAX_PENDING) {
+        if (debug_level >= 1) {printf("dns_server: too many queries in flight, dropped %s.\n", key.c_str());}
+        return;
+    }
+
+    // a random id for every query, so an answer is hard to guess
+    uint16_t id;
+    do {
+        id = id_generator();
+    } while (pending.count(id) != 0);
+    pending[id] = {*client, get_u16(&query[0]), key, now};
+
+    uint8_t packet[DNS_MAX_MESSAGE];
+    memcpy(packet, query, length);
+    put_u16(&packet[0], id);
+    if (send(upstream_fd, packet, length, MSG_DONTWAIT) < 0) {
+        printf("dns_server: send(): %s\n", std::strerror(errno));
+        pending.erase(id);
+        return;
+    }
+    if (debug_level >= 2) {printf("dns_server: %s forwarded upstream.\n", key.c_str());}
+}
+
+void dns_server::upstream_handler(uint32_t events)
+{
+    (void)events;
+
+    uint8_t response[DNS_MAX_MESSAGE];
+    const auto len = recv(upstream_fd, response, sizeof(response), MSG_DONTWAIT);
+    if (len < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            printf("dns_server: recv(): %s\n", std::strerror(errno));
+        }
+        return;
+    }
+    if (len < static_cast<ssize_t>(DNS_HEADER_SIZE)) {
+        return;
+    }
+    const auto it = pending.find(get_u16(&response[0]));
+    if (it == pending.end()) {
+        return;
+    }
+    // the id alone may be spoofed or reused: the question has to match too
+    size_t pos = DNS_HEADER_SIZE;
+    std::string name;
+    if (get_u16(&response[4]) != 1 || !read_qname(response, len, pos, name) || pos + 4 > static_cast<size_t>(len)
+        || question_key(name, get_u16(&response[pos]), get_u16(&response[pos + 2])) != it->second.key) {
+        if (debug_level >= 1) {printf("dns_server: ignored an answer that does not match %s.\n", it->second.key.c_str());}
+        return;
+    }
+    const auto query = it->second;
+    pending.erase(it);
+
+    put_u16(&response[0], query.client_id);
+    reply(&query.client, response, len);
+    store(query.key, response, len);
+}
+
+// Caches an upstream answer for the lowest TTL in it. Truncated answers and
+// errors other than NXDOMAIN are not kept.
+void dns_server::store(const std::string &key, const uint8_t *response, size_t length)
+{
+    const auto flags = get_u16(&response[2]);
+    const auto rcode = flags & DNS_RCODE_MASK;
+    if ((flags & DNS_FLAG_TC) || (rcode != DNS_RCODE_NOERROR && rcode != DNS_RCODE_NXDOMAIN)) {
+        return;
+    }
+
+    size_t pos = DNS_HEADER_SIZE;
+    for (unsigned int i = 0; i < get_u16(&response[4]); i++) {
+        if (!skip_name(response, length, pos) || (pos += 4) > length) {return;}
+    }
+    const unsigned int records = get_u16(&response[6]) + get_u16(&response[8]) + get_u16(&response[10]);
+    std::vector<size_t> ttl_offsets;
+    uint32_t ttl = DNS_MAX_TTL;
+    for (unsigned int i = 0; i < records; i++) {
+        if (!skip_name(response, length, pos) || pos + 10 > length) {return;}
+        const auto type = get_u16(&response[pos]);
+        if (type != DNS_TYPE_OPT) {
+            // the OPT pseudo record has flags where the TTL would be
+            ttl = std::min(ttl, get_u32(&response[pos + 4]));
+            ttl_offsets.push_back(pos + 4);
+        }
+        pos += 10 + get_u16(&response[pos + 8]);
+        if (pos > length) {return;}
+    }
+    if (ttl_offsets.empty()) {
+        ttl = DNS_NEGATIVE_TTL;
+    }
+    if (ttl == 0) {
+        return;
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    if (cache.size() >= DNS_MAX_CACHE) {
+        for (auto it = cache.begin(); it != cache.end();) {
+            it = (now >= it->second.expires_at) ? cache.erase(it) : std::next(it);
+        }
+        if (cache.size() >= DNS_MAX_CACHE) {cache.erase(cache.begin());}
+    }
+    cache[key] = {std::vector<uint8_t>(response, response + length), std::move(ttl_offsets),
+        now, now + std::chrono::seconds(ttl)};
+}
+
+void dns_server::reply(const struct sockaddr_in *client, const uint8_t *data, size_t length)
+{
+    const auto ret = sendto(sock_fd, data, length, MSG_DONTWAIT, reinterpret_cast<const struct sockaddr *>(client), sizeof(*client));
+    if (ret < 0) {
+        printf("dns_server: sendto(): %s\n", std::strerror(errno));
+    }
+}
+
+dns_server::dns_server(io_reactor *reactor, in_addr_t bind_addr, in_addr_t upstream_addr)
+{
+    dns_server::reactor = reactor;
+    id_generator.seed(std::random_device()());
+
+    sock_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sock_fd < 0) {
+        throw std::runtime_error((std::string) "dns_server: socket(): " + std::strerror(errno));
+    }
+    // the ISP address only exists while a PPP link is up
+    const int on = 1;
+    setsockopt(sock_fd, IPPROTO_IP, IP_FREEBIND, &on, sizeof(on));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = bind_addr;
+    addr.sin_port = htons(DNS_PORT);
+    if (bind(sock_fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0) {
+        ::close(sock_fd);
+        throw std::runtime_error((std::string) "dns_server: bind(): " + std::strerror(errno));
+    }
+
+    if (upstream_addr != INADDR_NONE) {
+        upstream_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (upstream_fd < 0) {
+            ::close(sock_fd);
+            throw std::runtime_error((std::string) "dns_server: socket(): " + std::strerror(errno));
+        }
+        addr.sin_addr.s_addr = upstream_addr;
+        if (connect(upstream_fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0) {
+            ::close(sock_fd);
+            ::close(upstream_fd);
+            throw std::runtime_error((std::string) "dns_server: connect(): " + std::strerror(errno));
+        }
+        reactor->add(upstream_fd, EPOLLIN, [this](uint32_t events){upstream_handler(events);});
+    }
+    reactor->add(sock_fd, EPOLLIN, [this](uint32_t events){query_handler(events);});
+}
+
+dns_server::~dns_server()
+{
+    reactor->remove(sock_fd);
+    ::close(sock_fd);
+    if (upstream_fd >= 0) {
+        reactor->remove(upstream_fd);
+        ::close(upstream_fd);
+    }
+}
+
+void dns_server::set_debug_level(const int level)
+{
+    debug_level = level;
+}
+
+// Call before queries arrive; the table is not locked.
+void dns_server::add_override(const std::string &name, in_addr_t addr, bool subdomains)
+{
+    std::string key(name);
+    std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c){return std::tolower(c);});
+    while (!key.empty() && key.back() == '.') {key.pop_back();}
+    overrides[key] = {addr, subdomains};
+}
+
+// Reads dnsmasq style "address=/name/.../ip" lines (the names and their
+// subdomains) and hosts style "ip name..." lines (the exact names).
+bool dns_server::load_overrides(const char *path)
+{
+    std::ifstream file(path);
+    if (!file) {
+        printf("dns_server: cannot open %s\n", path);
+        return false;
+    }
+
+    std::string line;
+    int line_number = 0;
+    while (std::getline(file, line)) {
+        line_number++;
+        line.erase(std::find(line.begin(), line.end(), '#'), line.end());
+        std::istringstream fields(line);
+        std::string first;
+        if (!(fields >> first)) {
+            continue;
+        }
+
+        struct in_addr addr;
+        if (first.compare(0, 9, "address=/") == 0) {
+            const auto last_slash = first.rfind('/');
+            if (inet_pton(AF_INET, first.substr(last_slash + 1).c_str(), &addr) != 1) {
+                printf("dns_server: %s:%d: bad address.\n", path, line_number);
+                continue;
+            }
+            std::istringstream names(first.substr(9, last_slash - 9));
+            std::string name;
+            while (std::getline(names, name, '/')) {
+                if (!name.empty()) {add_override(name, addr.s_addr, true);}
+            }
+        } else if (inet_pton(AF_INET, first.c_str(), &addr) == 1) {
+            std::string name;
+            while (fields >> name) {
+                add_override(name, addr.s_addr, false);
+            }
+        } else {
+            printf("dns_server: %s:%d: ignored.\n", path, line_number);
+        }
+    }
+    printf("dns_server: %zu names loaded from %s\n", overrides.size(), path);
+    return true;
+}
+
+// The first IPv4 nameserver of /etc/resolv.conf other than exclude (our
+// own address), or INADDR_NONE.
+in_addr_t dns_server::system_resolver(in_addr_t exclude)
+{
+    std::ifstream file("/etc/resolv.conf");
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string keyword, value;
+        struct in_addr addr;
+        if (fields >> keyword >> value && keyword == "nameserver"
+            && inet_pton(AF_INET, value.c_str(), &addr) == 1 && addr.s_addr != exclude) {
+            return addr.s_addr;
+        }
+    }
+    return INADDR_NONE;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <netinet/in.h>
+#include "io_reactor.h"
+
+constexpr uint16_t DNS_PORT = 53;
+
+// DNS resolver for the dial-up clients on the ISP path. Names in the override
+// table (game servers redirected to a replacement) are answered directly;
+// everything else is forwarded to the upstream resolver and the answers are
+// kept for their TTL. Replaces the dnsmasq address=/.../ setup. Everything
+// runs on the reactor thread.
+class dns_server {
+    private:
+        struct override_entry {
+            in_addr_t addr;
+            bool subdomains; // dnsmasq address=/name/ also matches *.name
+        };
+        struct pending_query {
+            struct sockaddr_in client;
+            uint16_t client_id;
+            std::string key;
+            std::chrono::steady_clock::time_point sent_at;
+        };
+        struct cache_entry {
+            std::vector<uint8_t> response;
+            std::vector<size_t> ttl_offsets; // TTL fields to age on a hit
+            std::chrono::steady_clock::time_point stored_at, expires_at;
+        };
+        io_reactor *reactor;
+        int sock_fd = -1;     // queries from the clients
+        int upstream_fd = -1; // connected to the upstream resolver
+        int debug_level = 0;
+        std::mt19937 id_generator; // upstream query ids
+        std::unordered_map<std::string, override_entry> overrides;
+        std::unordered_map<uint16_t, pending_query> pending;
+        std::unordered_map<std::string, cache_entry> cache;
+        void query_handler(uint32_t events);
+        void upstream_handler(uint32_t events);
+        bool find_override(const std::string &name, in_addr_t *addr) const;
+        bool answer_from_cache(const std::string &key, uint16_t id, const struct sockaddr_in *client);
+        void forward(const uint8_t *query, size_t length, const std::string &key, const struct sockaddr_in *client);
+        void store(const std::string &key, const uint8_t *response, size_t length);
+        void reply(const struct sockaddr_in *client, const uint8_t *data, size_t length);
+    public:
+        dns_server(io_reactor *reactor, in_addr_t bind_addr, in_addr_t upstream_addr);
+        ~dns_server();
+        void set_debug_level(const int level);
+        void add_override(const std::string &name, in_addr_t addr, bool subdomains);
+        bool load_overrides(const char *path);
+        static in_addr_t system_resolver(in_addr_t exclude);
+};
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include "app_context.h"
+#include "at_command.h"
+#include "escape_detector.h"
+#include "modem.h"
+#include "net_sock.h"
+#include "ppp_server.h"
+#include "pty_dev.h"
+#include "usb_gadget.h"
+
+// Bulk OUT endpoint loop shared by all models. It reads packets from the host,
+// unwraps them with the model's framing codec and hands the payload to the AT
+// command parser while off-line or to the PPP server, pty or socket while
+// on-line, watching for the +++ escape back to command mode. Command lines
+// are collected in a fixed buffer, so the off-line path does not allocate.
+//
+// Codec is a policy class with static members only, so every model gets its
+// own copy of the loop with the framing inlined:
+//     static size_t decode(const char *data, int length, const char *&payload);
+template <typename Codec>
+class endpoint_pump {
+    public:
+        static void *run(Modem *modem, int ep_num);
+    private:
+        static void send(const char *data, size_t length);
+};
+
+template <typename Codec>
+void *endpoint_pump<Codec>::run(Modem *modem, int ep_num)
+{
+    struct usb_packet_bulk pkt;
+    at_line_buffer line;
+    escape_detector escape(modem);
+
+    while (true) {
+        pkt.header.ep = ep_num;
+        pkt.header.flags = 0;
+        pkt.header.length = sizeof(pkt.data);
+
+        int ret = ctx.usb->ep_read(reinterpret_cast<struct usb_raw_ep_io *>(&pkt));
+        const char *payload;
+        const size_t length = Codec::decode(&pkt.data[0], ret, payload);
+
+        if (modem->is_online()) {
+            line.clear();
+            escape.scan(payload, length);
+            send(payload, length);
+            continue;
+        }
+        escape.reset();
+        if (modem->abort_dial_on_input(payload, length)) {
+            line.clear();
+            continue;
+        }
+
+        // Off-line and on-line command mode loop
+        size_t pos = 0;
+        while (pos < length && !modem->is_online()) {
+            pos += line.feed(&payload[pos], length - pos);
+            if (!line.is_complete()) { break; }
+            if (!line.is_empty()) { modem->process_at(line); }
+            line.clear();
+        }
+
+        // On-line mode: whatever followed the command that connected
+        if (pos < length && modem->is_online()) {
+            send(&payload[pos], length - pos);
+        }
+    }
+    return nullptr;
+}
+
+template <typename Codec>
+inline void endpoint_pump<Codec>::send(const char *data, size_t length)
+{
+    if (length == 0) { return; }
+    if (ctx.ppp != nullptr && ctx.ppp->is_connected()) {
+        ctx.ppp->send(data, length);
+    } else if (ctx.pty->is_connected()) {
+        ctx.pty->send(data, length);
+    } else if (ctx.sock != nullptr) {
+        ctx.sock->send(data, length);
+    }
+}
@@ -0,0 +1,106 @@
+#include <cstdio>
+#include <stdexcept>
+
+#include "app_context.h"
+#include "endpoint_scheduler.h"
+#include "usb_gadget.h"
+
+endpoint_scheduler::endpoint_scheduler(int lanes)
+{
+    if (lanes < 1) {
+        throw std::runtime_error("endpoint_scheduler: at least one lane is needed");
+    }
+    endpoint_scheduler::lanes.resize(lanes);
+}
+
+void endpoint_scheduler::set_debug_level(const int level)
+{
+    debug_level = level;
+}
+
+// Only before start().
+void endpoint_scheduler::add(int lane, int ep_num, uint32_t events, const std::chrono::milliseconds &period, poll_func_t poll)
+{
+    if (lane < 0 || lane >= static_cast<int>(lanes.size())) {
+        throw std::runtime_error("endpoint_scheduler: no such lane");
+    }
+    task t;
+    t.lane = lane;
+    t.ep_num = ep_num;
+    t.period = period;
+    t.poll = std::move(poll);
+    tasks.push_back(std::move(t));
+    lanes[lane].events |= events;
+}
+
+void endpoint_scheduler::start(void)
+{
+    const auto now = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < lanes.size(); i++) {
+        auto &l = lanes[i];
+        if (l.thread != nullptr) {continue;}
+        l.channel = new event_channel(ctx.usb_events, l.events);
+        l.wheel = new timer_wheel(ENDPOINT_SCHEDULER_TICK, ENDPOINT_SCHEDULER_SLOTS);
+        for (uint32_t id = 0; id < tasks.size(); id++) {
+            if (tasks[id].lane == static_cast<int>(i)) {l.ids.push_back(id);}
+        }
+        l.wheel->reserve(l.ids.size());
+        l.expired.reserve(l.ids.size());
+        for (const auto id : l.ids) {
+            if (tasks[id].period.count() > 0) {
+                tasks[id].next_at = now + tasks[id].period;
+                l.wheel->schedule(id, tasks[id].next_at);
+            }
+        }
+        l.thread = new std::thread(&endpoint_scheduler::lane_thread, this, i);
+    }
+}
+
+void *endpoint_scheduler::lane_thread(int lane)
+{
+    struct usb_packet_control pkt;
+    auto &l = lanes[lane];
+    if (debug_level >= 1) {printf("endpoint_scheduler: lane %d serves %d endpoints.\n", lane, (int) l.ids.size());}
+
+    while (true) {
+        // lanes of event driven endpoints only have no clock to look at
+        const auto now = l.wheel->is_empty() ? std::chrono::steady_clock::time_point() : std::chrono::steady_clock::now();
+        l.expired.clear();
+        l.wheel->advance(now, l.expired);
+        for (const auto id : l.expired) {
+            auto &t = tasks[id];
+            t.due = true;
+            // keep the cadence, skipping periods that were missed
+            while (t.next_at <= now) {
+                t.next_at += t.period;
+            }
+            l.wheel->schedule(id, t.next_at);
+        }
+
+        bool sent = false;
+        for (const auto id : l.ids) {
+            auto &t = tasks[id];
+            pkt.header.length = 0;
+            const auto send = t.poll(pkt, t.due);
+            t.due = false;
+            if (!send) {continue;}
+            pkt.header.ep = t.ep_num;
+            pkt.header.flags = 0;
+            ctx.usb->ep_write(reinterpret_cast<struct usb_raw_ep_io *>(&pkt));
+            sent = true;
+        }
+        if (sent) {
+            continue;
+        }
+
+        const auto timeout_at = l.wheel->next_expiry();
+        if (l.events & EVENT_DATA) {
+            ctx.wait_for_host(*l.channel, timeout_at);
+        } else if (timeout_at == std::chrono::steady_clock::time_point::max()) {
+            l.channel->wait();
+        } else {
+            l.channel->wait_until(timeout_at);
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <vector>
+#include "event_hub.h"
+#include "main_app.h"
+#include "timer_wheel.h"
+
+constexpr auto ENDPOINT_SCHEDULER_TICK = std::chrono::milliseconds(5);
+constexpr size_t ENDPOINT_SCHEDULER_SLOTS = 64;
+
+// Serves several IN endpoints of a model from one thread per lane instead of
+// one thread each. Every endpoint is polled for its next packet whenever one
+// of its events (EVENT_DATA, EVENT_LINE_STATUS) is posted, and again when
+// its period elapses, which a timer wheel per lane keeps track of; the
+// zero-length and status packets some models send while idle come from
+// there.
+//
+// ep_write() blocks until the host takes the packet, so an endpoint the host
+// stops polling holds up its whole lane. Endpoints the host may leave alone
+// go on a lane of their own. OUT endpoints are not handled here: raw-gadget
+// can only wait for them with a blocking read per endpoint.
+class endpoint_scheduler {
+    public:
+        // Fills pkt.data and pkt.header.length with the endpoint's next packet and
+        // returns true to send it, false if there is nothing to send. due is set
+        // when the endpoint's period has elapsed.
+        using poll_func_t = std::function<bool(struct usb_packet_control &pkt, bool due)>;
+    private:
+        struct task {
+            int lane;
+            int ep_num;
+            std::chrono::milliseconds period; // 0 for event driven only
+            poll_func_t poll;
+            bool due = false;
+            std::chrono::steady_clock::time_point next_at;
+        };
+        // Everything a lane thread touches is allocated by start(), so the
+        // threads themselves never call malloc.
+        struct lane {
+            uint32_t events = 0; // of all its endpoints
+            std::vector<uint32_t> ids;
+            std::vector<uint32_t> expired;
+            event_channel *channel = nullptr;
+            timer_wheel *wheel = nullptr;
+            std::thread *thread = nullptr;
+        };
+        std::vector<task> tasks;
+        std::vector<lane> lanes;
+        int debug_level = 0;
+        void *lane_thread(int lane);
+    public:
+        endpoint_scheduler(int lanes);
+        void set_debug_level(const int level);
+        void add(int lane, int ep_num, uint32_t events, const std::chrono::milliseconds &period, poll_func_t poll);
+        void start(void);
+};
@@ -0,0 +1,59 @@
+#include "escape_detector.h"
+#include "app_context.h"
+#include "modem.h"
+
+constexpr int ESCAPE_LENGTH = 3;
+
+escape_detector::escape_detector(Modem *modem) : modem(modem)
+{
+}
+
+escape_detector::~escape_detector()
+{
+    reset();
+}
+
+// Called by the bulk OUT thread with every packet sent while on-line.
+void escape_detector::scan(const char *data, size_t length)
+{
+    const auto now = std::chrono::steady_clock::now();
+    const auto guard_time = modem->get_guard_time();
+    const bool after_silence = now - last_data >= guard_time;
+    last_data = now;
+
+    if (timer != 0) {
+        // data within the final guard time
+        reset();
+    }
+    if (count > 0 && after_silence) {
+        count = 0; // the escape characters came too slowly
+    }
+    if (count == 0 && !after_silence) {
+        return;
+    }
+
+    const auto escape_char = modem->get_escape_char();
+    if (escape_char < 0 || length > (size_t) (ESCAPE_LENGTH - count)) {
+        count = 0;
+        return;
+    }
+    for (size_t i = 0; i < length; i++) {
+        if (data[i] != escape_char) {
+            count = 0;
+            return;
+        }
+    }
+    count += length;
+    if (count == ESCAPE_LENGTH) {
+        timer = ctx.reactor->add_timer(guard_time, [m = modem]{m->enter_command_mode();});
+    }
+}
+
+void escape_detector::reset(void)
+{
+    if (timer != 0) {
+        ctx.reactor->cancel_timer(timer);
+        timer = 0;
+    }
+    count = 0;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include "io_reactor.h"
+
+class Modem;
+
+// Hayes escape sequence on the on-line data stream: guard time of silence,
+// three escape characters (S2, '+') each within the guard time of the
+// previous one, and guard time of silence again. The guard time is S12 in
+// 1/50 s. The characters are still sent to the peer; the final silence is
+// timed on the reactor, which then puts the modem in on-line command mode.
+//
+// An escape can only start after a silent period, so packets of a data
+// stream are passed over after one clock read; only the few bytes of a
+// packet that follows silence are looked at.
+class escape_detector {
+    private:
+        Modem *modem;
+        std::chrono::steady_clock::time_point last_data{};
+        int count = 0;
+        io_reactor::timer_id_t timer = 0;
+    public:
+        escape_detector(Modem *modem);
+        ~escape_detector();
+        escape_detector(const escape_detector &) = delete;
+        escape_detector &operator=(const escape_detector &) = delete;
+        void scan(const char *data, size_t length);
+        void reset(void);
+};
@@ -0,0 +1,73 @@
+#include <algorithm>
+
+#include "event_hub.h"
+
+event_channel::event_channel(event_hub &hub, uint32_t mask)
+    : hub(hub), mask(mask)
+{
+    hub.subscribe(this);
+}
+
+event_channel::~event_channel()
+{
+    hub.unsubscribe(this);
+}
+
+void event_channel::post(uint32_t events)
+{
+    events &= mask;
+    if (events == 0) {
+        return;
+    }
+
+    bool was_idle;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        was_idle = (pending == 0);
+        pending |= events;
+    }
+    // a waiter with events already pending is woken up anyway
+    if (was_idle) {
+        cv.notify_one();
+    }
+}
+
+// Blocks until an event arrives and returns (and clears) the pending events.
+uint32_t event_channel::wait(void)
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    cv.wait(lock, [&]{return pending != 0;});
+    const auto events = pending;
+    pending = 0;
+    return events;
+}
+
+// Like wait(), but returns 0 when timeout_at passes first.
+uint32_t event_channel::wait_until(const std::chrono::steady_clock::time_point &timeout_at)
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    cv.wait_until(lock, timeout_at, [&]{return pending != 0;});
+    const auto events = pending;
+    pending = 0;
+    return events;
+}
+
+void event_hub::subscribe(event_channel *channel)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    channels.push_back(channel);
+}
+
+void event_hub::unsubscribe(event_channel *channel)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    channels.erase(std::remove(channels.begin(), channels.end(), channel), channels.end());
+}
+
+void event_hub::post(uint32_t events)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    for (auto channel : channels) {
+        channel->post(events);
+    }
+}
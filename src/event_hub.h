@@ -0,0 +1,48 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+enum : uint32_t {
+    EVENT_DATA        = 0x01, // usb_tx_buffer or usb_ctrl_buffer has new data
+    EVENT_LINE_STATUS = 0x02, // DCD or another modem status line changed
+};
+
+class event_hub;
+
+// Wakeup channel of one endpoint thread. Events it is interested in stay
+// pending until wait_until() collects them, so nothing posted between
+// checking the state and waiting is lost, and repeated posts coalesce into
+// a single wakeup.
+class event_channel {
+    friend class event_hub;
+    private:
+        event_hub &hub;
+        const uint32_t mask;
+        std::mutex mtx;
+        std::condition_variable cv;
+        uint32_t pending = 0;
+        void post(uint32_t events);
+    public:
+        event_channel(event_hub &hub, uint32_t mask);
+        ~event_channel();
+        event_channel(const event_channel &) = delete;
+        event_channel &operator=(const event_channel &) = delete;
+        uint32_t wait(void);
+        uint32_t wait_until(const std::chrono::steady_clock::time_point &timeout_at);
+};
+
+// Fans events out to the subscribed channels.
+class event_hub {
+    friend class event_channel;
+    private:
+        std::mutex mtx;
+        std::vector<event_channel *> channels;
+        void subscribe(event_channel *channel);
+        void unsubscribe(event_channel *channel);
+    public:
+        void post(uint32_t events);
+};
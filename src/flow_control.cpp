@@ -0,0 +1,77 @@
+#include <algorithm>
+#include <cstdio>
+#include <sys/epoll.h>
+
+#include "flow_control.h"
+
+recv_flow_control::recv_flow_control(const char *name, io_reactor *reactor)
+{
+    recv_flow_control::name = name;
+    recv_flow_control::reactor = reactor;
+}
+
+void recv_flow_control::set_debug_level(const int level)
+{
+    debug_level = level;
+}
+
+void recv_flow_control::set_watermarks(size_t high, size_t low)
+{
+    high_watermark = high;
+    low_watermark = low;
+}
+
+// Called on every wakeup of the reader's handler before it reads. Returns
+// paused when input was disabled until the buffer drains, and hang_up when
+// the fd hung up or failed while the buffer is full: EPOLLHUP and EPOLLERR
+// cannot be masked, so pausing then would wake the reactor again right away,
+// for as long as the host does not read.
+recv_flow_control::action recv_flow_control::check(int fd, uint32_t events, ring_buffer<char> &buffer)
+{
+    if (high_watermark == 0 || buffer.get_count() < high_watermark) {
+        return action::read;
+    }
+    if (events & (EPOLLHUP | EPOLLERR)) {
+        return action::hang_up;
+    }
+    return pause(fd, buffer) ? action::paused : action::read;
+}
+
+// Disables input on fd until the IN endpoints drain the buffer below the low
+// watermark, or below half of it without flow control. Returns false, with
+// input left enabled, if it has drained already.
+bool recv_flow_control::pause(int fd, ring_buffer<char> &buffer)
+{
+    reactor->disable(fd, EPOLLIN);
+    const auto level = (high_watermark != 0) ? low_watermark : buffer.get_buffer_size() / 2;
+    const auto armed = buffer.notify_below(level, [this, fd]{
+        if (debug_level >= 1) {printf("%s: flow control: resume receiving.\n", name);}
+        reactor->enable(fd, EPOLLIN);
+    });
+    if (armed) {
+        if (debug_level >= 1) {printf("%s: flow control: pause receiving.\n", name);}
+        return true;
+    }
+    reactor->enable(fd, EPOLLIN);
+    return false;
+}
+
+// With flow control, reads stop at the high watermark so nothing is lost to
+// a full buffer.
+size_t recv_flow_control::limit(ring_buffer<char> &buffer, size_t span_length) const
+{
+    if (high_watermark == 0) {
+        return span_length;
+    }
+    const auto count = buffer.get_count();
+    return std::min(span_length, (count < high_watermark) ? high_watermark - count : 1);
+}
+
+// How much may be received now: up to the high watermark with flow control,
+// the free space otherwise.
+size_t recv_flow_control::room(ring_buffer<char> &buffer) const
+{
+    const auto limit = (high_watermark != 0) ? high_watermark : buffer.get_buffer_size();
+    const auto count = buffer.get_count();
+    return (count < limit) ? limit - count : 0;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "io_reactor.h"
+#include "ring_buffer.h"
+
+// Watermark flow control for a reader on the reactor thread that receives
+// into a ring buffer (tcp_sock, udp_sock, pty_dev, ppp_server): input on its
+// fd is disabled while the buffer is above the high watermark and enabled
+// again once the IN endpoints drain it below the low watermark.
+class recv_flow_control {
+    public:
+        enum class action {read, paused, hang_up};
+    private:
+        const char *name;
+        io_reactor *reactor;
+        size_t high_watermark = 0, low_watermark = 0;
+        int debug_level = 0;
+    public:
+        recv_flow_control(const char *name, io_reactor *reactor);
+        void set_debug_level(const int level);
+        void set_watermarks(size_t high, size_t low);
+        bool is_enabled(void) const {return high_watermark != 0;}
+        action check(int fd, uint32_t events, ring_buffer<char> &buffer);
+        bool pause(int fd, ring_buffer<char> &buffer);
+        size_t room(ring_buffer<char> &buffer) const;
+        size_t limit(ring_buffer<char> &buffer, size_t span_length) const;
+};
@@ -0,0 +1,180 @@
+#include "hdlc.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Slice-by-8 tables for the reflected CRC-16 with polynomial 0x8408:
+// fcs16_table[k][b] is the FCS contribution of byte b followed by k zero bytes.
+static const struct fcs16_tables {
+    uint16_t value[8][256];
+    fcs16_tables() {
+        for (int b = 0; b < 256; b++) {
+            uint16_t v = b;
+            for (int i = 0; i < 8; i++) {
+                v = (v & 1) ? (v >> 1) ^ 0x8408 : v >> 1;
+            }
+            value[0][b] = v;
+        }
+        for (int k = 1; k < 8; k++) {
+            for (int b = 0; b < 256; b++) {
+                const auto prev = value[k - 1][b];
+                value[k][b] = (prev >> 8) ^ value[0][prev & 0xff];
+            }
+        }
+    }
+} fcs16_table;
+
+uint16_t hdlc_fcs16_bytewise(uint16_t fcs, const uint8_t *data, size_t length)
+{
+    const auto &t = fcs16_table.value[0];
+    for (size_t i = 0; i < length; i++) {
+        fcs = (fcs >> 8) ^ t[(fcs ^ data[i]) & 0xff];
+    }
+    return fcs;
+}
+
+uint16_t hdlc_fcs16(uint16_t fcs, const uint8_t *data, size_t length)
+{
+    const auto &t = fcs16_table.value;
+    while (length >= 8) {
+        fcs = t[7][(fcs ^ data[0]) & 0xff] ^ t[6][((fcs >> 8) ^ data[1]) & 0xff]
+            ^ t[5][data[2]] ^ t[4][data[3]] ^ t[3][data[4]] ^ t[2][data[5]]
+            ^ t[1][data[6]] ^ t[0][data[7]];
+        data += 8;
+        length -= 8;
+    }
+    return hdlc_fcs16_bytewise(fcs, data, length);
+}
+
+// Index of the first flag or escape byte (or with control_chars, of any byte
+// below 0x20 too), length if there is none.
+template <bool control_chars>
+static inline size_t find_special(const uint8_t *data, size_t length)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    const auto flag = _mm_set1_epi8(HDLC_FLAG);
+    const auto escape = _mm_set1_epi8(HDLC_ESCAPE);
+    const auto control_max = _mm_set1_epi8(0x1f);
+    for (; i + 16 <= length; i += 16) {
+        const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&data[i]));
+        auto match = _mm_or_si128(_mm_cmpeq_epi8(v, flag), _mm_cmpeq_epi8(v, escape));
+        if (control_chars) {
+            match = _mm_or_si128(match, _mm_cmpeq_epi8(_mm_min_epu8(v, control_max), v));
+        }
+        const auto mask = _mm_movemask_epi8(match);
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#elif defined(__ARM_NEON)
+    const auto flag = vdupq_n_u8(HDLC_FLAG);
+    const auto escape = vdupq_n_u8(HDLC_ESCAPE);
+    const auto control_end = vdupq_n_u8(0x20);
+    for (; i + 16 <= length; i += 16) {
+        const auto v = vld1q_u8(&data[i]);
+        auto match = vorrq_u8(vceqq_u8(v, flag), vceqq_u8(v, escape));
+        if (control_chars) {
+            match = vorrq_u8(match, vcltq_u8(v, control_end));
+        }
+        // narrow to 4 bits per byte to get a 64-bit mask
+        const auto mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(match), 4)), 0);
+        if (mask != 0) {
+            return i + (__builtin_ctzll(mask) >> 2);
+        }
+    }
+#endif
+    for (; i < length; i++) {
+        const auto c = data[i];
+        if (c == HDLC_FLAG || c == HDLC_ESCAPE || (control_chars && c < 0x20)) {
+            return i;
+        }
+    }
+    return length;
+}
+
+size_t hdlc_find_special(const uint8_t *data, size_t length)
+{
+    return find_special<false>(data, length);
+}
+
+size_t hdlc_find_special_or_control(const uint8_t *data, size_t length)
+{
+    return find_special<true>(data, length);
+}
+
+hdlc_encoder::hdlc_encoder()
+{
+    set_accm(0xffffffff);
+}
+
+void hdlc_encoder::set_accm(uint32_t accm)
+{
+    hdlc_encoder::accm = accm;
+    for (int c = 0; c < 256; c++) {
+        escape_map[c] = (c == HDLC_FLAG || c == HDLC_ESCAPE || (c < 0x20 && (accm & (1U << c))));
+    }
+}
+
+// Copies data to out with byte stuffing; returns the bytes written.
+size_t hdlc_encoder::escape_run(const uint8_t *data, size_t length, uint8_t *out) const
+{
+    size_t out_length = 0;
+    size_t pos = 0;
+    while (pos < length) {
+        const auto run = (accm == 0) ? hdlc_find_special(&data[pos], length - pos)
+                                     : hdlc_find_special_or_control(&data[pos], length - pos);
+        memcpy(&out[out_length], &data[pos], run);
+        out_length += run;
+        pos += run;
+        if (pos == length) {
+            break;
+        }
+        // a control character outside the ACCM goes out as is
+        const auto c = data[pos++];
+        if (escape_map[c]) {
+            out[out_length++] = HDLC_ESCAPE;
+            out[out_length++] = c ^ 0x20;
+        } else {
+            out[out_length++] = c;
+        }
+    }
+    return out_length;
+}
+
+// Writes flag, header, data, FCS and flag to out, which must hold
+// max_encoded_length(header_length + length) bytes. Returns the frame length.
+size_t hdlc_encoder::encode(const uint8_t *header, size_t header_length, const uint8_t *data, size_t length, uint8_t *out) const
+{
+    uint16_t fcs = hdlc_fcs16(FCS16_INIT, header, header_length);
+    fcs = hdlc_fcs16(fcs, data, length) ^ 0xffff;
+    const uint8_t trailer[2] = {static_cast<uint8_t>(fcs & 0xff), static_cast<uint8_t>(fcs >> 8)};
+
+    size_t out_length = 0;
+    out[out_length++] = HDLC_FLAG;
+    out_length += escape_run(header, header_length, &out[out_length]);
+    out_length += escape_run(data, length, &out[out_length]);
+    out_length += escape_run(trailer, sizeof(trailer), &out[out_length]);
+    out[out_length++] = HDLC_FLAG;
+    return out_length;
+}
+
+hdlc_decoder::hdlc_decoder(size_t capacity) : capacity(capacity)
+{
+    frame = new uint8_t[capacity];
+}
+
+hdlc_decoder::~hdlc_decoder()
+{
+    delete[] frame;
+}
+
+void hdlc_decoder::reset(void)
+{
+    length = 0;
+    escaped = false;
+    overflow = false;
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Async HDLC-like framing as used by PPP on serial lines (RFC 1662): frames
+// are delimited by 0x7e, 0x7d escapes the next byte (XOR 0x20) and every
+// frame ends with an FCS-16. The hot loops work on runs of plain bytes: an
+// SSE2/NEON scan finds the next byte that needs attention, the run is
+// copied in one go and the FCS is computed 8 bytes per step.
+
+constexpr uint8_t HDLC_FLAG = 0x7e;
+constexpr uint8_t HDLC_ESCAPE = 0x7d;
+constexpr uint16_t FCS16_INIT = 0xffff;
+constexpr uint16_t FCS16_GOOD = 0xf0b8; // FCS over a frame including its FCS
+
+uint16_t hdlc_fcs16(uint16_t fcs, const uint8_t *data, size_t length);
+uint16_t hdlc_fcs16_bytewise(uint16_t fcs, const uint8_t *data, size_t length);
+size_t hdlc_find_special(const uint8_t *data, size_t length);
+size_t hdlc_find_special_or_control(const uint8_t *data, size_t length);
+
+// Frames packets for the wire, escaping the control characters in the
+// peer's ACCM (all of them until LCP has negotiated one).
+class hdlc_encoder {
+    private:
+        uint32_t accm = 0xffffffff;
+        bool escape_map[256];
+        size_t escape_run(const uint8_t *data, size_t length, uint8_t *out) const;
+    public:
+        hdlc_encoder();
+        void set_accm(uint32_t accm);
+        uint32_t get_accm(void) const {return accm;}
+        static constexpr size_t max_encoded_length(size_t length) {return 2 * (length + 2) + 2;}
+        size_t encode(const uint8_t *header, size_t header_length, const uint8_t *data, size_t length, uint8_t *out) const;
+};
+
+// Reassembles frames from a byte stream. input() calls on_frame(data, length)
+// for every frame whose FCS checks out, with the FCS removed; the pointer is
+// valid during the call only.
+class hdlc_decoder {
+    private:
+        uint8_t *frame;
+        size_t capacity;
+        size_t length = 0;
+        bool escaped = false;
+        bool overflow = false;
+        uint64_t bad_frames = 0;
+        void append(const uint8_t *data, size_t count);
+        template <typename F> void end_frame(F &on_frame);
+    public:
+        hdlc_decoder(size_t capacity);
+        ~hdlc_decoder();
+        hdlc_decoder(const hdlc_decoder &) = delete;
+        hdlc_decoder &operator=(const hdlc_decoder &) = delete;
+        void reset(void);
+        uint64_t get_bad_frames(void) const {return bad_frames;}
+        template <typename F> void input(const uint8_t *data, size_t count, F &&on_frame);
+};
+
+inline void hdlc_decoder::append(const uint8_t *data, size_t count)
+{
+    if (count > capacity - length) {
+        count = capacity - length;
+        overflow = true;
+    }
+    memcpy(&frame[length], data, count);
+    length += count;
+}
+
+template <typename F>
+void hdlc_decoder::end_frame(F &on_frame)
+{
+    // back-to-back flags give empty frames, which are not errors
+    if (length > 0) {
+        if (!overflow && length > 2 && hdlc_fcs16(FCS16_INIT, frame, length) == FCS16_GOOD) {
+            on_frame(static_cast<const uint8_t *>(frame), length - 2);
+        } else {
+            bad_frames++;
+        }
+    }
+    length = 0;
+    escaped = false;
+    overflow = false;
+}
+
+template <typename F>
+void hdlc_decoder::input(const uint8_t *data, size_t count, F &&on_frame)
+{
+    size_t pos = 0;
+    while (pos < count) {
+        if (escaped) {
+            const auto c = data[pos++];
+            escaped = false;
+            if (c == HDLC_FLAG) {
+                // 0x7d 0x7e aborts the frame
+                length = 0;
+                overflow = false;
+                continue;
+            }
+            const uint8_t unescaped = c ^ 0x20;
+            append(&unescaped, 1);
+            continue;
+        }
+        const auto run = hdlc_find_special(&data[pos], count - pos);
+        append(&data[pos], run);
+        pos += run;
+        if (pos == count) {
+            break;
+        }
+        if (data[pos++] == HDLC_ESCAPE) {
+            escaped = true;
+        } else {
+            end_frame(on_frame);
+        }
+    }
+}
@@ -0,0 +1,259 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "io_reactor.h"
+
+constexpr auto IO_REACTOR_MAX_EVENTS = 16;
+
+void* io_reactor::loop_thread(void)
+{
+    struct epoll_event events[IO_REACTOR_MAX_EVENTS];
+
+    if (debug_level >= 1) {printf("io_reactor: start loop_thread.\n");}
+    while (running.load()) {
+        auto ret = epoll_wait(epoll_fd, events, IO_REACTOR_MAX_EVENTS, next_timeout_ms());
+        if (ret < 0) {
+            if (errno == EINTR) {continue;}
+            printf("io_reactor: epoll_wait(): %s\n", std::strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < ret; i++) {
+            const auto id = events[i].data.u64;
+            if (id == 0) {
+                uint64_t value;
+                if (read(wakeup_fd, &value, sizeof(value)) < 0) {(void)value;}
+                continue;
+            }
+
+            std::lock_guard<std::mutex> dispatch_lock(dispatch_mtx);
+            handler_t handler;
+            {
+                // the fd may have been removed by an earlier handler in this batch
+                std::lock_guard<std::mutex> lock(mtx);
+                const auto it = handlers.find(id);
+                if (it == handlers.end()) {continue;}
+                handler = it->second;
+            }
+            handler(events[i].events);
+        }
+
+        run_expired_timers();
+    }
+
+    return nullptr;
+}
+
+int io_reactor::next_timeout_ms(void)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    if (timers.empty()) {
+        return -1;
+    }
+    const auto remaining = timers.begin()->first - std::chrono::steady_clock::now();
+    if (remaining <= std::chrono::steady_clock::duration::zero()) {
+        return 0;
+    }
+    // round up so the timer has expired when epoll_wait() returns
+    return std::chrono::duration_cast<std::chrono::milliseconds>(remaining + std::chrono::milliseconds(1) - std::chrono::nanoseconds(1)).count();
+}
+
+void io_reactor::run_expired_timers(void)
+{
+    while (true) {
+        timer_func_t func;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (timers.empty() || timers.begin()->first > std::chrono::steady_clock::now()) {
+                return;
+            }
+            func = std::move(timers.begin()->second.second);
+            timers.erase(timers.begin());
+        }
+        std::lock_guard<std::mutex> dispatch_lock(dispatch_mtx);
+        func();
+    }
+}
+
+void io_reactor::wakeup(void)
+{
+    const uint64_t value = 1;
+    if (write(wakeup_fd, &value, sizeof(value)) < 0) {
+        printf("io_reactor: write(): %s\n", std::strerror(errno));
+    }
+}
+
+io_reactor::io_reactor()
+{
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        throw std::runtime_error((std::string) "io_reactor: epoll_create1(): " + std::strerror(errno));
+    }
+
+    wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeup_fd < 0) {
+        ::close(epoll_fd);
+        throw std::runtime_error((std::string) "io_reactor: eventfd(): " + std::strerror(errno));
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = 0;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wakeup_fd, &ev) < 0) {
+        ::close(wakeup_fd);
+        ::close(epoll_fd);
+        throw std::runtime_error((std::string) "io_reactor: epoll_ctl(): " + std::strerror(errno));
+    }
+
+    loop_thread_ptr = new std::thread([this]{loop_thread();});
+    loop_thread_id = loop_thread_ptr->get_id();
+}
+
+io_reactor::~io_reactor()
+{
+    stop();
+    ::close(wakeup_fd);
+    ::close(epoll_fd);
+}
+
+void io_reactor::set_debug_level(const int level)
+{
+    debug_level = level;
+}
+
+bool io_reactor::is_loop_thread(void)
+{
+    return std::this_thread::get_id() == loop_thread_id;
+}
+
+void io_reactor::add(int fd, uint32_t events, handler_t handler)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+
+    const auto id = next_id++;
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.u64 = id;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        throw std::runtime_error((std::string) "io_reactor: epoll_ctl(EPOLL_CTL_ADD): " + std::strerror(errno));
+    }
+    fd_ids[fd] = id;
+    fd_events[fd] = events;
+    handlers[id] = std::move(handler);
+}
+
+void io_reactor::modify(int fd, uint32_t events)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    modify_without_lock(fd, events);
+}
+
+// enable()/disable() change only the given bits, so e.g. a writer waiting for
+// EPOLLOUT and flow control pausing EPOLLIN can share one registration.
+void io_reactor::enable(int fd, uint32_t events)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    const auto it = fd_events.find(fd);
+    if (it != fd_events.end() && (it->second & events) != events) {
+        modify_without_lock(fd, it->second | events);
+    }
+}
+
+void io_reactor::disable(int fd, uint32_t events)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    const auto it = fd_events.find(fd);
+    if (it != fd_events.end() && (it->second & events) != 0) {
+        modify_without_lock(fd, it->second & ~events);
+    }
+}
+
+void io_reactor::modify_without_lock(int fd, uint32_t events)
+{
+    const auto it = fd_ids.find(fd);
+    if (it == fd_ids.end()) {
+        return;
+    }
+    fd_events[fd] = events;
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.u64 = it->second;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+        printf("io_reactor: epoll_ctl(EPOLL_CTL_MOD): %s\n", std::strerror(errno));
+    }
+}
+
+// Unregisters fd. When called from another thread, this also waits for a
+// handler that is running right now, so the fd can be closed safely afterwards.
+void io_reactor::remove(int fd)
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+
+        const auto it = fd_ids.find(fd);
+        if (it == fd_ids.end()) {
+            return;
+        }
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        handlers.erase(it->second);
+        fd_ids.erase(it);
+        fd_events.erase(fd);
+    }
+
+    if (!is_loop_thread()) {
+        std::lock_guard<std::mutex> dispatch_lock(dispatch_mtx);
+    }
+}
+
+io_reactor::timer_id_t io_reactor::add_timer(const std::chrono::steady_clock::duration &delay, timer_func_t func)
+{
+    timer_id_t id;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        id = next_id++;
+        timers.emplace(std::chrono::steady_clock::now() + delay, std::make_pair(id, std::move(func)));
+    }
+    if (!is_loop_thread()) {
+        wakeup();
+    }
+    return id;
+}
+
+void io_reactor::cancel_timer(timer_id_t id)
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (auto it = timers.begin(); it != timers.end(); ++it) {
+            if (it->second.first == id) {
+                timers.erase(it);
+                break;
+            }
+        }
+    }
+
+    if (!is_loop_thread()) {
+        std::lock_guard<std::mutex> dispatch_lock(dispatch_mtx);
+    }
+}
+
+void io_reactor::stop(void)
+{
+    if (loop_thread_ptr == nullptr) {
+        return;
+    }
+    running.store(false);
+    wakeup();
+    if (is_loop_thread()) {
+        loop_thread_ptr->detach();
+    } else if (loop_thread_ptr->joinable()) {
+        loop_thread_ptr->join();
+    }
+    delete loop_thread_ptr;
+    loop_thread_ptr = nullptr;
+}
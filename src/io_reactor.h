@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+// epoll based event loop running on a single thread. File descriptors are
+// registered with a handler that is called on the loop thread with the
+// ready epoll events; one-shot timers run on the same thread.
+class io_reactor {
+    public:
+        using handler_t = std::function<void(uint32_t)>;
+        using timer_func_t = std::function<void(void)>;
+        using timer_id_t = uint64_t;
+    private:
+        int epoll_fd = -1;
+        int wakeup_fd = -1; // eventfd used to interrupt epoll_wait()
+        int debug_level = 0;
+        std::atomic<bool> running{true};
+        std::thread *loop_thread_ptr = nullptr;
+        std::thread::id loop_thread_id;
+        std::mutex mtx;          // guards the tables below
+        std::mutex dispatch_mtx; // held while a handler or timer runs
+        uint64_t next_id = 1;
+        std::unordered_map<int, uint64_t> fd_ids;
+        std::unordered_map<int, uint32_t> fd_events;
+        std::unordered_map<uint64_t, handler_t> handlers;
+        std::multimap<std::chrono::steady_clock::time_point, std::pair<timer_id_t, timer_func_t>> timers;
+        void* loop_thread(void);
+        int next_timeout_ms(void);
+        void run_expired_timers(void);
+        void wakeup(void);
+        void modify_without_lock(int fd, uint32_t events);
+    public:
+        io_reactor();
+        ~io_reactor();
+        void set_debug_level(const int level);
+        bool is_loop_thread(void);
+        void add(int fd, uint32_t events, handler_t handler);
+        void modify(int fd, uint32_t events);
+        void enable(int fd, uint32_t events);
+        void disable(int fd, uint32_t events);
+        void remove(int fd);
+        timer_id_t add_timer(const std::chrono::steady_clock::duration &delay, timer_func_t func);
+        void cancel_timer(timer_id_t id);
+        void stop(void);
+};
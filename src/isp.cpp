@@ -0,0 +1,133 @@
+#include <fstream>
+#include <iostream>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+#include "isp.h"
+
+std::atomic<ISP::State> ISP::state{ISP::State::Idle};
+
+// Starts the command and returns its pid without waiting for it, -1 on error.
+pid_t ISP::spawnCommand(const std::vector<std::string>& args) {
+    if (args.empty()) return -1;
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        std::cerr << "Failed to fork for command\n";
+        return -1;
+    }
+
+    if (pid == 0) {
+        // Child process
+        std::vector<char*> c_args;
+        for (const auto& s : args)
+            c_args.push_back(const_cast<char*>(s.c_str()));
+        c_args.push_back(nullptr);
+
+        // Detach signals to avoid EINTR on parent
+        setsid();
+
+        execvp(c_args[0], c_args.data());
+        std::cerr << "Failed to exec " << c_args[0] << "\n";
+        _exit(1);
+    }
+    return pid;
+}
+
+bool ISP::runCommand(const std::vector<std::string>& args) {
+    const pid_t pid = spawnCommand(args);
+    if (pid < 0) return false;
+
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        std::cerr << "Command failed: " << args[0] << "\n";
+        return false;
+    }
+    return true;
+}
+
+bool ISP::setIpforward() {
+    // no sudo round trip when forwarding is on already
+    std::ifstream ip_forward("/proc/sys/net/ipv4/ip_forward");
+    char value = '0';
+    if (ip_forward >> value && value == '1') {
+        std::cout << "IP forwarding already enabled\n";
+        return true;
+    }
+    if (!runCommand({"sudo", "sysctl", "-w", "net.ipv4.ip_forward=1"})) {
+        return false;
+    }
+    std::cout << "IP forwarding enabled\n";
+    return true;
+}
+
+bool ISP::setIptables() {
+    // one shell for all rules; each is only added when the check fails
+    const bool ok = runCommand({"sudo", "sh", "-c",
+        "(iptables -t nat -C POSTROUTING -o wlan0 -j MASQUERADE 2>/dev/null ||"
+        " iptables -t nat -A POSTROUTING -o wlan0 -j MASQUERADE) &&"
+        " (iptables -C FORWARD -i ppp+ -o wlan0 -j ACCEPT 2>/dev/null ||"
+        " iptables -A FORWARD -i ppp+ -o wlan0 -j ACCEPT) &&"
+        " (iptables -C FORWARD -i wlan0 -o ppp+ -m state --state RELATED,ESTABLISHED -j ACCEPT 2>/dev/null ||"
+        " iptables -A FORWARD -i wlan0 -o ppp+ -m state --state RELATED,ESTABLISHED -j ACCEPT)"});
+    if (!ok) {
+        return false;
+    }
+    std::cout << "iptables rules applied successfully\n";
+    return true;
+}
+
+// Runs the network preparation unless it succeeded before; concurrent and
+// later calls return the cached result (false while it is still in progress).
+bool ISP::prepare() {
+    auto expected = State::Idle;
+    if (!state.compare_exchange_strong(expected, State::Preparing)) {
+        if (expected != State::Failed || !state.compare_exchange_strong(expected, State::Preparing)) {
+            return expected == State::Ready;
+        }
+    }
+    const bool ok = setIpforward() && setIptables();
+    state.store(ok ? State::Ready : State::Failed);
+    if (!ok) {
+        std::cerr << "ISP setup failed; dial-up clients may not reach the network\n";
+    }
+    return ok;
+}
+
+// Called when a PPP number is dialed; never blocks the dial. If the setup
+// is not Ready it says so, and after a failure it is retried off-thread.
+void ISP::prepareForDial() {
+    const auto current = state.load();
+    if (current == State::Ready) return;
+
+    if (current == State::Failed) {
+        std::cerr << "Dialing with the ISP setup failed; retrying it in the background\n";
+    } else {
+        std::cerr << "Dialing before the ISP setup has finished\n";
+    }
+    if (current != State::Preparing) {
+        std::thread(ISP::prepare).detach();
+    }
+}
+
+// pppd stays in the foreground (nodetach) so its supervisor can reap it. A
+// standby pppd is silent: it waits for the host's first LCP packet instead
+// of giving up after its Configure-Requests go unanswered.
+std::vector<std::string> ISP::pppdCommand(const std::string& slave_name, bool standby) {
+    std::vector<std::string> cmd = {
+        "sudo",
+        "pppd",
+        slave_name,
+        "115200",
+        "nodetach",
+        "local",
+        "debug",
+        "10.0.0.1:10.0.0.2",
+        "ms-dns", "10.0.0.1",
+        "proxyarp"
+    };
+    if (standby) cmd.push_back("silent");
+    return cmd;
+}
@@ -0,0 +1,104 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include "line_pacer.h"
+
+constexpr auto PACER_BURST = std::chrono::milliseconds(5);
+constexpr int BITS_PER_BYTE = 10; // start + 8 data + stop
+
+void line_pacer::set_debug_level(const int level)
+{
+    debug_level = level;
+}
+
+// Turns pacing on. bps is also the speed reported in CONNECT.
+void line_pacer::set_line_rate(uint32_t bps)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    line_rate = bps;
+    enabled = bps > 0;
+    update_rate_without_lock();
+}
+
+uint32_t line_pacer::get_line_rate(void)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return line_rate > 0 ? line_rate : 57600;
+}
+
+// Serial rate requested by the host driver (SET_LINE_CODING and alike).
+void line_pacer::set_dte_rate(uint32_t bps)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    if (dte_rate == bps) {
+        return;
+    }
+    dte_rate = bps;
+    update_rate_without_lock();
+}
+
+uint32_t line_pacer::get_effective_rate(void)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    if (!enabled) {return 0;}
+    return dte_rate > 0 ? std::min(line_rate, dte_rate) : line_rate;
+}
+
+void line_pacer::update_rate_without_lock(void)
+{
+    if (!enabled) {
+        return;
+    }
+    const auto rate = dte_rate > 0 ? std::min(line_rate, dte_rate) : line_rate;
+    bytes_per_us = (double) rate / BITS_PER_BYTE / 1e6;
+    burst = std::max(1.0, bytes_per_us * std::chrono::duration_cast<std::chrono::microseconds>(PACER_BURST).count());
+    tokens = std::min(tokens, burst);
+    printf("line_pacer: effective line rate %u bps (line %u bps, DTE %u bps)\n", rate, line_rate, dte_rate);
+}
+
+void line_pacer::refill_without_lock(const std::chrono::steady_clock::time_point &now)
+{
+    const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(now - last_refill).count();
+    tokens = std::min(burst, tokens + elapsed * bytes_per_us);
+    last_refill = now;
+}
+
+// How many of length bytes may go to the host now.
+size_t line_pacer::limit(size_t length)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    if (!enabled) {
+        return length;
+    }
+    refill_without_lock(std::chrono::steady_clock::now());
+    return std::min(length, (size_t) tokens);
+}
+
+void line_pacer::consume(size_t length)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    if (!enabled) {
+        return;
+    }
+    tokens -= length;
+    if (debug_level >= 3) {printf("line_pacer: sent %ld bytes, %.1f tokens left\n", (long) length, tokens);}
+}
+
+// When length bytes, or a full bucket if that is less, may be sent; now if
+// pacing is off. Waiting for a bucket's worth keeps the host from being fed
+// single bytes.
+std::chrono::steady_clock::time_point line_pacer::ready_at(size_t length)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    const auto now = std::chrono::steady_clock::now();
+    if (!enabled) {
+        return now;
+    }
+    refill_without_lock(now);
+    const auto wanted = std::min<double>(std::max<size_t>(length, 1), std::floor(burst));
+    if (tokens >= wanted) {
+        return now;
+    }
+    return now + std::chrono::microseconds((long) ((wanted - tokens) / bytes_per_us) + 1);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+// Token bucket that releases received data towards the host at the speed of
+// a real modem line instead of in USB sized bursts. The rate is the CONNECT
+// line rate, capped by the serial rate the host driver configured (if the
+// model lets it), at 10 bits per byte (8N1). The bucket only holds a few
+// milliseconds worth of bytes, so the per-byte delay stays stable.
+class line_pacer {
+    private:
+        std::mutex mtx;
+        bool enabled = false;
+        uint32_t line_rate = 57600; // bps, reported with CONNECT
+        uint32_t dte_rate = 0;      // bps set by the host driver, 0 if unknown
+        double bytes_per_us = 0;
+        double burst = 0;
+        double tokens = 0;
+        std::chrono::steady_clock::time_point last_refill;
+        int debug_level = 0;
+        void update_rate_without_lock(void);
+        void refill_without_lock(const std::chrono::steady_clock::time_point &now);
+    public:
+        void set_debug_level(const int level);
+        void set_line_rate(uint32_t bps);
+        uint32_t get_line_rate(void);
+        void set_dte_rate(uint32_t bps);
+        uint32_t get_effective_rate(void);
+        size_t limit(size_t length);
+        void consume(size_t length);
+        std::chrono::steady_clock::time_point ready_at(size_t length);
+};
@@ -9,36 +9,55 @@
 
 #include "ring_buffer.h"
 #include "tcp_sock.h"
+#include "udp_sock.h"
+#include "dns_server.h"
+#include "ppp_server.h"
 #include "pty_dev.h"
 #include "isp.h"
+#include "pppd_supervisor.h"
 #include "modem.h"
+#include "usb_raw_gadget.h"
 #include "app_context.h"
 
 AppContext ctx;
 
+// headroom kept free above the flow control high watermark so a receive never overruns the buffer
+constexpr size_t FLOW_CONTROL_HEADROOM = 4096;
+
+// matches the ppp+ interfaces of the NAT rules in isp.h
+constexpr const char *PPP_TUN_NAME = "ppptun0";
+
+// the DNS server address pppd and ppp_server hand out to the clients
+constexpr const char *ISP_DNS_ADDR = "10.0.0.1";
+
 void ring_callback()
 {
-    const std::string ring = "RING\r\n";
-    ctx.usb_tx_buffer.enqueue(ring.c_str(), ring.length());
-    ctx.usb_tx_buffer.notify_one();
+    ctx.current_modem->send_result(RESULT_RING);
 
     printf("Client connected.\n");
 }
 
-void recv_callback(const char *buffer, size_t length)
+void hangup_callback()
 {
-    if (ctx.connected.load()) {
-        const auto sent_length = ctx.usb_tx_buffer.enqueue(buffer, length);
-        if (ctx.debug_level >= 2) {
-            const auto buffer_size = ctx.usb_tx_buffer.get_buffer_size();
-            const auto data_count = ctx.usb_tx_buffer.get_count();
-            printf("usb_tx_buffer: used %ld bytes / %ld bytes (%.f%% used).\n", (long) data_count, (long) buffer_size, (float) data_count / buffer_size);
-        }
-        if (sent_length < length) {
-            printf("Transmit buffer is full! (overflow %ld bytes.)\n", length - sent_length);
-        }
-        ctx.usb_tx_buffer.notify_one();
+    ctx.current_modem->handle_carrier_loss();
+}
+
+// Called by tcp_sock/pty_dev after received data has landed in usb_tx_buffer's
+// reserved span. Returning false discards it instead of committing it.
+bool recv_callback(const char *buffer, size_t length)
+{
+    (void)buffer;
+    if (!ctx.connected.load()) {
+        return false;
+    }
+    ctx.usb_tx_codel.on_enqueue(length); // control() runs on dequeue, in the IN endpoint threads
+    if (ctx.debug_level >= 2) {
+        const auto buffer_size = ctx.usb_tx_buffer.get_buffer_size();
+        const auto data_count = ctx.usb_tx_buffer.get_count() + length;
+        const auto delay = ctx.usb_tx_codel.get_sojourn_time();
+        printf("usb_tx_buffer: used %ld bytes / %ld bytes (%.f%% used), queue delay %.1f ms.\n", (long) data_count, (long) buffer_size, (float) data_count / buffer_size, delay.count() / 1000.0);
     }
+    return true;
 }
 
 bool process_control_packet(usb_raw_control_event *e, struct usb_packet_control *pkt)
@@ -124,7 +143,7 @@ bool event_usb_control_loop()
 
 void show_usage(char *prog_name, bool verbose)
 {
-    printf("Usage: %s [-svh] [-m model] [ip_addr port] [usb_driver] [usb_device]\n", prog_name);
+    printf("Usage: %s [-fsSuvpPh] [-m model] [-b bps] [-D dns_file] [-l latency] [-d timeout] [-t timeout] [-w window] [ip_addr port] [usb_driver] [usb_device]\n", prog_name);
     if (!verbose) {return;}
 
     printf("\n");
@@ -134,8 +153,29 @@ void show_usage(char *prog_name, bool verbose)
     printf("        OnlineStation Suntac OnlineStation (MS56KPS2)\n");
     printf("        SmartSCM      Conexant SmartSCM (P2GATE)\n");
     printf("        Lucent        Multi-Tech MultiMobile (MT5634MU)\n");
+    printf("  -b    line rate in bps reported with CONNECT (default: 57600)\n");
+    printf("        received data is paced to this rate, or to the host's serial rate if lower\n");
+    printf("  -D    answer the dial-up clients' DNS queries on %s with the names in dns_file\n", ISP_DNS_ADDR);
+    printf("        (dnsmasq address=/name/ip or hosts lines); others go to the system resolver\n");
+    printf("  -f    flow control. stop reading from the network while the transmit buffer is full\n");
+    printf("        instead of dropping data\n");
+    printf("  -d    dial timeout in seconds (default: 30)\n");
+    printf("  -l    queue latency target in ms for received data (default: 0, disabled)\n");
+    printf("        older data is dropped to keep the delay towards the PS2 bounded\n");
+    printf("  -p    keep a PTY with pppd waiting on it, so ATD100/168 starts LCP without delay\n");
+    printf("  -P    answer ATD100/168 with the built-in PPP server on a TUN interface (%s)\n", PPP_TUN_NAME);
+    printf("        instead of a PTY and pppd\n");
     printf("  -s    run as server\n");
+    printf("  -S    serve the model's IN endpoints from shared scheduler threads instead of one\n");
+    printf("        thread per endpoint (fewer threads on small boards)\n");
+    printf("  -t    peer timeout in ms. hang up with NO CARRIER when the peer is silent this long\n");
+    printf("        (default: 0, TCP keeps the kernel defaults; UDP only notices BYE)\n");
+    printf("        TCP finds an idle dead peer by keepalive, in whole seconds\n");
+    printf("  -u    use UDP with sequencing and retransmission instead of TCP\n");
+    printf("        (both sides must use the same transport)\n");
     printf("  -v    verbose. increment log level\n");
+    printf("  -w    coalescing window in us for data sent to the network (default: 0)\n");
+    printf("        USB packets arriving within the window go out in one write\n");
     printf("  -h    show this help message.\n");
     printf("\n");
     printf("Parameters:\n");
@@ -146,15 +186,24 @@ void show_usage(char *prog_name, bool verbose)
     return;
 }
 
+#ifndef ME56PS2_NO_MAIN
 int main(int argc, char *argv[])
 {
     ctx.current_modem = nullptr;
     const char *ip_addr = nullptr;
     int port = -1;
     bool is_server = false;
+    bool use_udp = false;
+    bool use_ppp_server = false;
+    bool pppd_standby = false;
+    const char *dns_overrides = nullptr;
+
+    bool flow_control = false;
+    int peer_timeout = 0;
+    int coalescing_window = 0;
 
     int opt;
-    while((opt = getopt(argc, argv, "m:svh")) != -1) {
+    while((opt = getopt(argc, argv, "m:b:D:fd:l:pPsSt:uvw:h")) != -1) {
         switch(opt) {
             case 'm': {
                 ctx.current_modem = Modem::getInstance(optarg);
@@ -165,12 +214,45 @@ int main(int argc, char *argv[])
                 }
                 break;
             }
+            case 'b':
+                ctx.usb_tx_pacer.set_line_rate(atoi(optarg));
+                break;
+            case 'D':
+                dns_overrides = optarg;
+                break;
+            case 'f':
+                flow_control = true;
+                break;
+            case 'd':
+                ctx.dial_timeout = std::chrono::seconds(atoi(optarg));
+                break;
+            case 'l':
+                ctx.usb_tx_codel.set_target(std::chrono::milliseconds(atoi(optarg)));
+                break;
+            case 'p':
+                pppd_standby = true;
+                break;
+            case 'P':
+                use_ppp_server = true;
+                break;
             case 's':
                 is_server = true;
                 break;
+            case 'S':
+                ctx.endpoint_scheduler = true;
+                break;
+            case 't':
+                peer_timeout = atoi(optarg);
+                break;
+            case 'u':
+                use_udp = true;
+                break;
             case 'v':
                 ctx.debug_level++;
                 break;
+            case 'w':
+                coalescing_window = atoi(optarg);
+                break;
             case 'h':
                 show_usage(argv[0], true);
                 exit(0);
@@ -194,20 +276,76 @@ int main(int argc, char *argv[])
         }
     }
 
+    ctx.usb_tx_buffer.set_data_notifier([]{ctx.usb_events.post(EVENT_DATA);});
+    ctx.usb_tx_codel.set_debug_level(ctx.debug_level);
+    ctx.usb_tx_pacer.set_debug_level(ctx.debug_level);
+    const auto high_watermark = ctx.usb_tx_buffer.get_buffer_size() - FLOW_CONTROL_HEADROOM;
+    const auto low_watermark = ctx.usb_tx_buffer.get_buffer_size() / 2;
+
+    // forwarding and NAT for the dial-up ISP, once, while the USB side comes up
+    std::thread(ISP::prepare).detach();
+
     ctx.usb = new usb_raw_gadget("/dev/raw-gadget");
     ctx.usb->set_debug_level(ctx.debug_level);
     ctx.usb->init(USB_SPEED_FULL);
     ctx.usb->run();
 
-    ctx.pty = new pty_dev();
+    ctx.reactor = new io_reactor();
+    ctx.reactor->set_debug_level(ctx.debug_level);
+
+    ctx.pty = new pty_dev(ctx.reactor);
     ctx.pty->set_debug_level(ctx.debug_level);
+    ctx.pty->set_recv_buffer(&ctx.usb_tx_buffer);
     ctx.pty->set_recv_callback(recv_callback);
+    ctx.pty->set_hangup_callback(hangup_callback);
+    ctx.pty->set_coalescing_window(std::chrono::microseconds(coalescing_window));
+    if (flow_control) {
+        ctx.pty->set_flow_control(high_watermark, low_watermark);
+    }
+
+    ctx.pppd = new pppd_supervisor(ctx.reactor);
+    ctx.pppd->set_debug_level(ctx.debug_level);
+    if (pppd_standby && !use_ppp_server) {
+        ctx.pppd->set_standby(true);
+    }
+
+    if (use_ppp_server) {
+        ctx.ppp = new ppp_server(ctx.reactor, PPP_TUN_NAME);
+        ctx.ppp->set_debug_level(ctx.debug_level);
+        ctx.ppp->set_recv_buffer(&ctx.usb_tx_buffer);
+        ctx.ppp->set_recv_callback(recv_callback);
+        ctx.ppp->set_hangup_callback(hangup_callback);
+        ctx.ppp->set_coalescing_window(std::chrono::microseconds(coalescing_window));
+        if (flow_control) {
+            ctx.ppp->set_flow_control(high_watermark, low_watermark);
+        }
+    }
+
+    if (dns_overrides != nullptr) {
+        const auto dns_addr = inet_addr(ISP_DNS_ADDR);
+        ctx.dns = new dns_server(ctx.reactor, dns_addr, dns_server::system_resolver(dns_addr));
+        ctx.dns->set_debug_level(ctx.debug_level);
+        if (!ctx.dns->load_overrides(dns_overrides)) {
+            exit(1);
+        }
+    }
 
     if (ip_addr != nullptr && port != -1) {
-        ctx.sock = new tcp_sock(is_server, ip_addr, port);
+        if (use_udp) {
+            ctx.sock = new udp_sock(ctx.reactor, is_server, ip_addr, port);
+        } else {
+            ctx.sock = new tcp_sock(ctx.reactor, is_server, ip_addr, port);
+        }
         ctx.sock->set_debug_level(ctx.debug_level);
         ctx.sock->set_ring_callback(ring_callback);
+        ctx.sock->set_recv_buffer(&ctx.usb_tx_buffer);
         ctx.sock->set_recv_callback(recv_callback);
+        ctx.sock->set_hangup_callback(hangup_callback);
+        ctx.sock->set_peer_timeout(std::chrono::milliseconds(peer_timeout));
+        ctx.sock->set_coalescing_window(std::chrono::microseconds(coalescing_window));
+        if (flow_control) {
+            ctx.sock->set_flow_control(high_watermark, low_watermark);
+        }
     }
 
     while(event_usb_control_loop());
@@ -216,3 +354,4 @@ int main(int argc, char *argv[])
 
     return 0;
 }
+#endif // ME56PS2_NO_MAIN
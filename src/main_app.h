@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <linux/usb/ch9.h>
 
@@ -53,3 +54,10 @@ struct usb_config_descriptors {
     struct usb_interface_descriptor interface;
     struct _usb_endpoint_descriptor endpoints[8];
 };
+
+// The control loop and the callbacks for the network side, for harnesses
+// that link the emulator without its main() (built with ME56PS2_NO_MAIN).
+bool event_usb_control_loop();
+bool recv_callback(const char *buffer, size_t length);
+void ring_callback();
+void hangup_callback();
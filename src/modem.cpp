@@ -1,3 +1,5 @@
+#include <cctype>
+#include <cerrno>
 #include <cstdio>
 #include <cstring>
 #include <string>
@@ -8,16 +10,26 @@
 #include "modem_omron.h"
 #include "modem_onlinestation.h"
 #include "modem_smartscm.h"
-#include "tcp_sock.h"
+#include "net_sock.h"
+#include "ppp_server.h"
 #include "pty_dev.h"
 #include "app_context.h"
+#include "pppd_supervisor.h"
 #include "isp.h"
 
-bool Modem::parse_address(const std::string &addr, struct sockaddr_in *parsed_addr) {
-    // Input format: "000-000-000-000#00000"
+bool Modem::parse_address(const std::string &dial, struct sockaddr_in *parsed_addr, std::string *session_code) {
+    // Input format: "000-000-000-000#00000*code", port and relay session code are optional
     int d[4] = {0, 0, 0, 0};
     int port = TCP_DEFAULT_PORT;
 
+    const auto star = dial.find('*');
+    const auto addr = dial.substr(0, star);
+    std::string code;
+    if (star != std::string::npos) {
+        code = dial.substr(star + 1);
+        if (code.empty() || code.length() > 32 || code.find_first_not_of("0123456789") != std::string::npos) {return false;}
+    }
+
     auto has_port = addr.find('#') != std::string::npos;
 
     // Parse IPv4 address
@@ -44,6 +56,7 @@ bool Modem::parse_address(const std::string &addr, struct sockaddr_in *parsed_ad
     parsed_addr->sin_family = AF_INET;
     parsed_addr->sin_port = htons(port);
     parsed_addr->sin_addr.s_addr = inet_addr(ip_addr);
+    if (session_code != nullptr) {*session_code = code;}
 
     return true;
 }
@@ -90,32 +103,32 @@ bool Modem::handle_control_request(usb_raw_control_event *e, struct usb_packet_c
     return true;
 }
 
-bool isPPPNumber(const std::string& s) {
-    static const std::vector<std::string> pppNumbers = {
+// Dial strings that go to the local PPP server instead of a peer
+static bool isPPPNumber(const char *number, size_t length) {
+    static const char * const pppNumbers[] = {
         "100",
         "168"
     };
 
-    std::string num = s;
-
     // Strip Pulse/Tone prefix
-    if (!num.empty() && (num[0] == 'T' || num[0] == 'P')) {
-        num = num.substr(1);
+    if (length > 0 && (number[0] == 'T' || number[0] == 'P')) {
+        number++;
+        length--;
     }
 
     // Strip trailing dash
-    if (!num.empty() && num.back() == '-') {
-        num.pop_back();
+    if (length > 0 && number[length - 1] == '-') {
+        length--;
     }
 
     // Ignore extensions
-    size_t commaPos = num.find(',');
-    if (commaPos != std::string::npos) {
-        num = num.substr(0, commaPos);
+    const auto comma = static_cast<const char *>(memchr(number, ',', length));
+    if (comma != nullptr) {
+        length = comma - number;
     }
 
-    for (const auto& base : pppNumbers) {
-        if (num == base) {
+    for (const auto base : pppNumbers) {
+        if (strlen(base) == length && memcmp(number, base, length) == 0) {
             return true;
         }
     }
@@ -123,77 +136,279 @@ bool isPPPNumber(const std::string& s) {
     return false;
 }
 
-void Modem::process_at(std::string &line) {
-    bool enter_online = false;
-    printf("AT command: %s\n", line.c_str());
+Modem::Modem() {
+    reset();
+    echo = false;
+}
+
+// ATZ / AT&F: factory defaults
+void Modem::reset() {
+    static const uint8_t defaults[S_REGISTERS_NUM] = {
+        0, 0, '+', '\r', '\n', '\b', 2, 50, 2, 6, 14, 95, 50,
+    };
+    echo = true;
+    verbose.store(true);
+    quiet.store(false);
+    for (int i = 0; i < S_REGISTERS_NUM; i++) {
+        s_registers[i].store(defaults[i]);
+    }
+}
+
+const at_reply *Modem::at_replies() const {
+    return nullptr;
+}
+
+void Modem::send_result(at_result result) {
+    if (result == RESULT_NONE || quiet.load()) {
+        return;
+    }
+    if (verbose.load()) {
+        // CONNECT carries the line rate
+        char text[32];
+        const auto length = snprintf(text, sizeof(text), at_result_text(result), ctx.usb_tx_pacer.get_line_rate());
+        ctx.send_to_host(text, length);
+    } else {
+        char text[8];
+        const auto length = snprintf(text, sizeof(text), "%d\r", result);
+        ctx.send_to_host(text, length);
+    }
+}
+
+void Modem::process_at(at_line_buffer &line) {
+    char *text = line.get_line();
+    const auto length = line.get_length();
+    printf("AT command: %.*s\n", (int) length, text);
 
     if (echo) {
-        const auto s = line + "\r";
-        ctx.usb_tx_buffer.enqueue(s.c_str(), s.length());
+        ctx.send_to_host(text, length + 1); // with the CR
+    }
+    if (line.is_overflow()) {
+        send_result(RESULT_ERROR);
+        return;
     }
 
-    if (process_at_ext(line)) {
+    for (size_t i = 0; i < length; i++) {
+        text[i] = toupper((unsigned char) text[i]);
+    }
+    if (length < 2 || text[0] != 'A' || text[1] != 'T') {
+        send_result(RESULT_OK);
         return;
     }
 
-    std::string reply = "\r\nOK\r\n";
-    if (line == "ATZ" || line == "AT&F") {echo = true;}
-    if (line == "ATE0") {echo = false;}
-    if (line == "ATA") {
-        reply = "CONNECT 57600 V42\r\n";
-        enter_online = true;
-    }
-    if (strncmp(line.c_str(), "ATD", 3) == 0) {
-        // PPP
-        if (isPPPNumber(line.substr(3))) {
-            if (ctx.pty->connect()) {
-                reply = "CONNECT 57600 V42\r\n";
-                enter_online = true;
-                ISP::setupISP(ctx.pty->get_slave_name());
-            } else {
-                reply = "BUSY\r\n";
-            }
-
-        // P2P
-        } else {
-            if (ctx.sock == nullptr) {
-                reply = "BUSY\r\n";
-            } else {
-                struct sockaddr_in addr;
-                if (Modem::parse_address(line.substr(4), &addr)) {
-                    ctx.sock->set_addr(&addr);
-                }
-                if (ctx.sock->connect()) {
-                    reply = "CONNECT 57600 V42\r\n";
-                    enter_online = true;
-                } else {
-                    reply = "BUSY\r\n";
-                }
-            }
+    at_tokenizer tokens(&text[2], length - 2);
+    at_command cmd;
+    auto result = RESULT_OK;
+    while (result == RESULT_OK && tokens.next(cmd)) {
+        result = execute(cmd);
+    }
+    if (tokens.has_error()) {
+        result = RESULT_ERROR;
+    }
+    // on-line before CONNECT goes out: the host may send data as soon as it sees it
+    if (result == RESULT_CONNECT) {
+        printf("Enter on-line mode.\n");
+        command_mode.store(false);
+        ctx.set_connected(true);
+    }
+    send_result(result);
+}
+
+// Runs one command of a command line. Anything after A, D or O is ignored, and
+// so is anything after a command that did not return RESULT_OK.
+at_result Modem::execute(const at_command &cmd) {
+    const auto replies = at_replies();
+    for (auto r = replies; r != nullptr && r->command != nullptr; r++) {
+        if (strlen(r->command) == cmd.length && memcmp(r->command, cmd.text, cmd.length) == 0) {
+            if (r->text == nullptr) {return RESULT_ERROR;}
+            ctx.send_to_host(r->text, strlen(r->text));
+            return RESULT_OK;
         }
     }
 
-    ctx.usb_tx_buffer.enqueue(reply.c_str(), reply.length());
-    ctx.usb_tx_buffer.notify_one();
+    const auto number = cmd.number < 0 ? 0 : cmd.number;
+    if (cmd.prefix == '&') {
+        if (cmd.name == 'F') {reset();}
+        return RESULT_OK;
+    }
+    if (cmd.prefix != '\0') {
+        return RESULT_OK;
+    }
+    switch (cmd.name) {
+    case 'A':
+        return RESULT_CONNECT;
+    case 'D':
+        return dial(cmd.arg, cmd.arg_length);
+    case 'E':
+        echo = number != 0;
+        break;
+    case 'H':
+        if (ctx.connected.load()) {handle_disconnect();}
+        break;
+    case 'O':
+        // back from on-line command mode
+        return command_mode.load() && ctx.connected.load() ? RESULT_CONNECT : RESULT_ERROR;
+    case 'Q':
+        quiet.store(number != 0);
+        break;
+    case 'V':
+        verbose.store(number != 0);
+        break;
+    case 'Z':
+        reset();
+        break;
+    case 'S':
+        if (cmd.number < 0 || cmd.number >= S_REGISTERS_NUM) {return RESULT_ERROR;}
+        if (cmd.op == '=') {
+            if (cmd.value > 255) {return RESULT_ERROR;}
+            s_registers[cmd.number].store(cmd.value);
+        } else if (cmd.op == '?') {
+            char text[12];
+            const auto length = snprintf(text, sizeof(text), verbose.load() ? "\r\n%03u\r\n" : "%03u\r\n",
+                s_registers[cmd.number].load());
+            ctx.send_to_host(text, length);
+        }
+        break;
+    }
+    return RESULT_OK;
+}
 
-    if (enter_online) {
+at_result Modem::dial(const char *number, size_t length) {
+    // PPP
+    // (forwarding and NAT are set up by ISP::prepare() at startup)
+    if (isPPPNumber(number, length)) {
+        ISP::prepareForDial();
+    }
+    if (isPPPNumber(number, length) && ctx.ppp != nullptr) {
+        return ctx.ppp->connect() ? RESULT_CONNECT : RESULT_BUSY;
+    }
+    if (isPPPNumber(number, length)) {
+        int fd;
+        std::string slave_name;
+        if (ctx.pppd->take_standby(&fd, &slave_name)) {
+            ctx.pty->attach(fd, slave_name);
+            return RESULT_CONNECT;
+        }
+        if (!ctx.pty->connect()) {
+            return RESULT_BUSY;
+        }
+        if (!ctx.pppd->start(ctx.pty->get_slave_name())) {
+            ctx.pty->disconnect();
+            return RESULT_BUSY;
+        }
+        return RESULT_CONNECT;
+    }
+
+    // P2P
+    if (ctx.sock == nullptr) {
+        return RESULT_BUSY;
+    }
+    if (length > 0 && (number[0] == 'T' || number[0] == 'P')) {
+        number++;
+        length--;
+    }
+    struct sockaddr_in addr;
+    std::string session_code;
+    if (Modem::parse_address(std::string(number, length), &addr, &session_code)) {
+        ctx.sock->set_addr(&addr);
+    }
+    if (!ctx.sock->set_session_code(session_code)) {
+        return RESULT_ERROR;
+    }
+    // the result code is sent by handle_dial_result()
+    dialing.store(true);
+    ctx.sock->connect(ctx.dial_timeout, [this](int error){handle_dial_result(error);});
+    return RESULT_NONE;
+}
+
+// Runs on the reactor thread when the peer or the PTY slave went away: drops
+// DCD by leaving on-line mode and tells the host with NO CARRIER.
+void Modem::handle_carrier_loss() {
+    if (!ctx.set_connected(false)) {
+        return;
+    }
+    command_mode.store(false);
+    printf("Carrier lost.\n");
+    ctx.discard_received_data();
+    send_result(RESULT_NO_CARRIER);
+
+    if (ctx.sock != nullptr) {ctx.sock->disconnect();}
+    if (ctx.pty != nullptr) {ctx.pty->disconnect();}
+    if (ctx.pppd != nullptr) {ctx.pppd->stop();}
+    if (ctx.ppp != nullptr) {ctx.ppp->disconnect();}
+}
+
+// Runs on the reactor thread when the connect started by ATD has finished.
+void Modem::handle_dial_result(int error) {
+    if (!dialing.exchange(false)) {
+        // the dial was aborted, but the connect made it through anyway
+        if (error == 0) {ctx.sock->disconnect();}
+        return;
+    }
+
+    if (error == 0) {
         printf("Enter on-line mode.\n");
-        ctx.connected.store(true);
+        ctx.set_connected(true);
+        send_result(RESULT_CONNECT);
+    } else if (error == ETIMEDOUT) {
+        send_result(RESULT_NO_CARRIER);
+    } else {
+        send_result(RESULT_BUSY);
     }
 }
 
-bool Modem::process_at_ext(std::string&) {
-    return false;
+// Runs on the reactor thread when the guard time after +++ has passed.
+void Modem::enter_command_mode() {
+    if (!ctx.connected.load() || command_mode.exchange(true)) {
+        return;
+    }
+    printf("Enter on-line command mode.\n");
+    send_result(RESULT_OK);
+}
+
+// S2 escape character, -1 if the escape sequence is disabled (S2 > 127)
+int Modem::get_escape_char() const {
+    const auto c = s_registers[2].load();
+    return c > 127 ? -1 : c;
+}
+
+// S12 in 1/50 s
+std::chrono::milliseconds Modem::get_guard_time() const {
+    return std::chrono::milliseconds(s_registers[12].load() * 20);
+}
+
+// Any character from the host while dialing aborts the dial, as on a real modem.
+// A line feed left over from the ATD line does not count.
+bool Modem::abort_dial_on_input(const char *data, size_t length) {
+    size_t i = 0;
+    while (i < length && (data[i] == '\r' || data[i] == '\n')) {i++;}
+    if (i == length || !dialing.exchange(false)) {
+        return false;
+    }
+    ctx.sock->cancel_connect();
+    printf("Dial aborted.\n");
+    send_result(RESULT_NO_CARRIER);
+    return true;
 }
 
 void Modem::handle_disconnect() {
-    ctx.connected.store(false);
+    if (ctx.set_connected(false)) {
+        ctx.discard_received_data();
+    }
+    command_mode.store(false);
+    if (dialing.exchange(false)) {
+        ctx.sock->cancel_connect();
+    }
     if (ctx.sock != nullptr && ctx.sock->is_connected()) {
         ctx.sock->disconnect();
         printf("disconnected.\n");
     }
     if (ctx.pty != nullptr && ctx.pty->is_connected()) {
         ctx.pty->disconnect();
+        ctx.pppd->stop();
+        printf("disconnected.\n");
+    }
+    if (ctx.ppp != nullptr && ctx.ppp->is_connected()) {
+        ctx.ppp->disconnect();
         printf("disconnected.\n");
     }
 }
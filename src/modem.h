@@ -1,10 +1,14 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <string>
 #include <thread>
 #include <arpa/inet.h>
+#include "at_command.h"
+#include "app_context.h"
 #include "main_app.h"
-#include "usb_raw_gadget.h"
+#include "usb_gadget.h"
 #include "usb_raw_control_event.h"
 
 class Modem {
@@ -18,13 +22,33 @@ public:
     virtual bool handle_set_configuration(usb_raw_control_event *e, struct usb_packet_control *pkt);
     virtual bool handle_control_request(usb_raw_control_event *e, struct usb_packet_control *pkt);
 
-    void process_at(std::string &line);
-    virtual bool process_at_ext(std::string &line);
+    void process_at(at_line_buffer &line);
+    void send_result(at_result result);
     void handle_disconnect();
+    void handle_carrier_loss();
+    bool abort_dial_on_input(const char *data, size_t length);
+    void enter_command_mode();
+    bool is_online() const {return ctx.connected.load() && !command_mode.load();}
+    int get_escape_char() const;
+    std::chrono::milliseconds get_guard_time() const;
 
-    static bool parse_address(const std::string &addr, struct sockaddr_in *parsed_addr);
+    static bool parse_address(const std::string &dial, struct sockaddr_in *parsed_addr, std::string *session_code = nullptr);
     static Modem *getInstance(const char *name);
 
+    static constexpr int S_REGISTERS_NUM = 32;
+
 protected:
     bool echo = false;
+    std::atomic<bool> verbose{true};  // ATV: result codes as words or numbers
+    std::atomic<bool> quiet{false};   // ATQ: no result codes at all
+    std::atomic<uint8_t> s_registers[S_REGISTERS_NUM];
+    std::atomic<bool> dialing{false}; // ATD is waiting for the network connect
+    std::atomic<bool> command_mode{false}; // on-line command mode after +++
+
+    Modem();
+    virtual const at_reply *at_replies() const;
+    at_result execute(const at_command &cmd);
+    at_result dial(const char *number, size_t length);
+    void reset();
+    void handle_dial_result(int error);
 };
@@ -1,7 +1,8 @@
 #include "modem_lucent.h"
-#include "tcp_sock.h"
+#include "net_sock.h"
 #include "pty_dev.h"
 #include "app_context.h"
+#include "endpoint_pump.h"
 
 static const struct _usb_string_descriptor<1> str_lang = {
     .bLength = sizeof(str_lang),
@@ -210,20 +211,39 @@ const void * const *LucentModem::string_descriptors() const { return str_descs;
 bool LucentModem::handle_set_configuration(usb_raw_control_event *e, struct usb_packet_control *pkt) {
     const auto id = e->ctrl.wValue & 0x00ff;
     if (id == 2) {
-        if (thread_intr_in == nullptr) {
+        const bool new_scheduler = ctx.endpoint_scheduler && scheduler == nullptr;
+        if (new_scheduler) {
+            // notifications and bulk IN share a lane; cdc-acm polls both while the port is open
+            scheduler = new endpoint_scheduler(1);
+            scheduler->set_debug_level(ctx.debug_level);
+        }
+        if (new_scheduler || (!ctx.endpoint_scheduler && thread_intr_in == nullptr)) {
             const int ep_num = ctx.usb->ep_enable(reinterpret_cast<struct usb_endpoint_descriptor *>(
                     const_cast<struct _usb_endpoint_descriptor *>(&cfg2_descs.endpoint1)));
-            thread_intr_in = new std::thread(&LucentModem::intr_in_thread, this, ep_num);
+            if (ctx.endpoint_scheduler) {
+                scheduler->add(0, ep_num, EVENT_LINE_STATUS, std::chrono::milliseconds(0),
+                    [this](struct usb_packet_control &p, bool due) {return intr_in_poll(p, due);});
+            } else {
+                thread_intr_in = new std::thread(&LucentModem::intr_in_thread, this, ep_num);
+            }
         }
         if (thread_bulk_out == nullptr) {
             const int ep_num = ctx.usb->ep_enable(reinterpret_cast<struct usb_endpoint_descriptor *>(
                     const_cast<struct _usb_endpoint_descriptor *>(&cfg2_descs.endpoints2[0])));
             thread_bulk_out = new std::thread(&LucentModem::bulk_out_thread, this, ep_num);
         }
-        if (thread_bulk_in == nullptr) {
+        if (new_scheduler || (!ctx.endpoint_scheduler && thread_bulk_in == nullptr)) {
             const int ep_num = ctx.usb->ep_enable(reinterpret_cast<struct usb_endpoint_descriptor *>(
                     const_cast<struct _usb_endpoint_descriptor *>(&cfg2_descs.endpoints2[1])));
-            thread_bulk_in = new std::thread(&LucentModem::bulk_in_thread, this, ep_num);
+            if (ctx.endpoint_scheduler) {
+                scheduler->add(0, ep_num, EVENT_DATA, std::chrono::milliseconds(0),
+                    [this](struct usb_packet_control &p, bool due) {return bulk_in_poll(p, due);});
+            } else {
+                thread_bulk_in = new std::thread(&LucentModem::bulk_in_thread, this, ep_num);
+            }
+        }
+        if (new_scheduler) {
+            scheduler->start();
         }
     }
     return Modem::handle_set_configuration(e, pkt);
@@ -236,14 +256,17 @@ enum {
 
 bool LucentModem::handle_control_request(usb_raw_control_event *e, struct usb_packet_control *pkt) {
     if (e->is_event(USB_TYPE_CLASS, SET_LINE_CODING)) {
-        const uint32_t baud = pkt->data[0]
-                            | pkt->data[1] <<  8
-                            | pkt->data[2] << 16
-                            | pkt->data[3] << 24;
-        const uint8_t stop   = pkt->data[4];
-        const uint8_t parity = pkt->data[5];
-        const uint8_t bits   = pkt->data[6];
-        printf("SET_LINE_CODING : baud=%d, bits=%d, parity=%d, stop=%d\n", baud, bits, parity, stop);
+        // data is char, which is signed on x86
+        const auto coding = reinterpret_cast<const uint8_t *>(pkt->data);
+        const uint32_t baud = coding[0]
+                            | coding[1] <<  8
+                            | coding[2] << 16
+                            | static_cast<uint32_t>(coding[3]) << 24;
+        const uint8_t stop   = coding[4];
+        const uint8_t parity = coding[5];
+        const uint8_t bits   = coding[6];
+        printf("SET_LINE_CODING : baud=%u, bits=%d, parity=%d, stop=%d\n", baud, bits, parity, stop);
+        ctx.usb_tx_pacer.set_dte_rate(baud);
         return true;
     }
     if (e->is_event(USB_TYPE_CLASS, SET_CONTROL_LINE_STATE)) {
@@ -263,139 +286,108 @@ bool LucentModem::handle_control_request(usb_raw_control_event *e, struct usb_pa
     return false;
 }
 
-bool LucentModem::process_at_ext(std::string &line) {
-    std::string reply;
-    if (line == "AT#CLS=?" || line == "AT+GCI?" || line == "AT+GCI=?") {
-        reply += "\r\nERROR\r\n";
-        ctx.usb_tx_buffer.enqueue(reply.c_str(), reply.length());
-        ctx.usb_tx_buffer.notify_one();
-        return true;
-    }
-    if (line == "AT+GMM") {
-        reply = "\r\nH.324 video-ready rev. 1.0\r\n";
-    } else if (line == "AT+FCLASS=?") {
-        reply = "\r\n0,1,2";
-    } else if (line == "ATI" || line == "ATI0" || line == "ATI3") {
-        reply = "\r\nLT V.90 1.0 MT5634MU USB Data/Fax Modem Version 8.18j\r\n";
-    } else if (line == "ATI1") {
-        reply = "\r\nD092\r\n";
-    } else if (line == "ATI4") {
-        reply = "\r\n17\r\n";
-    } else if (line == "ATI5") {
-        reply = "\r\nU052099f,0,34\r\n";
-    } else if (line == "ATI7") {
-        reply = "\r\nGlobal2 Build\r\n";
-    } else if (line == "ATI9") {
-        reply = "\r\n52\r\n";
-    }
-    if (!reply.empty()) {
-        reply += "\r\nOK\r\n";
-        ctx.usb_tx_buffer.enqueue(reply.c_str(), reply.length());
-        ctx.usb_tx_buffer.notify_one();
-        return true;
-    }
-    return false;
+static const struct at_reply lucent_replies[] = {
+    {"#CLS=?",    nullptr},
+    {"+GCI?",     nullptr},
+    {"+GCI=?",    nullptr},
+    {"+GMM",      "\r\nH.324 video-ready rev. 1.0\r\n"},
+    {"+FCLASS=?", "\r\n0,1,2"},
+    {"I",         "\r\nLT V.90 1.0 MT5634MU USB Data/Fax Modem Version 8.18j\r\n"},
+    {"I0",        "\r\nLT V.90 1.0 MT5634MU USB Data/Fax Modem Version 8.18j\r\n"},
+    {"I1",        "\r\nD092\r\n"},
+    {"I3",        "\r\nLT V.90 1.0 MT5634MU USB Data/Fax Modem Version 8.18j\r\n"},
+    {"I4",        "\r\n17\r\n"},
+    {"I5",        "\r\nU052099f,0,34\r\n"},
+    {"I7",        "\r\nGlobal2 Build\r\n"},
+    {"I9",        "\r\n52\r\n"},
+    {nullptr,     nullptr},
+};
+
+const at_reply *LucentModem::at_replies() const {
+    return lucent_replies;
 }
 
 void *LucentModem::intr_in_thread(int ep_num) {
     struct usb_packet_control pkt;
-    auto timeout_at = std::chrono::steady_clock::now();
-
-    bool last_dcd = true;
+    event_channel events(ctx.usb_events, EVENT_LINE_STATUS);
 
     while (true) {
-        const auto now = std::chrono::steady_clock::now();
-        while (timeout_at <= now) {
-            timeout_at += std::chrono::milliseconds(40);
-        }
-        ctx.usb_tx_buffer.wait(timeout_at);
-
-        bool dcd = ctx.connected.load();
-        if (last_dcd == dcd)
+        if (!intr_in_poll(pkt, false)) {
+            events.wait();
             continue;
-        last_dcd = dcd;
-
-        pkt.data[0] = 0xa1; // bmRequestType
-        pkt.data[1] = 0x20; // bNotification
-        pkt.data[2] = 0x00; // wValue LSB
-        pkt.data[3] = 0x00; // wValue MSB
-        pkt.data[4] = 0x00; // wIndex LSB
-        pkt.data[5] = 0x00; // wIndex MSB
-        pkt.data[6] = 0x02; // wLength LSB
-        pkt.data[7] = 0x00; // wLength MSB
-
-        pkt.data[8] = 0x02; // DSR
-        if (dcd)
-            pkt.data[8] |= 0x01; // DCD
-        pkt.data[9] = 0x00;
+        }
 
         pkt.header.ep = ep_num;
         pkt.header.flags = 0;
-        pkt.header.length = 10;
 
         ctx.usb->ep_write(reinterpret_cast<struct usb_raw_ep_io *>(&pkt));
     }
     return nullptr;
 }
 
-void *LucentModem::bulk_out_thread(int ep_num) {
-    struct usb_packet_bulk pkt;
-    std::string buffer;
+// SERIAL_STATE notification when DCD changed.
+bool LucentModem::intr_in_poll(struct usb_packet_control &pkt, bool due) {
+    (void)due;
+    bool dcd = ctx.connected.load();
+    if (last_dcd == dcd) {
+        return false;
+    }
+    last_dcd = dcd;
 
-    while (true) {
-        pkt.header.ep = ep_num;
-        pkt.header.flags = 0;
-        pkt.header.length = sizeof(pkt.data);
+    pkt.data[0] = 0xa1; // bmRequestType
+    pkt.data[1] = 0x20; // bNotification
+    pkt.data[2] = 0x00; // wValue LSB
+    pkt.data[3] = 0x00; // wValue MSB
+    pkt.data[4] = 0x00; // wIndex LSB
+    pkt.data[5] = 0x00; // wIndex MSB
+    pkt.data[6] = 0x02; // wLength LSB
+    pkt.data[7] = 0x00; // wLength MSB
 
-        int length = ctx.usb->ep_read(reinterpret_cast<struct usb_raw_ep_io *>(&pkt));
-        buffer.append(&pkt.data[0], length);
+    pkt.data[8] = 0x02; // DSR
+    if (dcd)
+        pkt.data[8] |= 0x01; // DCD
+    pkt.data[9] = 0x00;
 
-        // Off-line mode loop
-        while (!ctx.connected.load()) {
-            while (!buffer.empty() && (buffer[0] == '\0')) {
-                buffer.erase(0, 1);
-            }
-            auto newline_pos = buffer.find('\x0d');
-            if (newline_pos == std::string::npos) { break; }
-            std::string line = buffer.substr(0, newline_pos);
-            buffer.erase(0, newline_pos + 1);
-            if (line.empty()) { continue; }
-            process_at(line);
-        }
+    pkt.header.length = 10;
+    return true;
+}
 
-        // On-line mode loop
-        while (ctx.connected.load() && buffer.length() > 0) {
-            if (ctx.pty->is_connected()) {
-                ctx.pty->send(buffer.c_str(), buffer.length());
-            } else if (ctx.sock != nullptr) {
-                ctx.sock->send(buffer.c_str(), buffer.length());
-            }
-            buffer.clear();
-        }
+// Raw payload; the NULs the host pads AT commands with are dropped by
+// at_line_buffer.
+struct LucentCodec {
+    static size_t decode(const char *data, int length, const char *&payload) {
+        payload = data;
+        return length;
     }
-    return nullptr;
+};
+
+void *LucentModem::bulk_out_thread(int ep_num) {
+    return endpoint_pump<LucentCodec>::run(this, ep_num);
 }
 
 void *LucentModem::bulk_in_thread(int ep_num) {
     struct usb_packet_control pkt;
-    auto timeout_at = std::chrono::steady_clock::now();
+    event_channel events(ctx.usb_events, EVENT_DATA);
 
     while (true) {
-        const auto now = std::chrono::steady_clock::now();
-        while (timeout_at <= now) {
-            timeout_at += std::chrono::milliseconds(40);
-        }
-        ctx.usb_tx_buffer.wait(timeout_at);
-
-        int payload_length = ctx.usb_tx_buffer.dequeue(&pkt.data[0], sizeof(pkt.data));
-        if (!payload_length)
+        if (!bulk_in_poll(pkt, false)) {
+            ctx.wait_for_host(events);
             continue;
+        }
 
         pkt.header.ep = ep_num;
         pkt.header.flags = 0;
-        pkt.header.length = payload_length;
 
         ctx.usb->ep_write(reinterpret_cast<struct usb_raw_ep_io *>(&pkt));
     }
     return nullptr;
 }
+
+bool LucentModem::bulk_in_poll(struct usb_packet_control &pkt, bool due) {
+    (void)due;
+    if (!ctx.has_data_for_host()) {
+        return false;
+    }
+    pkt.header.length = ctx.read_for_host(&pkt.data[0], sizeof(pkt.data));
+    return pkt.header.length > 0;
+}
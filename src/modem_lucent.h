@@ -1,5 +1,6 @@
 #pragma once
 
+#include "endpoint_scheduler.h"
 #include "modem.h"
 
 class LucentModem : public Modem {
@@ -10,14 +11,19 @@ public:
 
     bool handle_set_configuration(usb_raw_control_event *e, struct usb_packet_control *pkt) override;
     bool handle_control_request(usb_raw_control_event *e, struct usb_packet_control *pkt) override;
-    bool process_at_ext(std::string &line) override;
 
 protected:
+    const at_reply *at_replies() const override;
+
     void *intr_in_thread(int ep_num);
     void *bulk_out_thread(int ep_num);
     void *bulk_in_thread(int ep_num);
+    bool intr_in_poll(struct usb_packet_control &pkt, bool due);
+    bool bulk_in_poll(struct usb_packet_control &pkt, bool due);
 
     std::thread *thread_intr_in;
     std::thread *thread_bulk_out;
     std::thread *thread_bulk_in;
+    endpoint_scheduler *scheduler;
+    bool last_dcd = true;
 };
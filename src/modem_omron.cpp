@@ -1,7 +1,8 @@
 #include "modem_omron.h"
-#include "tcp_sock.h"
+#include "net_sock.h"
 #include "pty_dev.h"
 #include "app_context.h"
+#include "endpoint_pump.h"
 
 static const struct _usb_string_descriptor<1> str_lang = {
     .bLength = sizeof(str_lang),
@@ -139,18 +140,16 @@ bool OmronModem::handle_control_request(usb_raw_control_event *e, struct usb_pac
 
 void *OmronModem::bulk_in_thread(int ep_num) {
     struct usb_packet_control pkt;
-    auto timeout_at = std::chrono::steady_clock::now();
+    event_channel events(ctx.usb_events, EVENT_DATA | EVENT_LINE_STATUS);
 
     bool last_dcd = true;
 
     while (true) {
-        const auto now = std::chrono::steady_clock::now();
-        while (timeout_at <= now) {
-            timeout_at += std::chrono::milliseconds(40);
+        if (!ctx.has_data_for_host() && last_dcd == ctx.connected.load()) {
+            ctx.wait_for_host(events);
         }
-        ctx.usb_tx_buffer.wait(timeout_at);
 
-        int payload_length = ctx.usb_tx_buffer.dequeue(&pkt.data[2], MAX_PACKET_SIZE_BULK - 2);
+        int payload_length = ctx.read_for_host(&pkt.data[2], MAX_PACKET_SIZE_BULK - 2);
 
         bool dcd = ctx.connected.load();
         if (!payload_length && last_dcd == dcd)
@@ -171,42 +170,20 @@ void *OmronModem::bulk_in_thread(int ep_num) {
     return nullptr;
 }
 
-void *OmronModem::bulk_out_thread(int ep_num) {
-    struct usb_packet_bulk pkt;
-    std::string buffer;
-
-    while (true) {
-        pkt.header.ep = ep_num;
-        pkt.header.flags = 0;
-        pkt.header.length = sizeof(pkt.data);
-
-        int ret = ctx.usb->ep_read(reinterpret_cast<struct usb_raw_ep_io *>(&pkt));
-        int payload_length = pkt.data[0] >> 2;
-        if (payload_length != ret - 1) {
-            printf("Payload length mismatch! (payload length in header: %d, received payload: %d)\n", payload_length, ret - 1);
-            payload_length = std::min(payload_length, ret - 1);
-        }
-        buffer.append(&pkt.data[1], payload_length);
-
-        // Off-line mode loop
-        while (!ctx.connected.load()) {
-            auto newline_pos = buffer.find('\x0d');
-            if (newline_pos == std::string::npos) { break; }
-            std::string line = buffer.substr(0, newline_pos);
-            buffer.erase(0, newline_pos + 1);
-            if (line.empty()) { continue; }
-            process_at(line);
-        }
-
-        // On-line mode loop
-        while (ctx.connected.load() && buffer.length() > 0) {
-            if (ctx.pty->is_connected()) {
-                ctx.pty->send(buffer.c_str(), buffer.length());
-            } else if (ctx.sock != nullptr) {
-                ctx.sock->send(buffer.c_str(), buffer.length());
-            }
-            buffer.clear();
+// Each OUT packet starts with a header byte holding the payload length in
+// bits 7-2.
+struct OmronCodec {
+    static size_t decode(const char *data, int length, const char *&payload) {
+        int payload_length = static_cast<uint8_t>(data[0]) >> 2;
+        if (payload_length != length - 1) {
+            printf("Payload length mismatch! (payload length in header: %d, received payload: %d)\n", payload_length, length - 1);
+            payload_length = std::max(std::min(payload_length, length - 1), 0);
         }
+        payload = &data[1];
+        return payload_length;
     }
-    return nullptr;
+};
+
+void *OmronModem::bulk_out_thread(int ep_num) {
+    return endpoint_pump<OmronCodec>::run(this, ep_num);
 }
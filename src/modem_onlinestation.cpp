@@ -1,7 +1,10 @@
+#include <cstring>
+
 #include "modem_onlinestation.h"
-#include "tcp_sock.h"
+#include "net_sock.h"
 #include "pty_dev.h"
 #include "app_context.h"
+#include "endpoint_pump.h"
 
 static const struct _usb_string_descriptor<1> str_lang = {
     .bLength = sizeof(str_lang),
@@ -106,20 +109,39 @@ const struct usb_config_descriptors &OnlineStationModem::config_descriptors(cons
 const void * const *OnlineStationModem::string_descriptors() const { return str_descs; }
 
 bool OnlineStationModem::handle_set_configuration(usb_raw_control_event *e, struct usb_packet_control *pkt) {
-    if (thread_bulk_in == nullptr) {
+    const bool new_scheduler = ctx.endpoint_scheduler && scheduler == nullptr;
+    if (new_scheduler) {
+        // bulk IN and the status endpoint share a lane; the host driver polls both while the port is open
+        scheduler = new endpoint_scheduler(1);
+        scheduler->set_debug_level(ctx.debug_level);
+    }
+    if (new_scheduler || (!ctx.endpoint_scheduler && thread_bulk_in == nullptr)) {
         const int ep_num = ctx.usb->ep_enable(reinterpret_cast<struct usb_endpoint_descriptor *>(
                 const_cast<struct _usb_endpoint_descriptor *>(&config_descriptors(0).endpoints[0])));
-        thread_bulk_in = new std::thread(&OnlineStationModem::bulk_in_thread, this, ep_num);
+        if (ctx.endpoint_scheduler) {
+            scheduler->add(0, ep_num, EVENT_DATA, std::chrono::milliseconds(40),
+                [this](struct usb_packet_control &p, bool due) {return bulk_in_poll(p, due);});
+        } else {
+            thread_bulk_in = new std::thread(&OnlineStationModem::bulk_in_thread, this, ep_num);
+        }
     }
     if (thread_bulk_out == nullptr) {
         const int ep_num = ctx.usb->ep_enable(reinterpret_cast<struct usb_endpoint_descriptor *>(
                 const_cast<struct _usb_endpoint_descriptor *>(&config_descriptors(0).endpoints[1])));
         thread_bulk_out = new std::thread(&OnlineStationModem::bulk_out_thread, this, ep_num);
     }
-    if (thread_intr_in == nullptr) {
+    if (new_scheduler || (!ctx.endpoint_scheduler && thread_intr_in == nullptr)) {
         const int ep_num = ctx.usb->ep_enable(reinterpret_cast<struct usb_endpoint_descriptor *>(
                 const_cast<struct _usb_endpoint_descriptor *>(&config_descriptors(0).endpoints[2])));
-        thread_intr_in = new std::thread(&OnlineStationModem::intr_in_thread, this, ep_num);
+        if (ctx.endpoint_scheduler) {
+            scheduler->add(0, ep_num, EVENT_DATA | EVENT_LINE_STATUS, std::chrono::milliseconds(40),
+                [this](struct usb_packet_control &p, bool due) {return intr_in_poll(p, due);});
+        } else {
+            thread_intr_in = new std::thread(&OnlineStationModem::intr_in_thread, this, ep_num);
+        }
+    }
+    if (new_scheduler) {
+        scheduler->start();
     }
     return Modem::handle_set_configuration(e, pkt);
 }
@@ -127,7 +149,12 @@ bool OnlineStationModem::handle_set_configuration(usb_raw_control_event *e, stru
 bool OnlineStationModem::handle_control_request(usb_raw_control_event *e, struct usb_packet_control *pkt) {
     if (e->is_event(USB_TYPE_VENDOR, 0x10)) { // set baud rate
         constexpr uint32_t rates[] = {110, 300, 600, 1200, 2400, 4800, 9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600};
+        if (e->ctrl.wValue >= sizeof(rates) / sizeof(rates[0])) {
+            printf("os : vendor : set baud rate = 0x%02x (unknown)\n", e->ctrl.wValue);
+            return true;
+        }
         printf("os : vendor : set baud rate = 0x%02x (%d)\n", e->ctrl.wValue, rates[e->ctrl.wValue]);
+        ctx.usb_tx_pacer.set_dte_rate(rates[e->ctrl.wValue]);
         return true;
     }
     if (e->is_event(USB_TYPE_VENDOR, 0x11)) { // set line state
@@ -174,78 +201,96 @@ bool OnlineStationModem::handle_control_request(usb_raw_control_event *e, struct
     return false;
 }
 
-bool OnlineStationModem::process_at_ext(std::string &line) {
-    std::string reply;
-    if (line == "ATI" || line == "ATI0") {
-        reply = "\r\nPCTel/SUN T2M V.90\r\n";
-    } else if (line == "ATI1") {
-        reply = "\r\nCHECKSUM F352\r\n";
-    } else if (line == "ATI3") {
-        reply = "\r\nREV 1.100.06-003-00D   February 16, 2001\r\n";
-    } else if (line == "ATI4") {
-        reply = "\r\nCE DRIVER REV   4.2.12   04/01/2000\r\n";
-    } else if (line == "ATI5") {
-        reply = "\r\nCOUNTRY CODE   8181\r\n";
-    } else if (line == "ATI6") {
-        reply = "\r\nRX Level  -47.9 dB"
-                "\r\nTX Level    -14 dB"
-                "\r\nSNR       -00.3 dB\r\n";
-    } else if (line == "ATI7") {
-        reply = "\r\nVF1 = PCT303D REV C    VF2 = PCT303W REV C    INTERNATIONAL\r\n";
-    } else if (line == "ATI8") {
-        reply = "\r\nV.90  ti 5402  @ 096 Mhz\r\n";
-    } else if (line == "ATI9") {
-        reply = "\r\nSolsis 1\r\n";
-    }
-    if (!reply.empty()) {
-        reply += "\r\nOK\r\n";
-        ctx.usb_tx_buffer.enqueue(reply.c_str(), reply.length());
-        ctx.usb_tx_buffer.notify_one();
-        return true;
-    }
-    return false;
+static const struct at_reply onlinestation_replies[] = {
+    {"I",     "\r\nPCTel/SUN T2M V.90\r\n"},
+    {"I0",    "\r\nPCTel/SUN T2M V.90\r\n"},
+    {"I1",    "\r\nCHECKSUM F352\r\n"},
+    {"I3",    "\r\nREV 1.100.06-003-00D   February 16, 2001\r\n"},
+    {"I4",    "\r\nCE DRIVER REV   4.2.12   04/01/2000\r\n"},
+    {"I5",    "\r\nCOUNTRY CODE   8181\r\n"},
+    {"I6",    "\r\nRX Level  -47.9 dB"
+              "\r\nTX Level    -14 dB"
+              "\r\nSNR       -00.3 dB\r\n"},
+    {"I7",    "\r\nVF1 = PCT303D REV C    VF2 = PCT303W REV C    INTERNATIONAL\r\n"},
+    {"I8",    "\r\nV.90  ti 5402  @ 096 Mhz\r\n"},
+    {"I9",    "\r\nSolsis 1\r\n"},
+    {nullptr, nullptr},
+};
+
+const at_reply *OnlineStationModem::at_replies() const {
+    return onlinestation_replies;
 }
 
 void *OnlineStationModem::intr_in_thread(int ep_num) {
     struct usb_packet_control pkt;
     auto timeout_at = std::chrono::steady_clock::now();
+    event_channel events(ctx.usb_events, EVENT_DATA | EVENT_LINE_STATUS);
 
     while (true) {
         const auto now = std::chrono::steady_clock::now();
         while (timeout_at <= now) {
             timeout_at += std::chrono::milliseconds(40);
         }
-        ctx.usb_tx_buffer.wait(timeout_at);
-
-        pkt.data[0] = 0x04;
-        if (!ctx.usb_tx_buffer.is_empty())
-            pkt.data[0] |= 0x01;
-
-        pkt.data[1] = 0x03; // CTS/DTR
-        if (ctx.connected.load())
-            pkt.data[1] |= 0x08; // DCD
+        if (!ctx.has_data_for_host()) {
+            events.wait_until(timeout_at);
+        }
 
+        fill_intr_status(pkt);
         pkt.header.ep = ep_num;
         pkt.header.flags = 0;
-        pkt.header.length = 2;
 
         ctx.usb->ep_write(reinterpret_cast<struct usb_raw_ep_io *>(&pkt));
     }
     return nullptr;
 }
 
+void OnlineStationModem::fill_intr_status(struct usb_packet_control &pkt) {
+    pkt.data[0] = 0x04;
+    if (ctx.has_data_for_host())
+        pkt.data[0] |= 0x01;
+
+    pkt.data[1] = 0x03; // CTS/DTR
+    if (ctx.connected.load())
+        pkt.data[1] |= 0x08; // DCD
+
+    pkt.header.length = 2;
+}
+
+// Scheduler counterparts of the threads above. The status goes out every
+// 40 ms and when it changes, rather than back to back while data is queued.
+bool OnlineStationModem::intr_in_poll(struct usb_packet_control &pkt, bool due) {
+    fill_intr_status(pkt);
+    if (!due && memcmp(pkt.data, last_intr_status, sizeof(last_intr_status)) == 0) {
+        return false;
+    }
+    memcpy(last_intr_status, pkt.data, sizeof(last_intr_status));
+    return true;
+}
+
+// Data as soon as there is some, a zero-length packet every 40 ms otherwise.
+bool OnlineStationModem::bulk_in_poll(struct usb_packet_control &pkt, bool due) {
+    if (!due && !ctx.has_data_for_host()) {
+        return false;
+    }
+    pkt.header.length = ctx.read_for_host(&pkt.data[0], sizeof(pkt.data));
+    return due || pkt.header.length > 0;
+}
+
 void *OnlineStationModem::bulk_in_thread(int ep_num) {
     struct usb_packet_control pkt;
     auto timeout_at = std::chrono::steady_clock::now();
+    event_channel events(ctx.usb_events, EVENT_DATA);
 
     while (true) {
         const auto now = std::chrono::steady_clock::now();
         while (timeout_at <= now) {
             timeout_at += std::chrono::milliseconds(40);
         }
-        ctx.usb_tx_buffer.wait(timeout_at);
+        if (!ctx.has_data_for_host()) {
+            ctx.wait_for_host(events, timeout_at);
+        }
 
-        int payload_length = ctx.usb_tx_buffer.dequeue(&pkt.data[0], sizeof(pkt.data));
+        int payload_length = ctx.read_for_host(&pkt.data[0], sizeof(pkt.data));
 
         pkt.header.ep = ep_num;
         pkt.header.flags = 0;
@@ -256,37 +301,14 @@ void *OnlineStationModem::bulk_in_thread(int ep_num) {
     return nullptr;
 }
 
-void *OnlineStationModem::bulk_out_thread(int ep_num) {
-    struct usb_packet_bulk pkt;
-    std::string buffer;
-
-    while (true) {
-        pkt.header.ep = ep_num;
-        pkt.header.flags = 0;
-        pkt.header.length = sizeof(pkt.data);
-
-        int length = ctx.usb->ep_read(reinterpret_cast<struct usb_raw_ep_io *>(&pkt));
-        buffer.append(&pkt.data[0], length);
-
-        // Off-line mode loop
-        while (!ctx.connected.load()) {
-            auto newline_pos = buffer.find('\x0d');
-            if (newline_pos == std::string::npos) { break; }
-            std::string line = buffer.substr(0, newline_pos);
-            buffer.erase(0, newline_pos + 1);
-            if (line.empty()) { continue; }
-            process_at(line);
-        }
-
-        // On-line mode loop
-        while (ctx.connected.load() && buffer.length() > 0) {
-            if (ctx.pty->is_connected()) {
-                ctx.pty->send(buffer.c_str(), buffer.length());
-            } else if (ctx.sock != nullptr) {
-                ctx.sock->send(buffer.c_str(), buffer.length());
-            }
-            buffer.clear();
-        }
+// Raw payload without framing.
+struct OnlineStationCodec {
+    static size_t decode(const char *data, int length, const char *&payload) {
+        payload = data;
+        return length;
     }
-    return nullptr;
+};
+
+void *OnlineStationModem::bulk_out_thread(int ep_num) {
+    return endpoint_pump<OnlineStationCodec>::run(this, ep_num);
 }
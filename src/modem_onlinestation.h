@@ -1,5 +1,6 @@
 #pragma once
 
+#include "endpoint_scheduler.h"
 #include "modem.h"
 
 class OnlineStationModem : public Modem {
@@ -10,14 +11,20 @@ public:
 
     bool handle_set_configuration(usb_raw_control_event *e, struct usb_packet_control *pkt) override;
     bool handle_control_request(usb_raw_control_event *e, struct usb_packet_control *pkt) override;
-    bool process_at_ext(std::string &line) override;
 
 protected:
+    const at_reply *at_replies() const override;
+
     void *bulk_in_thread(int ep_num);
     void *bulk_out_thread(int ep_num);
     void *intr_in_thread(int ep_num);
+    void fill_intr_status(struct usb_packet_control &pkt);
+    bool bulk_in_poll(struct usb_packet_control &pkt, bool due);
+    bool intr_in_poll(struct usb_packet_control &pkt, bool due);
 
     std::thread *thread_bulk_in;
     std::thread *thread_bulk_out;
     std::thread *thread_intr_in;
+    endpoint_scheduler *scheduler;
+    uint8_t last_intr_status[2];
 };
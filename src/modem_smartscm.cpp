@@ -1,7 +1,8 @@
 #include "modem_smartscm.h"
-#include "tcp_sock.h"
+#include "net_sock.h"
 #include "pty_dev.h"
 #include "app_context.h"
+#include "endpoint_pump.h"
 
 static const struct _usb_string_descriptor<1> str_lang = {
     .bLength = sizeof(str_lang),
@@ -146,64 +147,82 @@ const struct usb_config_descriptors &SmartSCMModem::config_descriptors(const uin
 const void * const *SmartSCMModem::string_descriptors() const { return str_descs; }
 
 bool SmartSCMModem::handle_set_configuration(usb_raw_control_event *e, struct usb_packet_control *pkt) {
+    const bool new_scheduler = ctx.endpoint_scheduler && scheduler == nullptr;
+    const auto keepalive = [](struct usb_packet_control &p, bool due) {
+        p.header.length = 0;
+        return due;
+    };
+    if (new_scheduler) {
+        // data on lane 0, the ep1/ep4 keepalives on lane 1: a host that
+        // never reads those must not hold up the data
+        scheduler = new endpoint_scheduler(2);
+        scheduler->set_debug_level(ctx.debug_level);
+    }
     if (thread_control_out == nullptr) {
         const int ep_num = ctx.usb->ep_enable(reinterpret_cast<struct usb_endpoint_descriptor *>(
                 const_cast<struct _usb_endpoint_descriptor *>(&config_descriptors(0).endpoints[0])));
         thread_control_out = new std::thread(&SmartSCMModem::control_out_thread, this, ep_num);
     }
-    if (thread_control_in == nullptr) {
+    if (new_scheduler || (!ctx.endpoint_scheduler && thread_control_in == nullptr)) {
         const int ep_num = ctx.usb->ep_enable(reinterpret_cast<struct usb_endpoint_descriptor *>(
                 const_cast<struct _usb_endpoint_descriptor *>(&config_descriptors(0).endpoints[1])));
-        thread_control_in = new std::thread(&SmartSCMModem::control_in_thread, this, ep_num);
+        if (ctx.endpoint_scheduler) {
+            scheduler->add(1, ep_num, 0, std::chrono::milliseconds(5000), keepalive);
+        } else {
+            thread_control_in = new std::thread(&SmartSCMModem::control_in_thread, this, ep_num);
+        }
     }
     if (thread_data_out == nullptr) {
         const int ep_num = ctx.usb->ep_enable(reinterpret_cast<struct usb_endpoint_descriptor *>(
                 const_cast<struct _usb_endpoint_descriptor *>(&config_descriptors(0).endpoints[4])));
         thread_data_out = new std::thread(&SmartSCMModem::data_out_thread, this, ep_num);
     }
-    if (thread_data_in == nullptr) {
+    if (new_scheduler || (!ctx.endpoint_scheduler && thread_data_in == nullptr)) {
         const int ep_num = ctx.usb->ep_enable(reinterpret_cast<struct usb_endpoint_descriptor *>(
                 const_cast<struct _usb_endpoint_descriptor *>(&config_descriptors(0).endpoints[5])));
-        thread_data_in = new std::thread(&SmartSCMModem::data_in_thread, this, ep_num);
+        if (ctx.endpoint_scheduler) {
+            scheduler->add(0, ep_num, EVENT_DATA | EVENT_LINE_STATUS, std::chrono::milliseconds(0),
+                [this](struct usb_packet_control &p, bool due) {return data_in_poll(p, due);});
+        } else {
+            thread_data_in = new std::thread(&SmartSCMModem::data_in_thread, this, ep_num);
+        }
     }
     if (thread_gpio_out == nullptr) {
         const int ep_num = ctx.usb->ep_enable(reinterpret_cast<struct usb_endpoint_descriptor *>(
                 const_cast<struct _usb_endpoint_descriptor *>(&config_descriptors(0).endpoints[6])));
         thread_gpio_out = new std::thread(&SmartSCMModem::gpio_out_thread, this, ep_num);
     }
-    if (thread_gpio_in == nullptr) {
+    if (new_scheduler || (!ctx.endpoint_scheduler && thread_gpio_in == nullptr)) {
         const int ep_num = ctx.usb->ep_enable(reinterpret_cast<struct usb_endpoint_descriptor *>(
                 const_cast<struct _usb_endpoint_descriptor *>(&config_descriptors(0).endpoints[7])));
-        thread_gpio_in = new std::thread(&SmartSCMModem::gpio_in_thread, this, ep_num);
+        if (ctx.endpoint_scheduler) {
+            scheduler->add(1, ep_num, 0, std::chrono::milliseconds(5000), keepalive);
+        } else {
+            thread_gpio_in = new std::thread(&SmartSCMModem::gpio_in_thread, this, ep_num);
+        }
+    }
+    if (new_scheduler) {
+        scheduler->start();
     }
     return Modem::handle_set_configuration(e, pkt);
 }
 
-bool SmartSCMModem::process_at_ext(std::string &line) {
-    std::string reply;
-    if (line == "ATI" || line == "ATI0") {
-        reply = "\r\n56000\r\n";
-    } else if (line == "ATI1") {
-        reply = "\r\n042\r\n";
-    } else if (line == "ati3") {
-        reply = "\r\nP2109-V90\r\n";
-    } else if (line == "ATI4") {
-        reply = "\r\na007080284C6002F\r\n"
-                "\r\nbC60000000\r\n"
-                "\r\nr1005111151012004\r\n"
-                "\r\nr3000111170000000\r\n";
-    } else if (line == "ATI5") {
-        reply = "\r\nB5\r\n";
-    } else if (line == "ATI6") {
-        reply = "\r\nRCV56DPF-PLL L8773A Rev 14.00/34.00";
-    }
-    if (!reply.empty()) {
-        reply += "\r\nOK\r\n";
-        ctx.usb_tx_buffer.enqueue(reply.c_str(), reply.length());
-        ctx.usb_tx_buffer.notify_one();
-        return true;
-    }
-    return false;
+static const struct at_reply smartscm_replies[] = {
+    {"I",     "\r\n56000\r\n"},
+    {"I0",    "\r\n56000\r\n"},
+    {"I1",    "\r\n042\r\n"},
+    {"I3",    "\r\nP2109-V90\r\n"},
+    {"I4",    "\r\na007080284C6002F\r\n"
+              "\r\nbC60000000\r\n"
+              "\r\nr1005111151012004\r\n"
+              "\r\nr3000111170000000\r\n"},
+    {"I5",    "\r\nB5\r\n"},
+    {"I6",    "\r\nRCV56DPF-PLL L8773A Rev 14.00/34.00"},
+    {nullptr, nullptr},
+};
+
+const at_reply *SmartSCMModem::at_replies() const {
+    return smartscm_replies;
 }
 
 // ep1 out
@@ -250,85 +269,84 @@ void *SmartSCMModem::control_in_thread(int ep_num) {
     return nullptr;
 }
 
+// Raw payload without framing; line status only travels on the IN side.
+struct SmartSCMCodec {
+    static size_t decode(const char *data, int length, const char *&payload) {
+        payload = data;
+        return length;
+    }
+};
+
 // ep3 out
 void *SmartSCMModem::data_out_thread(int ep_num) {
-    struct usb_packet_bulk pkt;
-    std::string buffer;
-
-    while (true) {
-        pkt.header.ep = ep_num;
-        pkt.header.flags = 0;
-        pkt.header.length = sizeof(pkt.data);
-
-        int length = ctx.usb->ep_read(reinterpret_cast<struct usb_raw_ep_io *>(&pkt));
-        buffer.append(&pkt.data[0], length);
-
-        // Off-line mode loop
-        while (!ctx.connected.load()) {
-            auto newline_pos = buffer.find('\x0d');
-            if (newline_pos == std::string::npos) { break; }
-            std::string line = buffer.substr(0, newline_pos);
-            buffer.erase(0, newline_pos + 1);
-            if (line.empty()) { continue; }
-            process_at(line);
-        }
-
-        // On-line mode loop
-        while (ctx.connected.load() && buffer.length() > 0) {
-            if (ctx.pty->is_connected()) {
-                ctx.pty->send(buffer.c_str(), buffer.length());
-            } else if (ctx.sock != nullptr) {
-                ctx.sock->send(buffer.c_str(), buffer.length());
-            }
-            buffer.clear();
-        }
-    }
-    return nullptr;
+    return endpoint_pump<SmartSCMCodec>::run(this, ep_num);
 }
 
 // ep3 in
 void *SmartSCMModem::data_in_thread(int ep_num) {
     struct usb_packet_control pkt;
-    auto timeout_at = std::chrono::steady_clock::now();
-
-    bool last_dcd = true;
+    event_channel events(ctx.usb_events, EVENT_DATA | EVENT_LINE_STATUS);
 
     while (true) {
-        const auto now = std::chrono::steady_clock::now();
-        while (timeout_at <= now) {
-            timeout_at += std::chrono::milliseconds(40);
-        }
-        ctx.usb_tx_buffer.wait(timeout_at);
-
-        char data[15] = {0};
-        int payload_length = ctx.usb_tx_buffer.dequeue(data, sizeof(data));
-
-        bool dcd = ctx.connected.load();
-        if (!payload_length && last_dcd == dcd)
+        if (!data_in_poll(pkt, false)) {
+            ctx.wait_for_host(events);
             continue;
-        last_dcd = dcd;
-
-        pkt.data[0] = 0x30; // MSR
-        if (dcd)
-            pkt.data[0] |= 0x80; // DCD
-
-        for (int i = 0; i < payload_length; ++i) {
-             pkt.data[1 + 2*i]     = 0x61; // LSR
-             pkt.data[1 + 2*i + 1] = data[i];
         }
-        bool is_empty = ctx.usb_tx_buffer.is_empty();
-        if (is_empty)
-            pkt.data[1 + 2*payload_length] = 0x60; // LSR
 
         pkt.header.ep = ep_num;
         pkt.header.flags = 0;
-        pkt.header.length = 1 + 2 * payload_length + (is_empty ? 1 : 0);
 
         ctx.usb->ep_write(reinterpret_cast<struct usb_raw_ep_io *>(&pkt));
     }
     return nullptr;
 }
 
+bool SmartSCMModem::data_in_poll(struct usb_packet_control &pkt, bool due) {
+    (void)due;
+    if (!ctx.has_data_for_host() && last_dcd == ctx.connected.load()) {
+        return false;
+    }
+
+    // interleave LSR bytes straight from the ring buffer, 15 bytes per packet;
+    // modem output goes before received payload
+    if (ctx.usb_ctrl_buffer.is_empty()) {
+        ctx.usb_tx_codel.control();
+    }
+    auto &source = ctx.usb_ctrl_buffer.is_empty() ? ctx.usb_tx_buffer : ctx.usb_ctrl_buffer;
+    size_t span_length;
+    const char *data = source.peek(&span_length);
+    int payload_length = std::min<size_t>(span_length, 15);
+    if (&source == &ctx.usb_tx_buffer) {
+        payload_length = ctx.usb_tx_pacer.limit(payload_length);
+    }
+
+    bool dcd = ctx.connected.load();
+    if (!payload_length && last_dcd == dcd) {
+        source.consume(0);
+        return false;
+    }
+    last_dcd = dcd;
+
+    pkt.data[0] = 0x30; // MSR
+    if (dcd)
+        pkt.data[0] |= 0x80; // DCD
+
+    for (int i = 0; i < payload_length; ++i) {
+         pkt.data[1 + 2*i]     = 0x61; // LSR
+         pkt.data[1 + 2*i + 1] = data[i];
+    }
+    source.consume(payload_length);
+    if (&source == &ctx.usb_tx_buffer) {
+        ctx.usb_tx_pacer.consume(payload_length);
+    }
+    bool is_empty = !ctx.has_data_for_host();
+    if (is_empty)
+        pkt.data[1 + 2*payload_length] = 0x60; // LSR
+
+    pkt.header.length = 1 + 2 * payload_length + (is_empty ? 1 : 0);
+    return true;
+}
+
 // ep4 out
 void *SmartSCMModem::gpio_out_thread(int ep_num) {
     struct usb_packet_bulk pkt;
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "endpoint_scheduler.h"
 #include "modem.h"
 
 class SmartSCMModem : public Modem {
@@ -10,15 +11,16 @@ public:
 
     bool handle_set_configuration(usb_raw_control_event *e, struct usb_packet_control *pkt) override;
 
-    bool process_at_ext(std::string &line) override;
-
 protected:
+    const at_reply *at_replies() const override;
+
     void *control_out_thread(int ep_num);
     void *control_in_thread(int ep_num); // empty
     void *data_out_thread(int ep_num);
     void *data_in_thread(int ep_num);
     void *gpio_out_thread(int ep_num);
     void *gpio_in_thread(int ep_num); // empty
+    bool data_in_poll(struct usb_packet_control &pkt, bool due);
 
     std::thread *thread_control_out;
     std::thread *thread_control_in;
@@ -26,4 +28,6 @@ protected:
     std::thread *thread_data_in;
     std::thread *thread_gpio_out;
     std::thread *thread_gpio_in;
+    endpoint_scheduler *scheduler;
+    bool last_dcd = true;
 };
@@ -0,0 +1,152 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sys/epoll.h>
+
+#include "net_sock.h"
+
+constexpr auto NET_SOCK_TX_QUEUE_SIZE = 65536U;
+
+net_sock::net_sock(const char *name, io_reactor *reactor, const char *ip_addr, uint16_t port)
+    : tx(name, reactor, NET_SOCK_TX_QUEUE_SIZE, [this]{flush_tx();}), flow(name, reactor)
+{
+    net_sock::name = name;
+    net_sock::reactor = reactor;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr(ip_addr);
+}
+
+// Copies already received data into recv_buffer, for transports that cannot
+// receive straight into its span. All or nothing: returns false, taking none
+// of it, if it does not fit below the high watermark (into the free space
+// without flow control); true once it is in, or discarded by recv_callback.
+bool net_sock::deliver(const char *data, size_t length)
+{
+    if (length == 0) {
+        return true;
+    }
+    char *spans[2];
+    size_t lengths[2];
+    const auto free_count = recv_buffer->reserve(spans, lengths);
+    if (length > std::min(free_count, flow.room(*recv_buffer))) {
+        recv_buffer->commit(0);
+        return false;
+    }
+    const auto first = std::min(length, lengths[0]);
+    memcpy(spans[0], data, first);
+    memcpy(spans[1], &data[first], length - first);
+
+    const auto accepted = (*recv_callback)(data, length);
+    recv_buffer->commit(accepted ? length : 0);
+    if (accepted) {recv_buffer->notify();}
+    return true;
+}
+
+// Arms the dial timeout. Whoever takes the callback first (the transport on
+// completion, the timer, or cancel_connect) finishes the dial.
+void net_sock::begin_dial(const std::chrono::milliseconds &timeout, dial_callback_t done)
+{
+    std::lock_guard<std::mutex> lock(dial_mtx);
+    dial_callback = std::move(done);
+    dial_timer = reactor->add_timer(timeout, [this]{
+        auto done = take_dial_callback();
+        if (!done) {
+            return;
+        }
+        printf("%s: connect(): timed out.\n", name);
+        abort_dial();
+        done(ETIMEDOUT);
+    });
+}
+
+net_sock::dial_callback_t net_sock::take_dial_callback(void)
+{
+    dial_callback_t done;
+    io_reactor::timer_id_t timer;
+    {
+        std::lock_guard<std::mutex> lock(dial_mtx);
+        done = std::move(dial_callback);
+        dial_callback = nullptr;
+        timer = dial_timer;
+        dial_timer = 0;
+    }
+    if (done && timer != 0) {
+        reactor->cancel_timer(timer);
+    }
+    return done;
+}
+
+// Gives up a dial in progress without calling its callback.
+void net_sock::cancel_connect(void)
+{
+    if (take_dial_callback()) {
+        abort_dial();
+    }
+}
+
+// Called by the bulk OUT endpoint threads; blocks while the send queue is full.
+void net_sock::send(const char *buffer, size_t length)
+{
+    if (!is_connected()) {
+        printf("%s: socket closed.\n", name);
+        return;
+    }
+    tx.push(buffer, length);
+}
+
+void net_sock::set_debug_level(const int level)
+{
+    debug_level = level;
+    flow.set_debug_level(level);
+}
+
+void net_sock::set_ring_callback(void (*func)(void))
+{
+    ring_callback = func;
+}
+
+void net_sock::set_hangup_callback(void (*func)(void))
+{
+    hangup_callback = func;
+}
+
+void net_sock::set_peer_timeout(const std::chrono::milliseconds &timeout)
+{
+    peer_timeout = timeout;
+}
+
+void net_sock::set_recv_buffer(ring_buffer<char> *buffer)
+{
+    recv_buffer = buffer;
+}
+
+void net_sock::set_flow_control(size_t high, size_t low)
+{
+    flow.set_watermarks(high, low);
+}
+
+void net_sock::set_recv_callback(bool (*func)(const char *, size_t))
+{
+    recv_callback = func;
+}
+
+void net_sock::set_addr(const struct sockaddr_in *addr_in)
+{
+    memcpy(&addr, addr_in, sizeof(addr));
+}
+
+// Returns false if the transport cannot join a relay session.
+bool net_sock::set_session_code(const std::string &code)
+{
+    session_code = code;
+    return true;
+}
+
+void net_sock::set_coalescing_window(const std::chrono::microseconds &window)
+{
+    tx.set_window(window);
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "flow_control.h"
+#include "io_reactor.h"
+#include "ring_buffer.h"
+#include "tx_queue.h"
+
+// Common part of the network transports (tcp_sock, udp_sock). Received data
+// goes into recv_buffer; data to send is queued in tx and written by the
+// transport's flush_tx() on the reactor thread. The modems only use the
+// interface below.
+class net_sock {
+    public:
+        // 0 on success, otherwise an errno value (ETIMEDOUT when the dial timed out)
+        using dial_callback_t = std::function<void(int)>;
+    private:
+        std::mutex dial_mtx;
+        dial_callback_t dial_callback; // set while a connect is in progress
+        io_reactor::timer_id_t dial_timer = 0;
+    protected:
+        const char *name;
+        int debug_level = 0;
+        struct sockaddr_in addr;
+        std::string session_code; // sent to a relay server after connecting
+        io_reactor *reactor;
+        void (*ring_callback)(void) = nullptr;
+        void (*hangup_callback)(void) = nullptr; // the peer went away
+        std::chrono::milliseconds peer_timeout{0}; // 0: rely on the kernel defaults
+        tx_queue tx;
+        ring_buffer<char> *recv_buffer = nullptr;
+        recv_flow_control flow;
+        bool (*recv_callback)(const char *, size_t) = nullptr;
+        net_sock(const char *name, io_reactor *reactor, const char *ip_addr, uint16_t port);
+        bool deliver(const char *data, size_t length);
+        void begin_dial(const std::chrono::milliseconds &timeout, dial_callback_t done);
+        dial_callback_t take_dial_callback(void);
+        virtual void abort_dial(void) = 0;
+        virtual void flush_tx(void) = 0;
+    public:
+        virtual ~net_sock() {}
+        void set_debug_level(const int level);
+        void set_ring_callback(void (*func)(void));
+        void set_hangup_callback(void (*func)(void));
+        void set_peer_timeout(const std::chrono::milliseconds &timeout);
+        void set_recv_buffer(ring_buffer<char> *buffer);
+        void set_flow_control(size_t high, size_t low);
+        void set_recv_callback(bool (*func)(const char *, size_t));
+        void set_addr(const struct sockaddr_in *addr_in);
+        virtual bool set_session_code(const std::string &code);
+        void set_coalescing_window(const std::chrono::microseconds &window);
+        virtual bool is_connected() = 0;
+        virtual void connect(const std::chrono::milliseconds &timeout, dial_callback_t done) = 0;
+        void cancel_connect(void);
+        virtual void disconnect() = 0;
+        void send(const char *buffer, size_t length);
+};
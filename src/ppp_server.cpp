@@ -0,0 +1,739 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+
+#include "ppp_server.h"
+
+constexpr auto PPP_TX_QUEUE_SIZE = 65536U;
+constexpr auto PPP_START_DELAY = std::chrono::milliseconds(100); // let CONNECT reach the host first
+constexpr auto PPP_RESTART_INTERVAL = std::chrono::seconds(3);
+constexpr auto PPP_HANGUP_DELAY = std::chrono::milliseconds(100);
+constexpr int PPP_MAX_CONFIGURE = 10;
+constexpr int PPP_TUN_BURST = 16; // packets read from the TUN per wakeup
+
+constexpr const char *PPP_LOCAL_ADDR = "10.0.0.1";
+constexpr const char *PPP_PEER_ADDR = "10.0.0.2";
+constexpr const char *PPP_DNS_ADDR = "10.0.0.1";
+
+enum : uint16_t {
+    PPP_IP   = 0x0021,
+    PPP_IPCP = 0x8021,
+    PPP_LCP  = 0xc021,
+    PPP_PAP  = 0xc023,
+    PPP_CHAP = 0xc223,
+};
+
+enum : uint8_t {
+    CONF_REQ = 1,
+    CONF_ACK,
+    CONF_NAK,
+    CONF_REJ,
+    TERM_REQ,
+    TERM_ACK,
+    CODE_REJ,
+    PROTO_REJ,
+    ECHO_REQ,
+    ECHO_REPLY,
+    DISCARD_REQ,
+};
+
+enum : uint8_t {
+    LCP_MRU   = 1,
+    LCP_ACCM  = 2,
+    LCP_AUTH  = 3,
+    LCP_MAGIC = 5,
+    LCP_PFC   = 7,
+    LCP_ACFC  = 8,
+};
+
+enum : uint8_t {
+    IPCP_ADDR = 3,
+    IPCP_DNS1 = 129,
+    IPCP_DNS2 = 131,
+};
+
+enum : uint8_t {
+    PAP_REQ = 1,
+    PAP_ACK = 2,
+    CHAP_CHALLENGE = 1,
+    CHAP_RESPONSE = 2,
+    CHAP_SUCCESS = 3,
+    CHAP_MD5 = 5,
+};
+
+enum {OPTION_ACK, OPTION_NAK, OPTION_REJ};
+
+static inline uint16_t get_u16(const uint8_t *p)
+{
+    return p[0] << 8 | p[1];
+}
+
+static inline void put_u16(uint8_t *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v & 0xff;
+}
+
+static inline uint32_t get_u32(const uint8_t *p)
+{
+    return (uint32_t) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static inline void put_u32(uint8_t *p, uint32_t v)
+{
+    put_u16(&p[0], v >> 16);
+    put_u16(&p[2], v & 0xffff);
+}
+
+ppp_server::ppp_server(io_reactor *reactor, const char *tun_name)
+    : tun(tun_name), reactor(reactor), flow("ppp_server", reactor), tx("ppp_server", reactor, PPP_TX_QUEUE_SIZE, [this]{flush_tx();})
+{
+    local_addr = inet_addr(PPP_LOCAL_ADDR);
+    peer_addr = inet_addr(PPP_PEER_ADDR);
+    dns_addr = inet_addr(PPP_DNS_ADDR);
+    lcp = {PPP_LCP, "LCP", false, false, false, 0, 0};
+    ipcp = {PPP_IPCP, "IPCP", false, false, false, 0, 0};
+}
+
+ppp_server::~ppp_server()
+{
+    disconnect();
+}
+
+void ppp_server::set_debug_level(const int level)
+{
+    debug_level = level;
+    tun.set_debug_level(level);
+    flow.set_debug_level(level);
+}
+
+void ppp_server::set_recv_buffer(ring_buffer<char> *buffer)
+{
+    recv_buffer = buffer;
+}
+
+void ppp_server::set_flow_control(size_t high, size_t low)
+{
+    flow.set_watermarks(high, low);
+}
+
+void ppp_server::set_recv_callback(bool (*func)(const char *, size_t))
+{
+    recv_callback = func;
+}
+
+void ppp_server::set_hangup_callback(void (*func)(void))
+{
+    hangup_callback = func;
+}
+
+void ppp_server::set_coalescing_window(const std::chrono::microseconds &window)
+{
+    tx.set_window(window);
+}
+
+bool ppp_server::is_connected()
+{
+    return tun_fd.load() >= 0;
+}
+
+// Called by the bulk OUT endpoint thread for ATD100/168. The link state is
+// reset before the TUN fd is published, after which only the reactor thread
+// touches it.
+bool ppp_server::connect()
+{
+    if (is_connected()) {
+        return true;
+    }
+    if (!tun.open(local_addr, peer_addr, PPP_MRU)) {
+        return false;
+    }
+    tx.discard();
+    reset();
+
+    const auto fd = tun.get_fd();
+    tun_fd.store(fd);
+    reactor->add(fd, EPOLLIN, [this, fd](uint32_t events){tun_handler(fd, events);});
+    restart_timer.store(reactor->add_timer(PPP_START_DELAY, [this]{start();}));
+    printf("ppp_server: %s up, waiting for LCP.\n", tun.get_name().c_str());
+    return true;
+}
+
+void ppp_server::disconnect()
+{
+    // the reactor thread calls this too when the peer terminates the link
+    const auto fd = tun_fd.exchange(-1);
+    if (fd < 0) {
+        return;
+    }
+    reactor->cancel_timer(restart_timer.exchange(0));
+    // returns once a running tun_handler has finished, so closing is safe
+    reactor->remove(fd);
+    tun.close();
+    printf("ppp_server: link down.\n");
+}
+
+// Called by the bulk OUT endpoint threads; blocks while the send queue is full.
+void ppp_server::send(const char *buffer, size_t length)
+{
+    if (!is_connected()) {
+        printf("ppp_server: not connected.\n");
+        return;
+    }
+    tx.push(buffer, length);
+}
+
+void ppp_server::reset(void)
+{
+    phase = link_phase::establish;
+    lcp = {PPP_LCP, "LCP", false, false, false, 0, 0};
+    ipcp = {PPP_IPCP, "IPCP", false, false, false, 0, 0};
+    auth_protocol = PPP_PAP;
+    request_accm = true;
+    request_magic = true;
+    request_addr = true;
+    peer_accm = 0xffffffff;
+    encoder.set_accm(peer_accm);
+    decoder.reset();
+
+    std::random_device rd;
+    magic = rd();
+    for (auto &c : chap_challenge) {c = rd();}
+}
+
+void ppp_server::start(void)
+{
+    if (!is_connected()) {
+        return;
+    }
+    if (!lcp.request_sent) {
+        send_config_request(lcp);
+    }
+    restart_timer.store(reactor->add_timer(PPP_RESTART_INTERVAL, [this]{restart();}));
+}
+
+// Restart timer: repeats whatever request the peer has not answered yet.
+void ppp_server::restart(void)
+{
+    if (!is_connected()) {
+        return;
+    }
+    control_protocol *pending = nullptr;
+    if (phase == link_phase::establish && !lcp.ack_received) {
+        pending = &lcp;
+    } else if (phase == link_phase::network && !ipcp.ack_received) {
+        pending = &ipcp;
+    }
+    if (pending != nullptr) {
+        if (pending->retries >= PPP_MAX_CONFIGURE) {
+            hang_up("no answer to Configure-Request");
+            return;
+        }
+        send_config_request(*pending);
+    } else if (phase == link_phase::authenticate && auth_protocol == PPP_CHAP) {
+        send_chap_challenge();
+    }
+    restart_timer.store(reactor->add_timer(PPP_RESTART_INTERVAL, [this]{restart();}));
+}
+
+void ppp_server::hang_up(const char *reason)
+{
+    printf("ppp_server: %s, hanging up.\n", reason);
+    disconnect();
+    if (hangup_callback != nullptr) {(*hangup_callback)();}
+}
+
+// Feeds the data queued by send() to the HDLC deframer on the reactor thread.
+void ppp_server::flush_tx(void)
+{
+    if (!is_connected()) {
+        tx.discard();
+        return;
+    }
+    struct iovec iov[2];
+    int iov_count;
+    while ((iov_count = tx.peek(iov)) > 0) {
+        size_t length = 0;
+        for (int i = 0; i < iov_count; i++) {
+            input(static_cast<const uint8_t *>(iov[i].iov_base), iov[i].iov_len);
+            length += iov[i].iov_len;
+        }
+        tx.consume(length);
+    }
+}
+
+void ppp_server::tun_handler(int fd, uint32_t events)
+{
+    switch (flow.check(fd, events, *recv_buffer)) {
+        case recv_flow_control::action::paused:
+            // the TUN queue drops meanwhile
+            return;
+        case recv_flow_control::action::hang_up:
+            hang_up("TUN device closed");
+            return;
+        case recv_flow_control::action::read:
+            break;
+    }
+
+    uint8_t packet[PPP_MRU];
+    for (int i = 0; i < PPP_TUN_BURST; i++) {
+        const auto len = read(fd, packet, sizeof(packet));
+        if (len < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                printf("ppp_server: read(): %s\n", std::strerror(errno));
+            }
+            return;
+        }
+        if (!ipcp.is_opened()) {
+            continue;
+        }
+        if (debug_level >= 2) {printf("ppp_server: IP packet to the host, %ld bytes.\n", (long) len);}
+        send_frame(PPP_IP, packet, len);
+    }
+}
+
+void ppp_server::input(const uint8_t *data, size_t length)
+{
+    const auto bad_frames = decoder.get_bad_frames();
+    decoder.input(data, length, [this](const uint8_t *frame, size_t frame_length) {
+        handle_frame(frame, frame_length);
+    });
+    if (debug_level >= 1 && decoder.get_bad_frames() != bad_frames) {
+        printf("ppp_server: dropped %ld frame(s) with a bad FCS.\n", (long) (decoder.get_bad_frames() - bad_frames));
+    }
+}
+
+void ppp_server::handle_frame(const uint8_t *data, size_t length)
+{
+    // address and control field may be compressed away (ACFC), so may the
+    // high byte of the protocol (PFC)
+    if (length >= 2 && data[0] == 0xff && data[1] == 0x03) {
+        data += 2;
+        length -= 2;
+    }
+    if (length < 1) {return;}
+    uint16_t protocol = data[0];
+    if (protocol & 1) {
+        data += 1;
+        length -= 1;
+    } else {
+        if (length < 2) {return;}
+        protocol = get_u16(data);
+        data += 2;
+        length -= 2;
+    }
+
+    if (protocol == PPP_IP) {
+        if (!ipcp.is_opened()) {return;}
+        if (write(tun_fd.load(), data, length) < 0 && debug_level >= 1) {
+            printf("ppp_server: write(): %s\n", std::strerror(errno));
+        }
+        return;
+    }
+
+    // control protocols: code, identifier, length
+    if (length < 4) {return;}
+    const auto code = data[0];
+    const auto id = data[1];
+    const auto packet_length = get_u16(&data[2]);
+    if (protocol == PPP_LCP || protocol == PPP_PAP || protocol == PPP_CHAP || protocol == PPP_IPCP) {
+        if (packet_length < 4 || packet_length > length) {return;}
+        if (debug_level >= 1) {printf("ppp_server: received protocol 0x%04x code %d id %d.\n", protocol, code, id);}
+    }
+    switch (protocol) {
+        case PPP_LCP:
+            handle_lcp(code, id, &data[4], packet_length - 4);
+            return;
+        case PPP_PAP:
+            if (phase != link_phase::dead && phase != link_phase::establish) {handle_pap(code, id, &data[4], packet_length - 4);}
+            return;
+        case PPP_CHAP:
+            if (phase != link_phase::dead && phase != link_phase::establish) {handle_chap(code, id, &data[4], packet_length - 4);}
+            return;
+        case PPP_IPCP:
+            if (phase == link_phase::network) {handle_ipcp(code, id, &data[4], packet_length - 4);}
+            return;
+    }
+
+    // IPv6CP, CCP and the like
+    if (lcp.is_opened()) {
+        uint8_t reject[2 + PPP_MRU];
+        put_u16(reject, protocol);
+        const auto info_length = std::min(length, sizeof(reject) - 2 - 4);
+        memcpy(&reject[2], data, info_length);
+        if (debug_level >= 1) {printf("ppp_server: rejecting protocol 0x%04x.\n", protocol);}
+        send_control(PPP_LCP, PROTO_REJ, ++lcp.request_id, reject, 2 + info_length);
+    }
+}
+
+void ppp_server::handle_lcp(uint8_t code, uint8_t id, const uint8_t *data, size_t length)
+{
+    switch (code) {
+        case CONF_REQ:
+            if (lcp.is_opened()) {
+                // the peer renegotiates: back to link establishment
+                phase = link_phase::establish;
+                lcp.ack_received = false;
+                lcp.request_sent = false;
+                ipcp = {PPP_IPCP, "IPCP", false, false, false, 0, 0};
+            }
+            handle_config_request(lcp, id, data, length);
+            return;
+        case CONF_ACK:
+        case CONF_NAK:
+        case CONF_REJ:
+            handle_config_reply(lcp, code, id, data, length);
+            return;
+        case TERM_REQ:
+            printf("ppp_server: the host terminated the link.\n");
+            send_control(PPP_LCP, TERM_ACK, id, nullptr, 0);
+            phase = link_phase::dead;
+            // hang up once Terminate-Ack is on its way
+            reactor->cancel_timer(restart_timer.exchange(0));
+            restart_timer.store(reactor->add_timer(PPP_HANGUP_DELAY, [this]{
+                if (is_connected()) {hang_up("link terminated");}
+            }));
+            return;
+        case TERM_ACK:
+        case CODE_REJ:
+        case PROTO_REJ:
+        case ECHO_REPLY:
+        case DISCARD_REQ:
+            return;
+        case ECHO_REQ: {
+            if (!lcp.is_opened() || length < 4) {return;}
+            uint8_t reply[PPP_MRU];
+            length = std::min(length, sizeof(reply));
+            memcpy(reply, data, length);
+            put_u32(reply, magic);
+            send_control(PPP_LCP, ECHO_REPLY, id, reply, length);
+            return;
+        }
+        default: {
+            uint8_t reject[PPP_MRU];
+            reject[0] = code;
+            reject[1] = id;
+            length = std::min(length, sizeof(reject) - 4);
+            put_u16(&reject[2], length + 4);
+            memcpy(&reject[4], data, length);
+            send_control(PPP_LCP, CODE_REJ, ++lcp.request_id, reject, length + 4);
+            return;
+        }
+    }
+}
+
+void ppp_server::handle_ipcp(uint8_t code, uint8_t id, const uint8_t *data, size_t length)
+{
+    switch (code) {
+        case CONF_REQ:
+            handle_config_request(ipcp, id, data, length);
+            return;
+        case CONF_ACK:
+        case CONF_NAK:
+        case CONF_REJ:
+            handle_config_reply(ipcp, code, id, data, length);
+            return;
+        case TERM_REQ:
+            send_control(PPP_IPCP, TERM_ACK, id, nullptr, 0);
+            ipcp.ack_sent = false;
+            ipcp.ack_received = false;
+            return;
+    }
+}
+
+void ppp_server::handle_pap(uint8_t code, uint8_t id, const uint8_t *data, size_t length)
+{
+    if (code != PAP_REQ || auth_protocol != PPP_PAP || length < 1 || data[0] + 1U > length) {
+        return;
+    }
+    printf("ppp_server: PAP login as \"%.*s\".\n", data[0], (const char *) &data[1]);
+
+    static const char message[] = "Login ok";
+    uint8_t ack[1 + sizeof(message)];
+    ack[0] = sizeof(message) - 1;
+    memcpy(&ack[1], message, sizeof(message) - 1);
+    send_control(PPP_PAP, PAP_ACK, id, ack, sizeof(message));
+    if (phase == link_phase::authenticate) {
+        network_phase();
+    }
+}
+
+void ppp_server::handle_chap(uint8_t code, uint8_t id, const uint8_t *data, size_t length)
+{
+    if (code != CHAP_RESPONSE || auth_protocol != PPP_CHAP || id != chap_id || length < 1 || data[0] + 1U > length) {
+        return;
+    }
+    printf("ppp_server: CHAP login as \"%.*s\".\n", (int) (length - 1 - data[0]), (const char *) &data[1 + data[0]]);
+
+    static const char message[] = "Welcome";
+    send_control(PPP_CHAP, CHAP_SUCCESS, id, reinterpret_cast<const uint8_t *>(message), sizeof(message) - 1);
+    if (phase == link_phase::authenticate) {
+        network_phase();
+    }
+}
+
+// Answers a Configure-Request with Ack, Nak or Reject, option by option.
+void ppp_server::handle_config_request(control_protocol &cp, uint8_t id, const uint8_t *data, size_t length)
+{
+    const bool was_opened = cp.is_opened();
+    uint8_t nak[PPP_MAX_FRAME], rej[PPP_MAX_FRAME];
+    size_t nak_length = 0, rej_length = 0;
+    pending_accm = 0xffffffff;
+
+    for (size_t pos = 0; pos < length; ) {
+        if (length - pos < 2 || data[pos + 1] < 2 || data[pos + 1] > length - pos) {
+            return; // malformed, drop the packet
+        }
+        const auto option = &data[pos];
+        const auto option_length = option[1];
+        const auto verdict = check_option(cp, option, &nak[nak_length]);
+        if (verdict == OPTION_REJ) {
+            memcpy(&rej[rej_length], option, option_length);
+            rej_length += option_length;
+        } else if (verdict == OPTION_NAK) {
+            nak_length += nak[nak_length + 1];
+        }
+        pos += option_length;
+    }
+
+    if (!cp.request_sent) {
+        send_config_request(cp);
+    }
+    if (rej_length > 0) {
+        send_control(cp.protocol, CONF_REJ, id, rej, rej_length);
+        cp.ack_sent = false;
+    } else if (nak_length > 0) {
+        send_control(cp.protocol, CONF_NAK, id, nak, nak_length);
+        cp.ack_sent = false;
+    } else {
+        send_control(cp.protocol, CONF_ACK, id, data, length);
+        cp.ack_sent = true;
+        if (cp.protocol == PPP_LCP) {
+            peer_accm = pending_accm;
+            encoder.set_accm(peer_accm);
+        }
+    }
+    if (!was_opened && cp.is_opened()) {
+        layer_up(cp);
+    }
+}
+
+// Returns OPTION_ACK, OPTION_NAK (with the wanted option written to nak) or
+// OPTION_REJ for one option of the peer's Configure-Request.
+int ppp_server::check_option(control_protocol &cp, const uint8_t *option, uint8_t *nak)
+{
+    const auto type = option[0];
+    const auto length = option[1];
+    if (cp.protocol == PPP_LCP) {
+        switch (type) {
+            case LCP_MRU:
+                return length == 4 ? OPTION_ACK : OPTION_REJ;
+            case LCP_ACCM:
+                if (length != 6) {return OPTION_REJ;}
+                pending_accm = get_u32(&option[2]);
+                return OPTION_ACK;
+            case LCP_MAGIC:
+                if (length != 6) {return OPTION_REJ;}
+                if (get_u32(&option[2]) != magic) {return OPTION_ACK;}
+                // looped back line or same random number: suggest another one
+                nak[0] = LCP_MAGIC;
+                nak[1] = 6;
+                put_u32(&nak[2], ~magic);
+                return OPTION_NAK;
+            case LCP_PFC:
+            case LCP_ACFC:
+                return length == 2 ? OPTION_ACK : OPTION_REJ;
+            default:
+                // including authentication of ourselves towards the host
+                return OPTION_REJ;
+        }
+    }
+
+    // IPCP
+    in_addr_t wanted;
+    switch (type) {
+        case IPCP_ADDR:
+            wanted = peer_addr;
+            break;
+        case IPCP_DNS1:
+        case IPCP_DNS2:
+            wanted = dns_addr;
+            break;
+        default:
+            // including VJ header compression and NBNS
+            return OPTION_REJ;
+    }
+    if (length != 6) {return OPTION_REJ;}
+    if (memcmp(&option[2], &wanted, 4) == 0) {return OPTION_ACK;}
+    nak[0] = type;
+    nak[1] = 6;
+    memcpy(&nak[2], &wanted, 4);
+    return OPTION_NAK;
+}
+
+void ppp_server::handle_config_reply(control_protocol &cp, uint8_t code, uint8_t id, const uint8_t *data, size_t length)
+{
+    if (id != cp.request_id || cp.ack_received) {
+        return;
+    }
+    if (code == CONF_ACK) {
+        const bool was_opened = cp.is_opened();
+        cp.ack_received = true;
+        cp.retries = 0;
+        if (!was_opened && cp.is_opened()) {
+            layer_up(cp);
+        }
+        return;
+    }
+
+    for (size_t pos = 0; pos + 2 <= length && data[pos + 1] >= 2 && pos + data[pos + 1] <= length; pos += data[pos + 1]) {
+        const auto option = &data[pos];
+        if (cp.protocol == PPP_LCP) {
+            switch (option[0]) {
+                case LCP_ACCM:
+                    request_accm = false;
+                    break;
+                case LCP_MAGIC:
+                    if (code == CONF_REJ) {request_magic = false;} else {magic = std::random_device()();}
+                    break;
+                case LCP_AUTH:
+                    // a Nak names the protocol the host prefers
+                    if (code == CONF_NAK && option[1] >= 5 && get_u16(&option[2]) == PPP_CHAP && option[4] == CHAP_MD5) {
+                        auth_protocol = PPP_CHAP;
+                    } else if (code == CONF_NAK && option[1] >= 4 && get_u16(&option[2]) == PPP_PAP) {
+                        auth_protocol = PPP_PAP;
+                    } else {
+                        auth_protocol = 0;
+                    }
+                    break;
+            }
+        } else if (option[0] == IPCP_ADDR && code == CONF_REJ) {
+            request_addr = false;
+        }
+    }
+    if (cp.retries >= PPP_MAX_CONFIGURE) {
+        hang_up("Configure-Request does not converge");
+        return;
+    }
+    send_config_request(cp);
+}
+
+void ppp_server::layer_up(control_protocol &cp)
+{
+    if (cp.protocol == PPP_IPCP) {
+        char local[INET_ADDRSTRLEN], peer[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &local_addr, local, sizeof(local));
+        inet_ntop(AF_INET, &peer_addr, peer, sizeof(peer));
+        printf("ppp_server: IPCP up, %s <-> %s on %s.\n", local, peer, tun.get_name().c_str());
+        return;
+    }
+
+    printf("ppp_server: LCP up.\n");
+    if (auth_protocol == PPP_PAP) {
+        phase = link_phase::authenticate;
+    } else if (auth_protocol == PPP_CHAP) {
+        phase = link_phase::authenticate;
+        send_chap_challenge();
+    } else {
+        network_phase();
+    }
+}
+
+void ppp_server::network_phase(void)
+{
+    phase = link_phase::network;
+    if (!ipcp.request_sent) {
+        send_config_request(ipcp);
+    }
+}
+
+void ppp_server::send_config_request(control_protocol &cp)
+{
+    uint8_t options[32];
+    size_t length = 0;
+    if (cp.protocol == PPP_LCP) {
+        if (request_accm) {
+            // we take every control character as is
+            options[length++] = LCP_ACCM;
+            options[length++] = 6;
+            put_u32(&options[length], 0);
+            length += 4;
+        }
+        if (auth_protocol == PPP_PAP) {
+            options[length++] = LCP_AUTH;
+            options[length++] = 4;
+            put_u16(&options[length], PPP_PAP);
+            length += 2;
+        } else if (auth_protocol == PPP_CHAP) {
+            options[length++] = LCP_AUTH;
+            options[length++] = 5;
+            put_u16(&options[length], PPP_CHAP);
+            length += 2;
+            options[length++] = CHAP_MD5;
+        }
+        if (request_magic) {
+            options[length++] = LCP_MAGIC;
+            options[length++] = 6;
+            put_u32(&options[length], magic);
+            length += 4;
+        }
+    } else if (request_addr) {
+        options[length++] = IPCP_ADDR;
+        options[length++] = 6;
+        memcpy(&options[length], &local_addr, 4);
+        length += 4;
+    }
+
+    cp.request_sent = true;
+    cp.retries++;
+    send_control(cp.protocol, CONF_REQ, ++cp.request_id, options, length);
+}
+
+void ppp_server::send_chap_challenge(void)
+{
+    static const char name[] = "me56ps2";
+    uint8_t challenge[1 + sizeof(chap_challenge) + sizeof(name)];
+    challenge[0] = sizeof(chap_challenge);
+    memcpy(&challenge[1], chap_challenge, sizeof(chap_challenge));
+    memcpy(&challenge[1 + sizeof(chap_challenge)], name, sizeof(name) - 1);
+    send_control(PPP_CHAP, CHAP_CHALLENGE, ++chap_id, challenge, sizeof(challenge) - 1);
+}
+
+void ppp_server::send_control(uint16_t protocol, uint8_t code, uint8_t id, const uint8_t *data, size_t length)
+{
+    uint8_t packet[4 + PPP_MRU];
+    length = std::min(length, PPP_MRU);
+    packet[0] = code;
+    packet[1] = id;
+    put_u16(&packet[2], length + 4);
+    if (length > 0) {memcpy(&packet[4], data, length);}
+    if (debug_level >= 1) {printf("ppp_server: sending protocol 0x%04x code %d id %d.\n", protocol, code, id);}
+    send_frame(protocol, packet, length + 4);
+}
+
+// Async HDLC framing towards the host. Address, control and protocol fields
+// are never compressed; LCP always escapes all control characters.
+void ppp_server::send_frame(uint16_t protocol, const uint8_t *data, size_t length)
+{
+    uint8_t out[hdlc_encoder::max_encoded_length(PPP_MAX_FRAME)];
+    const uint8_t header[4] = {0xff, 0x03, static_cast<uint8_t>(protocol >> 8), static_cast<uint8_t>(protocol & 0xff)};
+    const auto &framer = (protocol == PPP_LCP) ? lcp_encoder : encoder;
+    const auto out_length = framer.encode(header, sizeof(header), data, length, out);
+
+    // a frame is delivered whole or not at all
+    if (recv_buffer->get_buffer_size() - recv_buffer->get_count() < out_length) {
+        if (debug_level >= 1) {printf("ppp_server: receive buffer is full! (dropped a %ld bytes frame.)\n", (long) out_length);}
+        return;
+    }
+    if (!(*recv_callback)(reinterpret_cast<const char *>(out), out_length)) {
+        return;
+    }
+    recv_buffer->enqueue(reinterpret_cast<const char *>(out), out_length);
+    recv_buffer->notify();
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <netinet/in.h>
+#include "flow_control.h"
+#include "hdlc.h"
+#include "io_reactor.h"
+#include "ring_buffer.h"
+#include "tun_dev.h"
+#include "tx_queue.h"
+
+constexpr size_t PPP_MRU = 1500;
+constexpr size_t PPP_MAX_FRAME = PPP_MRU + 8; // address, control, protocol, FCS and slack
+
+// PPP peer for the dial-up ISP numbers, terminating the link inside the
+// emulator: async HDLC framing on the USB data stream, LCP, PAP or CHAP
+// (any credentials are accepted) and IPCP, with the IP packets going in and
+// out of a TUN interface. Replaces the PTY and pppd for ATD100/168.
+//
+// send() is called by the bulk OUT endpoint threads and only queues; all
+// protocol handling runs on the reactor thread. Frames to the host go into
+// recv_buffer like data received from a socket.
+class ppp_server {
+    private:
+        enum class link_phase {dead, establish, authenticate, network};
+
+        // Configure-Request/Ack state of LCP or IPCP
+        struct control_protocol {
+            uint16_t protocol;
+            const char *name;
+            bool request_sent;
+            bool ack_sent;     // we acked the peer's request
+            bool ack_received; // the peer acked ours
+            uint8_t request_id;
+            int retries;
+            bool is_opened(void) const {return ack_sent && ack_received;}
+        };
+
+        std::atomic<int> tun_fd{-1};
+        tun_dev tun;
+        int debug_level = 0;
+        io_reactor *reactor;
+        ring_buffer<char> *recv_buffer = nullptr;
+        recv_flow_control flow;
+        bool (*recv_callback)(const char *, size_t) = nullptr;
+        void (*hangup_callback)(void) = nullptr; // the peer ended the link
+        tx_queue tx;
+        std::atomic<io_reactor::timer_id_t> restart_timer{0};
+        in_addr_t local_addr, peer_addr, dns_addr;
+
+        // reactor thread only from here on
+        link_phase phase = link_phase::dead;
+        control_protocol lcp, ipcp;
+        uint16_t auth_protocol = 0; // PAP, CHAP or 0 while negotiating none
+        bool request_accm = true;
+        bool request_magic = true;
+        bool request_addr = true;
+        uint32_t magic = 0;
+        uint32_t peer_accm = 0xffffffff;
+        uint32_t pending_accm = 0xffffffff;
+        uint8_t chap_id = 0;
+        uint8_t chap_challenge[16];
+        hdlc_encoder encoder;     // peer's ACCM once LCP is up
+        hdlc_encoder lcp_encoder; // LCP always escapes all control characters
+        hdlc_decoder decoder{PPP_MAX_FRAME};
+
+        void reset(void);
+        void start(void);
+        void restart(void);
+        void hang_up(const char *reason);
+        void flush_tx(void);
+        void tun_handler(int fd, uint32_t events);
+        void input(const uint8_t *data, size_t length);
+        void handle_frame(const uint8_t *data, size_t length);
+        void handle_lcp(uint8_t code, uint8_t id, const uint8_t *data, size_t length);
+        void handle_ipcp(uint8_t code, uint8_t id, const uint8_t *data, size_t length);
+        void handle_pap(uint8_t code, uint8_t id, const uint8_t *data, size_t length);
+        void handle_chap(uint8_t code, uint8_t id, const uint8_t *data, size_t length);
+        void handle_config_request(control_protocol &cp, uint8_t id, const uint8_t *data, size_t length);
+        void handle_config_reply(control_protocol &cp, uint8_t code, uint8_t id, const uint8_t *data, size_t length);
+        int check_option(control_protocol &cp, const uint8_t *option, uint8_t *nak);
+        void layer_up(control_protocol &cp);
+        void network_phase(void);
+        void send_config_request(control_protocol &cp);
+        void send_chap_challenge(void);
+        void send_control(uint16_t protocol, uint8_t code, uint8_t id, const uint8_t *data, size_t length);
+        void send_frame(uint16_t protocol, const uint8_t *data, size_t length);
+    public:
+        ppp_server(io_reactor *reactor, const char *tun_name);
+        ~ppp_server();
+        void set_debug_level(const int level);
+        void set_recv_buffer(ring_buffer<char> *buffer);
+        void set_flow_control(size_t high, size_t low);
+        void set_recv_callback(bool (*func)(const char *, size_t));
+        void set_hangup_callback(void (*func)(void));
+        void set_coalescing_window(const std::chrono::microseconds &window);
+        bool is_connected();
+        bool connect();
+        void disconnect();
+        void send(const char *buffer, size_t length);
+};
@@ -0,0 +1,198 @@
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "isp.h"
+#include "pppd_supervisor.h"
+#include "pty_dev.h"
+
+// the refill waits until the new session's LCP is under way
+constexpr auto STANDBY_REFILL_DELAY = std::chrono::seconds(1);
+constexpr auto STANDBY_RETRY_DELAY = std::chrono::seconds(10);
+
+pppd_supervisor::pppd_supervisor(io_reactor *reactor)
+{
+    pppd_supervisor::reactor = reactor;
+}
+
+pppd_supervisor::~pppd_supervisor()
+{
+    stop();
+    std::lock_guard<std::mutex> lock(standby_mtx);
+    standby_enabled = false;
+    if (standby_pid != 0) {kill(standby_pid, SIGTERM);}
+    if (standby_fd >= 0) {close(standby_fd);}
+}
+
+void pppd_supervisor::set_debug_level(const int level)
+{
+    debug_level = level;
+}
+
+void pppd_supervisor::set_standby(bool enable)
+{
+    {
+        std::lock_guard<std::mutex> lock(standby_mtx);
+        standby_enabled = enable;
+    }
+    if (enable) {schedule_refill(std::chrono::seconds(0));}
+}
+
+bool pppd_supervisor::is_running()
+{
+    return pid.load() != 0;
+}
+
+// Forks the command and arranges for it to be reaped; returns its pid or -1.
+pid_t pppd_supervisor::spawn(const std::vector<std::string> &args)
+{
+    const auto child = ISP::spawnCommand(args);
+    if (child < 0) {
+        return -1;
+    }
+
+    const int fd = syscall(SYS_pidfd_open, child, 0);
+    if (fd < 0) {
+        // kernels before 5.3: reap from a thread of its own
+        if (debug_level >= 1) {printf("pppd_supervisor: pidfd_open(): %s\n", std::strerror(errno));}
+        std::thread([this, child]{exit_handler(-1, child);}).detach();
+        return child;
+    }
+    reactor->add(fd, EPOLLIN, [this, fd, child](uint32_t){exit_handler(fd, child);});
+    return child;
+}
+
+// Called on the dial path: returns as soon as pppd is forked.
+bool pppd_supervisor::start(const std::string &slave_name)
+{
+    if (is_running()) {
+        // left over from the previous call, its PTY is gone already
+        if (debug_level >= 1) {printf("pppd_supervisor: stopping the previous pppd (pid %d).\n", pid.load());}
+        stop();
+    }
+    if (slave_name.empty()) {
+        printf("pppd_supervisor: slave name not set!\n");
+        return false;
+    }
+
+    const auto child = spawn(ISP::pppdCommand(slave_name, false));
+    if (child < 0) {
+        return false;
+    }
+    pid.store(child);
+    if (debug_level >= 1) {printf("pppd_supervisor: started pppd on %s (pid %d).\n", slave_name.c_str(), child);}
+    return true;
+}
+
+// Called on the dial path: moves the standby PTY master and its pppd to the
+// session. Returns false when there is none ready.
+bool pppd_supervisor::take_standby(int *fd, std::string *slave_name)
+{
+    {
+        std::lock_guard<std::mutex> lock(standby_mtx);
+        if (standby_pid == 0) {
+            return false;
+        }
+        if (is_running()) {stop();}
+        pid.store(standby_pid);
+        *fd = standby_fd;
+        *slave_name = standby_name;
+        standby_pid = 0;
+        standby_fd = -1;
+    }
+    if (debug_level >= 1) {printf("pppd_supervisor: using the standby pppd on %s (pid %d).\n", slave_name->c_str(), pid.load());}
+    schedule_refill(STANDBY_REFILL_DELAY);
+    return true;
+}
+
+void pppd_supervisor::schedule_refill(const std::chrono::steady_clock::duration &delay)
+{
+    {
+        std::lock_guard<std::mutex> lock(standby_mtx);
+        if (!standby_enabled || refill_pending) {
+            return;
+        }
+        refill_pending = true;
+    }
+    reactor->add_timer(delay, [this]{refill_standby();});
+}
+
+// Runs on the reactor thread: opens a PTY and starts a pppd that stays
+// silent until the host's first LCP packet.
+void pppd_supervisor::refill_standby(void)
+{
+    bool retry = false;
+    {
+        // held across the fork so the fallback reaper cannot miss standby_pid
+        std::lock_guard<std::mutex> lock(standby_mtx);
+        refill_pending = false;
+        if (!standby_enabled || standby_pid != 0) {
+            return;
+        }
+        std::string name;
+        const int fd = pty_dev::open_master(&name);
+        const auto child = (fd >= 0) ? spawn(ISP::pppdCommand(name, true)) : -1;
+        if (child >= 0) {
+            standby_fd = fd;
+            standby_name = name;
+            standby_pid = child;
+            if (debug_level >= 1) {printf("pppd_supervisor: standby pppd ready on %s (pid %d).\n", name.c_str(), child);}
+        } else {
+            if (fd >= 0) {close(fd);}
+            retry = true;
+        }
+    }
+    if (retry) {schedule_refill(STANDBY_RETRY_DELAY);}
+}
+
+// Runs on the reactor thread (or the fallback thread) once a pppd has exited.
+void pppd_supervisor::exit_handler(int fd, pid_t child)
+{
+    int status = 0;
+    if (waitpid(child, &status, 0) < 0) {
+        printf("pppd_supervisor: waitpid(): %s\n", std::strerror(errno));
+    }
+    if (fd >= 0) {
+        reactor->remove(fd);
+        close(fd);
+    }
+    pid_t expected = child;
+    pid.compare_exchange_strong(expected, 0);
+
+    if (WIFEXITED(status)) {
+        printf("pppd_supervisor: pppd exited with status %d.\n", WEXITSTATUS(status));
+    } else if (WIFSIGNALED(status)) {
+        printf("pppd_supervisor: pppd killed by signal %d.\n", WTERMSIG(status));
+    }
+
+    bool lost_standby = false;
+    {
+        std::lock_guard<std::mutex> lock(standby_mtx);
+        if (standby_pid == child) {
+            close(standby_fd);
+            standby_fd = -1;
+            standby_pid = 0;
+            lost_standby = true;
+        }
+    }
+    if (lost_standby) {
+        printf("pppd_supervisor: the standby pppd went away, starting another one later.\n");
+        schedule_refill(STANDBY_RETRY_DELAY);
+    }
+}
+
+// pppd normally exits by itself when the PTY master is closed; this covers
+// one that hangs on. Reaping is left to exit_handler.
+void pppd_supervisor::stop()
+{
+    const auto child = pid.load();
+    if (child != 0 && kill(child, SIGTERM) < 0 && errno != ESRCH) {
+        printf("pppd_supervisor: kill(): %s\n", std::strerror(errno));
+    }
+}
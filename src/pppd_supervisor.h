@@ -0,0 +1,41 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+#include "io_reactor.h"
+
+// Runs pppd on a PTY slave without blocking the caller. Children are watched
+// through a pidfd on the reactor and reaped when they exit; stop() asks the
+// session's pppd to terminate.
+//
+// In standby mode a second PTY is kept open with a silent pppd waiting on
+// it. take_standby() hands that pair to the dialing session and a new one is
+// prepared on the reactor thread a little later.
+class pppd_supervisor {
+    private:
+        io_reactor *reactor;
+        std::atomic<pid_t> pid{0}; // pppd of the current session
+        int debug_level = 0;
+        std::mutex standby_mtx; // guards the standby fields
+        bool standby_enabled = false;
+        bool refill_pending = false;
+        int standby_fd = -1;
+        std::string standby_name;
+        pid_t standby_pid = 0;
+        pid_t spawn(const std::vector<std::string> &args);
+        void exit_handler(int fd, pid_t child);
+        void schedule_refill(const std::chrono::steady_clock::duration &delay);
+        void refill_standby(void);
+    public:
+        pppd_supervisor(io_reactor *reactor);
+        ~pppd_supervisor();
+        void set_debug_level(const int level);
+        void set_standby(bool enable);
+        bool is_running();
+        bool start(const std::string &slave_name);
+        bool take_standby(int *fd, std::string *slave_name);
+        void stop();
+};
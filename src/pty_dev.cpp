@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cerrno>
 #include <cstdio>
 #include <cstring>
@@ -5,59 +6,81 @@
 #include <stdlib.h>
 #include <termios.h>
 #include <unistd.h>
-#include <sys/select.h>
-#include <thread>
+#include <sys/epoll.h>
+#include <sys/uio.h>
 
 #include "pty_dev.h"
 
-void* pty_dev::recv_thread(void)
+void pty_dev::recv_handler(int fd, uint32_t events)
 {
-    fd_set readfds;
-    timeval recv_timeout;
-    auto fd = master_fd.load();
-    char buf[64];
-
-    if (debug_level >= 1) {printf("pty_dev: start recv_thread.\n");}
-    while (true) {
-        FD_ZERO(&readfds);
-        FD_SET(fd, &readfds);
-        recv_timeout = {.tv_sec = 0, .tv_usec = 100 * 1000}; // 100ms
-        auto ret = select(fd + 1, &readfds, nullptr, nullptr, &recv_timeout);
-        if (ret < 0) {
-            printf("pty_dev: select(): %s\n", std::strerror(errno));
-            break;
-        }
-        if (ret == 0) {
-            if (!is_connected()) {
-                break;
-            }
-            continue;
+    if (events & EPOLLOUT) {
+        flush_tx();
+        if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) == 0) {
+            return;
         }
+    }
 
-        auto len = read(fd, buf, sizeof(buf));
-        if (len < 0) {
-            if (errno == EIO) {
-                // slave side closed (no process has the slave open)
-                if (debug_level >= 1) {printf("pty_dev: slave closed.\n");}
-            } else {
-                printf("pty_dev: read(): %s\n", std::strerror(errno));
-            }
+    switch (flow.check(fd, events, *recv_buffer)) {
+        case recv_flow_control::action::paused:
+            // the PTY throttles the writer meanwhile
+            return;
+        case recv_flow_control::action::hang_up:
+            if (debug_level >= 1) {printf("pty_dev: slave closed.\n");}
+            disconnect();
+            if (hangup_callback != nullptr) {(*hangup_callback)();}
+            return;
+        case recv_flow_control::action::read:
             break;
-        }
-        if (len == 0) {
+    }
+
+    // read straight into the free span of the ring buffer
+    size_t span_length;
+    auto span = recv_buffer->reserve(&span_length);
+    span_length = flow.limit(*recv_buffer, span_length);
+    char overflow[64];
+    const auto is_full = (span_length == 0);
+    if (is_full) {
+        span = overflow;
+        span_length = sizeof(overflow);
+    }
+
+    auto len = read(fd, span, span_length);
+    if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        recv_buffer->commit(0);
+        return;
+    }
+    if (len <= 0) {
+        recv_buffer->commit(0);
+        if (len < 0 && errno == EIO) {
+            // slave side closed (no process has the slave open)
+            if (debug_level >= 1) {printf("pty_dev: slave closed.\n");}
+        } else if (len < 0) {
+            printf("pty_dev: read(): %s\n", std::strerror(errno));
+        } else {
             printf("pty_dev: connection closed.\n");
-            break;
         }
-        if (debug_level >= 2) {printf("pty_dev: received %ld bytes.\n", len);}
-        (*recv_callback)(buf, len);
+        disconnect();
+        if (hangup_callback != nullptr) {(*hangup_callback)();}
+        return;
     }
-
-    return nullptr;
+    if (is_full) {
+        recv_buffer->commit(0);
+        printf("pty_dev: receive buffer is full! (overflow %ld bytes.)\n", len);
+        return;
+    }
+    if (debug_level >= 2) {printf("pty_dev: received %ld bytes.\n", len);}
+    const auto accepted = (*recv_callback)(span, len);
+    recv_buffer->commit(accepted ? len : 0);
+    if (accepted) {recv_buffer->notify();}
 }
 
-pty_dev::pty_dev()
+constexpr auto PTY_DEV_TX_QUEUE_SIZE = 65536U;
+
+pty_dev::pty_dev(io_reactor *reactor)
+    : flow("pty_dev", reactor), tx("pty_dev", reactor, PTY_DEV_TX_QUEUE_SIZE, [this]{flush_tx();})
 {
     master_fd.store(0);
+    pty_dev::reactor = reactor;
 }
 
 pty_dev::~pty_dev()
@@ -68,36 +91,58 @@ pty_dev::~pty_dev()
 void pty_dev::set_debug_level(const int level)
 {
     debug_level = level;
+    flow.set_debug_level(level);
+}
+
+void pty_dev::set_recv_buffer(ring_buffer<char> *buffer)
+{
+    recv_buffer = buffer;
 }
 
-void pty_dev::set_recv_callback(void (*func)(const char *, size_t))
+void pty_dev::set_flow_control(size_t high, size_t low)
+{
+    flow.set_watermarks(high, low);
+}
+
+void pty_dev::set_recv_callback(bool (*func)(const char *, size_t))
 {
     recv_callback = func;
 }
 
+void pty_dev::set_hangup_callback(void (*func)(void))
+{
+    hangup_callback = func;
+}
+
+void pty_dev::set_coalescing_window(const std::chrono::microseconds &window)
+{
+    tx.set_window(window);
+}
+
 bool pty_dev::is_connected()
 {
     return master_fd.load() != 0;
 }
 
-bool pty_dev::connect()
+// Opens a raw PTY master; returns its fd and the slave path, or -1.
+int pty_dev::open_master(std::string *slave_name)
 {
-    int fd = posix_openpt(O_RDWR | O_NOCTTY);
+    int fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
     if (fd < 0) {
         printf("pty_dev: posix_openpt(): %s\n", std::strerror(errno));
-        return false;
+        return -1;
     }
 
     if (grantpt(fd) < 0) {
         printf("pty_dev: grantpt(): %s\n", std::strerror(errno));
         close(fd);
-        return false;
+        return -1;
     }
 
     if (unlockpt(fd) < 0) {
         printf("pty_dev: unlockpt(): %s\n", std::strerror(errno));
         close(fd);
-        return false;
+        return -1;
     }
 
     // Set raw mode so binary PPP frames pass through without echo or
@@ -106,62 +151,93 @@ bool pty_dev::connect()
     if (tcgetattr(fd, &tios) < 0) {
         printf("pty_dev: tcgetattr(): %s\n", std::strerror(errno));
         close(fd);
-        return false;
+        return -1;
     }
     cfmakeraw(&tios);
     if (tcsetattr(fd, TCSANOW, &tios) < 0) {
         printf("pty_dev: tcsetattr(): %s\n", std::strerror(errno));
         close(fd);
-        return false;
+        return -1;
     }
 
-    char slave_name[256];
-    if (ptsname_r(fd, slave_name, sizeof(slave_name)) != 0) {
+    char name[256];
+    if (ptsname_r(fd, name, sizeof(name)) != 0) {
         printf("pty_dev: ptsname_r(): %s\n", std::strerror(errno));
         close(fd);
-        return false;
+        return -1;
     }
+    *slave_name = name;
+    return fd;
+}
 
-    printf("pty_dev: PTY slave device: %s\n", slave_name);
+bool pty_dev::connect()
+{
+    std::string name;
+    const int fd = open_master(&name);
+    if (fd < 0) {
+        return false;
+    }
+    attach(fd, name);
+    return true;
+}
 
-    master_fd.store(fd);
+// Takes over a master opened by open_master(), e.g. one with pppd already
+// waiting on the slave side.
+void pty_dev::attach(int fd, const std::string &slave_name)
+{
+    printf("pty_dev: PTY slave device: %s\n", slave_name.c_str());
     this->slave_name = slave_name;
-    recv_thread_ptr = new std::thread([this]{pty_dev::recv_thread();});
-    return true;
+    master_fd.store(fd);
+    reactor->add(fd, EPOLLIN, [this, fd](uint32_t events){recv_handler(fd, events);});
 }
 
 void pty_dev::disconnect()
 {
-    auto fd = master_fd.load();
+    // the reactor thread calls this too when the slave is closed
+    auto fd = master_fd.exchange(0);
     if (fd != 0) {
+        // returns once a running recv_handler has finished, so closing is safe
+        reactor->remove(fd);
         close(fd);
-        master_fd.store(0);
-    }
-    if (recv_thread_ptr != nullptr) {
-        if (recv_thread_ptr->joinable()) {
-            recv_thread_ptr->join();
-        }
-        delete recv_thread_ptr;
-        recv_thread_ptr = nullptr;
     }
 }
 
+// Called by the bulk OUT endpoint threads; blocks while the send queue is full.
 void pty_dev::send(const char *buffer, size_t length)
 {
-    size_t ptr = 0;
-    auto fd = master_fd.load();
-    if (fd == 0) {
+    if (master_fd.load() == 0) {
         printf("pty_dev: not connected.\n");
         return;
     }
-    while (ptr < length) {
-        auto ret = write(fd, buffer + ptr, length - ptr);
+    tx.push(buffer, length);
+}
+
+// Writes the queued data on the reactor thread. When the PTY is full,
+// EPOLLOUT brings us back through recv_handler.
+void pty_dev::flush_tx(void)
+{
+    const auto fd = master_fd.load();
+    if (fd == 0) {
+        tx.discard();
+        return;
+    }
+
+    struct iovec iov[2];
+    int iov_count;
+    while ((iov_count = tx.peek(iov)) > 0) {
+        auto ret = writev(fd, iov, iov_count);
+        if (ret < 0 && errno == EAGAIN) {
+            reactor->enable(fd, EPOLLOUT);
+            return;
+        }
         if (ret < 0) {
-            printf("pty_dev: write(): %s\n", std::strerror(errno));
+            printf("pty_dev: writev(): %s\n", std::strerror(errno));
+            tx.discard();
             break;
         }
-        ptr += ret;
+        tx.consume(ret);
     }
+    reactor->disable(fd, EPOLLOUT);
 }
 
 std::string pty_dev::get_slave_name() {
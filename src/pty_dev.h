@@ -2,24 +2,38 @@
 #define PTY_DEV_H
 
 #include <atomic>
-#include <thread>
 #include <string>
+#include "flow_control.h"
+#include "io_reactor.h"
+#include "ring_buffer.h"
+#include "tx_queue.h"
 
 class pty_dev {
     private:
         std::atomic<int> master_fd;
         std::string slave_name;
         int debug_level = 0;
-        std::thread *recv_thread_ptr = nullptr;
-        void (*recv_callback)(const char *, size_t) = nullptr;
-        void* recv_thread(void);
+        io_reactor *reactor;
+        ring_buffer<char> *recv_buffer = nullptr;
+        recv_flow_control flow;
+        bool (*recv_callback)(const char *, size_t) = nullptr;
+        void (*hangup_callback)(void) = nullptr; // the slave side was closed
+        tx_queue tx;
+        void recv_handler(int fd, uint32_t events);
+        void flush_tx(void);
     public:
-        pty_dev();
+        pty_dev(io_reactor *reactor);
         ~pty_dev();
         void set_debug_level(const int level);
-        void set_recv_callback(void (*func)(const char *, size_t));
+        void set_recv_buffer(ring_buffer<char> *buffer);
+        void set_flow_control(size_t high, size_t low);
+        void set_recv_callback(bool (*func)(const char *, size_t));
+        void set_hangup_callback(void (*func)(void));
+        void set_coalescing_window(const std::chrono::microseconds &window);
         bool is_connected();
+        static int open_master(std::string *slave_name);
         bool connect();
+        void attach(int fd, const std::string &slave_name);
         void disconnect();
         void send(const char *buffer, size_t length);
         std::string get_slave_name();
@@ -1,33 +1,52 @@
 #pragma once
 
-#include <chrono>
-#include <condition_variable>
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
 #include <mutex>
+#include <type_traits>
 
 template <typename T>
 class ring_buffer
 {
+    static_assert(std::is_trivially_copyable<T>::value, "ring_buffer copies elements with memcpy");
+
     private:
         T *buffer;
         size_t buffer_size;
         size_t write_ptr, read_ptr;
-        std::mutex mtx;
-        std::condition_variable cv;
+        uint64_t write_total = 0, read_total = 0;
+        std::mutex mtx;       // guards write_ptr and read_ptr
+        std::mutex write_mtx; // serializes producers, held from reserve() to commit()
+        std::mutex read_mtx;  // serializes consumers, held from peek() to consume()
+        std::function<void(void)> data_notifier; // set once before the threads start
+        size_t space_threshold = 0; // non-zero while a space notifier is armed
+        std::function<void(void)> space_notifier;
         bool is_empty_without_lock(void);
         bool is_full_without_lock(void);
-        bool enqueue_single_without_lock(const T *data);
-        bool dequeue_single_without_lock(T *data);
+        size_t get_count_without_lock(void);
+        std::function<void(void)> take_space_notifier_without_lock(void);
     public:
         ring_buffer(const size_t size);
         ~ring_buffer();
         bool is_empty(void);
         size_t get_buffer_size(void);
         size_t get_count(void);
+        uint64_t get_write_total(void);
+        uint64_t get_read_total(void);
         size_t enqueue(const T *data, size_t length);
         size_t dequeue(T *data, size_t max_length);
-        bool wait(const std::chrono::steady_clock::time_point &timeout_at);
-        void notify_one(void);
+        T *reserve(size_t *length);
+        size_t reserve(T *(&spans)[2], size_t (&lengths)[2]);
+        void commit(size_t length);
+        const T *peek(size_t *length);
+        void consume(size_t length);
+        size_t discard(size_t max_length);
+        void set_data_notifier(std::function<void(void)> func);
+        void notify(void);
+        bool notify_below(const size_t count, std::function<void(void)> func);
 };
 
 template <typename T>
@@ -72,77 +91,215 @@ size_t ring_buffer<T>::get_buffer_size(void)
     return buffer_size - 1;
 }
 
+template <typename T>
+size_t ring_buffer<T>::get_count_without_lock(void)
+{
+    return (write_ptr - read_ptr + buffer_size) % buffer_size;
+}
+
 template <typename T>
 size_t ring_buffer<T>::get_count(void)
 {
     std::lock_guard<std::mutex> lock(mtx);
-    return (write_ptr - read_ptr + buffer_size) % buffer_size;
+    return get_count_without_lock();
 }
 
+// Running totals of all elements ever written/read, used to tell which of
+// them are still queued without keeping per-element state.
 template <typename T>
-bool ring_buffer<T>::enqueue_single_without_lock(const T *data)
+uint64_t ring_buffer<T>::get_write_total(void)
 {
-    if (is_full_without_lock()) {
-        return false;
+    std::lock_guard<std::mutex> lock(mtx);
+    return write_total;
+}
+
+template <typename T>
+uint64_t ring_buffer<T>::get_read_total(void)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return read_total;
+}
+
+template <typename T>
+size_t ring_buffer<T>::enqueue(const T *data, size_t length)
+{
+    std::lock_guard<std::mutex> write_lock(write_mtx);
+
+    size_t ptr;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        length = std::min(length, get_buffer_size() - get_count_without_lock());
+        ptr = write_ptr;
     }
 
-    buffer[write_ptr] = *data;
-    write_ptr = (write_ptr + 1) % buffer_size;
+    // copy in at most two spans: up to the end of the storage, then from the top
+    const auto first = std::min(length, buffer_size - ptr);
+    memcpy(&buffer[ptr], data, first * sizeof(T));
+    memcpy(&buffer[0], &data[first], (length - first) * sizeof(T));
 
-    return true;
+    std::lock_guard<std::mutex> lock(mtx);
+    write_ptr = (ptr + length) % buffer_size;
+    write_total += length;
+
+    return length;
 }
 
 template <typename T>
-size_t ring_buffer<T>::enqueue(const T *data, size_t length)
+size_t ring_buffer<T>::dequeue(T *data, size_t max_length)
+{
+    std::lock_guard<std::mutex> read_lock(read_mtx);
+
+    size_t ptr, length;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        length = std::min(max_length, get_count_without_lock());
+        ptr = read_ptr;
+    }
+
+    const auto first = std::min(length, buffer_size - ptr);
+    memcpy(data, &buffer[ptr], first * sizeof(T));
+    memcpy(&data[first], &buffer[0], (length - first) * sizeof(T));
+
+    std::function<void(void)> notifier;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        read_ptr = (ptr + length) % buffer_size;
+        read_total += length;
+        notifier = take_space_notifier_without_lock();
+    }
+    if (notifier) {notifier();}
+
+    return length;
+}
+
+// Returns the largest contiguous free span and stores its length in *length.
+// The caller writes into it directly and must then call commit(), even with 0,
+// which publishes the written elements and lets other producers continue.
+template <typename T>
+T *ring_buffer<T>::reserve(size_t *length)
 {
+    write_mtx.lock();
+
     std::lock_guard<std::mutex> lock(mtx);
+    const auto free_count = get_buffer_size() - get_count_without_lock();
+    *length = std::min(free_count, buffer_size - write_ptr);
 
-    size_t ptr = 0;
-    while(ptr < length && enqueue_single_without_lock(&data[ptr])) {ptr++;}
+    return &buffer[write_ptr];
+}
 
-    return ptr;
+// Like reserve(), but returns all of the free space, split in two spans where
+// it wraps around (lengths[1] is 0 otherwise), and its total length.
+template <typename T>
+size_t ring_buffer<T>::reserve(T *(&spans)[2], size_t (&lengths)[2])
+{
+    write_mtx.lock();
+
+    std::lock_guard<std::mutex> lock(mtx);
+    const auto free_count = get_buffer_size() - get_count_without_lock();
+    spans[0] = &buffer[write_ptr];
+    lengths[0] = std::min(free_count, buffer_size - write_ptr);
+    spans[1] = &buffer[0];
+    lengths[1] = free_count - lengths[0];
+    return free_count;
 }
 
 template <typename T>
-bool ring_buffer<T>::dequeue_single_without_lock(T *data)
+void ring_buffer<T>::commit(size_t length)
 {
-    if (is_empty_without_lock()) {
-        return false;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        write_ptr = (write_ptr + length) % buffer_size;
+        write_total += length;
     }
 
-    *data = buffer[read_ptr];
-    read_ptr = (read_ptr + 1) % buffer_size;
-
-    return true;
+    write_mtx.unlock();
 }
 
+// Returns the largest contiguous readable span and stores its length in *length.
+// The caller reads from it directly and must then call consume(), even with 0,
+// which releases the read elements and lets other consumers continue.
 template <typename T>
-size_t ring_buffer<T>::dequeue(T *data, size_t max_length)
+const T *ring_buffer<T>::peek(size_t *length)
 {
+    read_mtx.lock();
+
     std::lock_guard<std::mutex> lock(mtx);
+    *length = std::min(get_count_without_lock(), buffer_size - read_ptr);
 
-    size_t ptr = 0;
-    while(ptr < max_length && dequeue_single_without_lock(&data[ptr])) {ptr++;}
+    return &buffer[read_ptr];
+}
 
-    return ptr;
+template <typename T>
+void ring_buffer<T>::consume(size_t length)
+{
+    std::function<void(void)> notifier;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        read_ptr = (read_ptr + length) % buffer_size;
+        read_total += length;
+        notifier = take_space_notifier_without_lock();
+    }
+
+    read_mtx.unlock();
+    if (notifier) {notifier();}
 }
 
 template <typename T>
-bool ring_buffer<T>::wait(const std::chrono::steady_clock::time_point &timeout_at)
+size_t ring_buffer<T>::discard(size_t max_length)
 {
-    std::unique_lock<std::mutex> lock(mtx);
+    std::lock_guard<std::mutex> read_lock(read_mtx);
 
-    if (!is_empty_without_lock()) {
-        return false;
+    size_t length;
+    std::function<void(void)> notifier;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        length = std::min(max_length, get_count_without_lock());
+        read_ptr = (read_ptr + length) % buffer_size;
+        read_total += length;
+        notifier = take_space_notifier_without_lock();
     }
+    if (notifier) {notifier();}
 
-    return cv.wait_until(lock, timeout_at, [&]{return !is_empty_without_lock();});
+    return length;
 }
 
 template <typename T>
-void ring_buffer<T>::notify_one(void)
+void ring_buffer<T>::set_data_notifier(std::function<void(void)> func)
 {
-    cv.notify_one();
+    data_notifier = std::move(func);
+}
 
-    return;
-}
\ No newline at end of file
+// Called by producers after enqueue()/commit() to wake the consumers.
+template <typename T>
+void ring_buffer<T>::notify(void)
+{
+    if (data_notifier) {data_notifier();}
+}
+
+template <typename T>
+std::function<void(void)> ring_buffer<T>::take_space_notifier_without_lock(void)
+{
+    if (space_threshold == 0 || get_count_without_lock() >= space_threshold) {
+        return nullptr;
+    }
+    space_threshold = 0;
+    auto notifier = std::move(space_notifier);
+    space_notifier = nullptr;
+    return notifier;
+}
+
+// Arms a one-shot notifier that a consumer calls once fewer than count elements
+// are queued. Returns false without arming it if that is already the case.
+template <typename T>
+bool ring_buffer<T>::notify_below(const size_t count, std::function<void(void)> func)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+
+    if (get_count_without_lock() < count) {
+        return false;
+    }
+    space_threshold = count;
+    space_notifier = std::move(func);
+
+    return true;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+
+// Lock-free ring buffer for exactly one producer thread and one consumer thread.
+// head/tail run freely and are masked on access, so the capacity is rounded
+// up to a power of two and every slot is usable.
+template <typename T>
+class spsc_ring_buffer
+{
+    static_assert(std::is_trivially_copyable<T>::value, "spsc_ring_buffer copies elements with memcpy");
+
+    private:
+        T *buffer;
+        size_t buffer_size;
+        size_t mask;
+        alignas(64) std::atomic<size_t> head; // written by the producer
+        alignas(64) std::atomic<size_t> tail; // written by the consumer
+    public:
+        spsc_ring_buffer(const size_t size);
+        ~spsc_ring_buffer();
+        spsc_ring_buffer(const spsc_ring_buffer &) = delete;
+        spsc_ring_buffer &operator=(const spsc_ring_buffer &) = delete;
+        bool is_empty(void) const;
+        size_t get_buffer_size(void) const;
+        size_t get_count(void) const;
+        size_t enqueue(const T *data, size_t length);
+        size_t dequeue(T *data, size_t max_length);
+        size_t peek(T *(&spans)[2], size_t (&lengths)[2]);
+        void consume(size_t length);
+};
+
+template <typename T>
+spsc_ring_buffer<T>::spsc_ring_buffer(const size_t size)
+{
+    buffer_size = 1;
+    while (buffer_size < size) {buffer_size <<= 1;}
+    mask = buffer_size - 1;
+    buffer = new T[buffer_size];
+    head.store(0, std::memory_order_relaxed);
+    tail.store(0, std::memory_order_relaxed);
+}
+
+template <typename T>
+spsc_ring_buffer<T>::~spsc_ring_buffer()
+{
+    delete[] buffer;
+}
+
+template <typename T>
+bool spsc_ring_buffer<T>::is_empty(void) const
+{
+    return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+}
+
+template <typename T>
+size_t spsc_ring_buffer<T>::get_buffer_size(void) const
+{
+    return buffer_size;
+}
+
+template <typename T>
+size_t spsc_ring_buffer<T>::get_count(void) const
+{
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+}
+
+template <typename T>
+size_t spsc_ring_buffer<T>::enqueue(const T *data, size_t length)
+{
+    const auto h = head.load(std::memory_order_relaxed);
+    const auto t = tail.load(std::memory_order_acquire);
+    length = std::min(length, buffer_size - (h - t));
+
+    const auto offset = h & mask;
+    const auto first = std::min(length, buffer_size - offset);
+    memcpy(&buffer[offset], data, first * sizeof(T));
+    memcpy(&buffer[0], &data[first], (length - first) * sizeof(T));
+
+    head.store(h + length, std::memory_order_release);
+    return length;
+}
+
+template <typename T>
+size_t spsc_ring_buffer<T>::dequeue(T *data, size_t max_length)
+{
+    const auto t = tail.load(std::memory_order_relaxed);
+    const auto h = head.load(std::memory_order_acquire);
+    const auto length = std::min(max_length, h - t);
+
+    const auto offset = t & mask;
+    const auto first = std::min(length, buffer_size - offset);
+    memcpy(data, &buffer[offset], first * sizeof(T));
+    memcpy(&data[first], &buffer[0], (length - first) * sizeof(T));
+
+    tail.store(t + length, std::memory_order_release);
+    return length;
+}
+
+// Consumer side: the queued data in place, split in two spans where it wraps
+// around (lengths[1] is 0 otherwise). Returns the total length.
+template <typename T>
+size_t spsc_ring_buffer<T>::peek(T *(&spans)[2], size_t (&lengths)[2])
+{
+    const auto t = tail.load(std::memory_order_relaxed);
+    const auto h = head.load(std::memory_order_acquire);
+    const auto length = h - t;
+
+    const auto offset = t & mask;
+    spans[0] = &buffer[offset];
+    lengths[0] = std::min(length, buffer_size - offset);
+    spans[1] = &buffer[0];
+    lengths[1] = length - lengths[0];
+    return length;
+}
+
+// Consumer side: releases length elements returned by peek().
+template <typename T>
+void spsc_ring_buffer<T>::consume(size_t length)
+{
+    tail.store(tail.load(std::memory_order_relaxed) + length, std::memory_order_release);
+}
@@ -1,93 +1,127 @@
+#include <algorithm>
 #include <cstring>
 #include <stdexcept>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <arpa/inet.h> 
 #include <unistd.h>
-#include <thread>
 
 #include "tcp_sock.h"
 
-void* tcp_sock::recv_thread(void)
+void tcp_sock::recv_handler(int comm_fd, uint32_t events)
 {
-    fd_set readfds;
-    timeval recv_timeout;
-    auto comm_fd = tcp_sock::comm_fd.load();
-    char buf[64];
-
-    if (debug_level >= 1) {printf("tcp_sock: start recv_thread.\n");}
-    while (true) {
-        FD_ZERO(&readfds);
-        FD_SET(comm_fd, &readfds);
-        recv_timeout = {.tv_sec = 0, .tv_usec = 100 * 1000}; // 100ms
-        auto ret = select(comm_fd + 1, &readfds, nullptr, nullptr, &recv_timeout);
-        if (ret < 0) {
-            printf("tcp_sock: select(): %s\n", std::strerror(errno));
-            break;
-        }
-        if (ret == 0) {
-            if (!is_connected()) {
-                // Connection closed
-                break;
-            }
-            // No data
-            continue;
+    if (events & EPOLLOUT) {
+        flush_tx();
+        if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) == 0) {
+            return;
         }
+    }
+
+    switch (flow.check(comm_fd, events, *recv_buffer)) {
+        case recv_flow_control::action::paused:
+            // the TCP window throttles the peer meanwhile
+            return;
+        case recv_flow_control::action::hang_up:
+            printf("tcp_sock: connection closed.\n");
+            disconnect();
+            if (hangup_callback != nullptr) {(*hangup_callback)();}
+            return;
+        case recv_flow_control::action::read:
+            break;
+    }
+
+    // receive straight into the free span of the ring buffer
+    size_t span_length;
+    auto span = recv_buffer->reserve(&span_length);
+    span_length = flow.limit(*recv_buffer, span_length);
+    char overflow[64];
+    const auto is_full = (span_length == 0);
+    if (is_full) {
+        span = overflow;
+        span_length = sizeof(overflow);
+    }
 
-        auto len = ::recv(comm_fd, buf, sizeof(buf), 0);
+    auto len = ::recv(comm_fd, span, span_length, MSG_DONTWAIT);
+    if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        recv_buffer->commit(0);
+        return;
+    }
+    if (len <= 0) {
+        recv_buffer->commit(0);
         if (len < 0) {
             printf("tcp_sock: recv(): %s\n", std::strerror(errno));
-            break;
-        }
-        if (len == 0) {
+        } else {
             printf("tcp_sock: connection closed.\n");
-            break;
         }
-        if (debug_level >= 2) {printf("tcp_sock: received %ld bytes.\n", len);}
-        (*recv_callback)(buf, len);
+        disconnect();
+        if (hangup_callback != nullptr) {(*hangup_callback)();}
+        return;
+    }
+    if (is_full) {
+        recv_buffer->commit(0);
+        printf("tcp_sock: receive buffer is full! (overflow %ld bytes.)\n", len);
+        return;
     }
+    if (debug_level >= 2) {printf("tcp_sock: received %ld bytes.\n", len);}
+    const auto accepted = (*recv_callback)(span, len);
+    recv_buffer->commit(accepted ? len : 0);
+    if (accepted) {recv_buffer->notify();}
+}
 
-    return nullptr;
+// With a peer timeout, unacknowledged data or unanswered keepalive probes
+// reset the connection after that long instead of the kernel's ~15 minutes.
+// Keepalive only has a resolution of seconds; TCP_USER_TIMEOUT is in ms.
+void tcp_sock::set_peer_timeout_options(int fd)
+{
+    const int timeout_ms = peer_timeout.count();
+    if (timeout_ms <= 0) {
+        return;
+    }
+    const int one = 1;
+    const int idle = std::max(1, timeout_ms / 2000);
+    const int count = std::max(1, timeout_ms / 1000 - idle);
+    setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &timeout_ms, sizeof(timeout_ms));
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &one, sizeof(one));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
 }
 
-void* tcp_sock::listen_thread(void)
+void tcp_sock::listen_handler(uint32_t events)
 {
-    if (debug_level >= 1) {printf("tcp_sock: start listen_thread.\n");}
-    while (true) {
-        struct sockaddr_in client_addr;
-        socklen_t len = sizeof(client_addr);
-        auto client_fd = accept(server_fd, reinterpret_cast<struct sockaddr *>(&client_addr), &len);
+    (void)events;
 
-        if (debug_level >= 1) {printf("tcp_sock: client connected.\n");}
+    struct sockaddr_in client_addr;
+    socklen_t len = sizeof(client_addr);
+    auto client_fd = accept4(server_fd, reinterpret_cast<struct sockaddr *>(&client_addr), &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client_fd < 0) {
+        printf("tcp_sock: accept(): %s\n", std::strerror(errno));
+        return;
+    }
 
-        if (client_fd < 0) {
-            throw std::runtime_error((std::string) "accept(): " + std::strerror(errno));
-        }
+    if (debug_level >= 1) {printf("tcp_sock: client connected.\n");}
 
-        if (comm_fd.load() == 0) {
-            comm_fd.store(client_fd);
-            (*ring_callback)();
-            recv_thread_ptr = new std::thread([&]{tcp_sock::recv_thread();});
-        } else {
-            ::close(client_fd);
-        }
+    if (comm_fd.load() == 0) {
+        set_peer_timeout_options(client_fd);
+        comm_fd.store(client_fd);
+        (*ring_callback)();
+        reactor->add(client_fd, EPOLLIN, [this, client_fd](uint32_t events){recv_handler(client_fd, events);});
+    } else {
+        ::close(client_fd);
     }
-
-    return nullptr;
 }
 
-tcp_sock::tcp_sock(bool is_server,  const char *ip_addr, uint16_t port)
+tcp_sock::tcp_sock(io_reactor *reactor, bool is_server, const char *ip_addr, uint16_t port)
+    : net_sock("tcp_sock", reactor, ip_addr, port)
 {
     int ret;
     comm_fd.store(0);
     tcp_sock::is_server = is_server;
 
-    memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port);
-    addr.sin_addr.s_addr = inet_addr(ip_addr);
-
     if (is_server) {
-        server_fd = socket(AF_INET, SOCK_STREAM, 0);
+        server_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
         if (server_fd < 0) {
             throw std::runtime_error((std::string) "tcp_sock: socket(): " + std::strerror(errno));
         }
@@ -103,100 +137,140 @@ tcp_sock::tcp_sock(bool is_server,  const char *ip_addr, uint16_t port)
             throw std::runtime_error((std::string) "tcp_sock: listen(): " + std::strerror(errno));
         }
 
-        listen_thread_ptr = new std::thread([&]{listen_thread();});
+        reactor->add(server_fd, EPOLLIN, [this](uint32_t events){listen_handler(events);});
     }
 }
 
 tcp_sock::~tcp_sock()
 {
+    cancel_connect();
     if (server_fd >= 0) {
+        reactor->remove(server_fd);
         close(server_fd);
     }
-    if (listen_thread_ptr != nullptr) {
-        listen_thread_ptr->join();
-        delete listen_thread_ptr;
-        listen_thread_ptr = nullptr;
-    }
     disconnect();
 }
 
-void tcp_sock::set_debug_level(const int level)
+bool tcp_sock::is_connected()
 {
-    debug_level = level;
+    return comm_fd.load() != 0;
 }
 
-void tcp_sock::set_ring_callback(void (*func)(void))
+// Starts a non-blocking connect; done is called on the reactor thread once
+// the connection is up, refused or timed out.
+void tcp_sock::connect(const std::chrono::milliseconds &timeout, dial_callback_t done)
 {
-    ring_callback = func;
-}
+    auto fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        throw std::runtime_error((std::string) "tcp_sock: socket(): " + std::strerror(errno));
+    }
 
-void tcp_sock::set_recv_callback(void (*func)(const char *, size_t))
-{
-    recv_callback = func;
-}
+    auto ret = ::connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+    if (ret < 0 && errno != EINPROGRESS) {
+        const auto error = errno;
+        printf("tcp_sock: connect(): %s\n", std::strerror(error));
+        ::close(fd);
+        done(error);
+        return;
+    }
 
-void tcp_sock::set_addr(const struct sockaddr_in *addr_in)
-{
-    memcpy(&addr, addr_in, sizeof(addr));
+    // dial_handler ignores EPOLLOUT until begin_dial() has stored the callback
+    dial_fd = fd;
+    reactor->add(fd, EPOLLOUT, [this](uint32_t events){dial_handler(events);});
+    begin_dial(timeout, std::move(done));
 }
 
-bool tcp_sock::is_connected()
+void tcp_sock::dial_handler(uint32_t events)
 {
-    return comm_fd.load() != 0;
+    (void)events;
+
+    auto done = take_dial_callback();
+    if (!done) {
+        return;
+    }
+
+    const auto fd = dial_fd;
+    dial_fd = -1;
+    reactor->remove(fd);
+
+    int error = 0;
+    socklen_t error_length = sizeof(error);
+    getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &error_length);
+    if (error == 0 && !session_code.empty()) {
+        // ask the relay server to pair us with the other end of this session
+        const auto hello = "RELAY " + session_code + "\r\n";
+        if (::send(fd, hello.c_str(), hello.length(), MSG_NOSIGNAL) != static_cast<ssize_t>(hello.length())) {
+            error = errno;
+        } else if (debug_level >= 1) {
+            printf("tcp_sock: joined relay session %s.\n", session_code.c_str());
+        }
+    }
+    if (error != 0) {
+        printf("tcp_sock: connect(): %s\n", std::strerror(error));
+        ::close(fd);
+        done(error);
+        return;
+    }
+
+    set_peer_timeout_options(fd);
+    comm_fd.store(fd);
+    reactor->add(fd, EPOLLIN, [this, fd](uint32_t events){recv_handler(fd, events);});
+    done(0);
 }
 
-bool tcp_sock::connect()
+void tcp_sock::abort_dial(void)
 {
-    int ret;
-    auto comm_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (comm_fd < 0) {
-        throw std::runtime_error((std::string) "tcp_sock: socket(): " + std::strerror(errno));
+    if (dial_fd >= 0) {
+        // returns once a running dial_handler has finished
+        reactor->remove(dial_fd);
+        ::close(dial_fd);
+        dial_fd = -1;
     }
-
-    ret = ::connect(comm_fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
-    if (ret < 0) {
-        printf("tcp_sock: connect(): %s\n", std::strerror(errno));
-        ::close(comm_fd);
-        return false;
-    }
-    
-    tcp_sock::comm_fd.store(comm_fd);
-    recv_thread_ptr = new std::thread([&]{tcp_sock::recv_thread();});
-    return true;
 }
 
 void tcp_sock::disconnect()
 {
-    auto comm_fd = tcp_sock::comm_fd.load();
+    // the reactor thread calls this too when the peer hangs up
+    auto comm_fd = tcp_sock::comm_fd.exchange(0);
     if (comm_fd != 0) {
+        // returns once a running recv_handler has finished, so closing is safe
+        reactor->remove(comm_fd);
         close(comm_fd);
-        tcp_sock::comm_fd.store(0);
-    }
-    if (recv_thread_ptr != nullptr) {
-        if (recv_thread_ptr->joinable()) {
-            recv_thread_ptr->join();
-        }
-        delete recv_thread_ptr;
-        recv_thread_ptr = nullptr;
     }
 }
 
-void tcp_sock::send(const char *buffer, size_t length)
+// Writes the queued USB OUT data on the reactor thread. When the socket is
+// full, EPOLLOUT brings us back through recv_handler.
+void tcp_sock::flush_tx(void)
 {
-    size_t ptr = 0;
-    auto comm_fd = tcp_sock::comm_fd.load();
+    const auto comm_fd = tcp_sock::comm_fd.load();
     if (comm_fd == 0) {
-        printf("tcp_sock: socket closed.\n");
+        tx.discard();
         return;
     }
-    while (ptr < length) {
-        auto ret = ::send(comm_fd, buffer + ptr, length - ptr, MSG_NOSIGNAL);
+
+    struct iovec iov[2];
+    int iov_count;
+    while ((iov_count = tx.peek(iov)) > 0) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iov_count;
+        auto ret = sendmsg(comm_fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            reactor->enable(comm_fd, EPOLLOUT);
+            return;
+        }
         if (ret < 0) {
-            printf("tcp_sock: send(): %s\n", std::strerror(errno));
+            // the receive side notices the broken connection and hangs up
+            printf("tcp_sock: sendmsg(): %s\n", std::strerror(errno));
+            tx.discard();
             break;
         }
-        ptr += ret;
+        if (debug_level >= 2) {printf("tcp_sock: sent %ld bytes.\n", (long) ret);}
+        tx.consume(ret);
     }
+    reactor->disable(comm_fd, EPOLLOUT);
 }
 
 int tcp_sock::recv(char *buffer, size_t max_length)
@@ -3,30 +3,25 @@
 #include <atomic>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include "net_sock.h"
 
-class tcp_sock {
+class tcp_sock : public net_sock {
     private:
         int server_fd = -1;
         std::atomic<int> comm_fd; // communication socket fd
+        int dial_fd = -1;         // socket of the connect in progress
         bool is_server;
-        int debug_level = 0;
-        struct sockaddr_in addr;
-        std::thread *recv_thread_ptr = nullptr;
-        std::thread *listen_thread_ptr = nullptr;
-        void (*ring_callback)(void);
-        void (*recv_callback)(const char *, size_t);
-        void* recv_thread(void);
-        void* listen_thread(void);
+        void recv_handler(int comm_fd, uint32_t events);
+        void listen_handler(uint32_t events);
+        void dial_handler(uint32_t events);
+        void set_peer_timeout_options(int fd);
+        void abort_dial(void) override;
+        void flush_tx(void) override;
     public:
-        tcp_sock(bool is_server, const char *ip_addr, uint16_t port);
+        tcp_sock(io_reactor *reactor, bool is_server, const char *ip_addr, uint16_t port);
         ~tcp_sock();
-        void set_debug_level(const int level);
-        void set_ring_callback(void (*func)(void));
-        void set_recv_callback(void (*func)(const char *, size_t));
-        void set_addr(const struct sockaddr_in *addr_in);
-        bool is_connected();
-        bool connect();
-        void disconnect();
-        void send(const char *buffer, size_t length);
+        bool is_connected() override;
+        void connect(const std::chrono::milliseconds &timeout, dial_callback_t done) override;
+        void disconnect() override;
         int recv(char *buffer, size_t max_length);
 };
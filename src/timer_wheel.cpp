@@ -0,0 +1,77 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "timer_wheel.h"
+
+timer_wheel::timer_wheel(const std::chrono::steady_clock::duration &tick, size_t slot_count)
+    : tick(tick), slots(slot_count), origin(std::chrono::steady_clock::now())
+{
+    if (tick <= std::chrono::steady_clock::duration::zero() || slot_count == 0) {
+        throw std::runtime_error("timer_wheel: tick and slot count must be positive");
+    }
+}
+
+// Room for this many timers in every slot, so that scheduling does not
+// allocate on the owner thread.
+void timer_wheel::reserve(size_t timers)
+{
+    for (auto &slot : slots) {
+        slot.reserve(timers);
+    }
+}
+
+void timer_wheel::schedule(uint32_t id, const std::chrono::steady_clock::time_point &when)
+{
+    // first tick at or after when, but never one that was already processed
+    const auto offset = std::max(when - origin, std::chrono::steady_clock::duration::zero());
+    const uint64_t due = std::max<uint64_t>(current + 1, (offset + tick - std::chrono::nanoseconds(1)) / tick);
+    const auto n = slots.size();
+    slots[due % n].push_back({id, (due - current - 1) / n});
+    count++;
+}
+
+// Processes every tick up to now and appends the ids of the timers that
+// expired, tick by tick.
+void timer_wheel::advance(const std::chrono::steady_clock::time_point &now, std::vector<uint32_t> &expired)
+{
+    if (now < origin) {
+        return;
+    }
+    const uint64_t target = (now - origin) / tick;
+    while (current < target && count > 0) {
+        current++;
+        auto &slot = slots[current % slots.size()];
+        for (size_t i = 0; i < slot.size();) {
+            if (slot[i].rounds > 0) {
+                slot[i++].rounds--;
+                continue;
+            }
+            expired.push_back(slot[i].id);
+            slot[i] = slot.back();
+            slot.pop_back();
+            count--;
+        }
+    }
+    // an empty wheel has nothing to walk through
+    current = std::max(current, target);
+}
+
+// Start of the tick in which the earliest timer expires; time_point::max()
+// if none is scheduled.
+std::chrono::steady_clock::time_point timer_wheel::next_expiry(void) const
+{
+    if (count == 0) {
+        return std::chrono::steady_clock::time_point::max();
+    }
+    const auto n = slots.size();
+    uint64_t earliest = UINT64_MAX;
+    for (size_t s = 0; s < n; s++) {
+        if (slots[s].empty()) {continue;}
+        // the first tick after current that maps to this slot
+        const auto first = current + 1 + (s + n - (current + 1) % n) % n;
+        for (const auto &e : slots[s]) {
+            earliest = std::min(earliest, first + e.rounds * n);
+        }
+    }
+    return origin + earliest * tick;
+}
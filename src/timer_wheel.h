@@ -0,0 +1,30 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Hashed timing wheel: timers land in the slot of their expiry tick, with the
+// number of full turns still to wait, so scheduling and expiry cost O(1) no
+// matter how far out a timer is. Expiry times are rounded up to the tick.
+// Not thread-safe; owned by one thread.
+class timer_wheel {
+    private:
+        struct entry {
+            uint32_t id;
+            uint64_t rounds; // full turns left before it expires
+        };
+        std::chrono::steady_clock::duration tick;
+        std::vector<std::vector<entry>> slots;
+        std::chrono::steady_clock::time_point origin; // start of tick 0
+        uint64_t current = 0; // last tick processed
+        size_t count = 0;
+    public:
+        timer_wheel(const std::chrono::steady_clock::duration &tick, size_t slot_count);
+        bool is_empty(void) const {return count == 0;}
+        void reserve(size_t timers);
+        void schedule(uint32_t id, const std::chrono::steady_clock::time_point &when);
+        void advance(const std::chrono::steady_clock::time_point &now, std::vector<uint32_t> &expired);
+        std::chrono::steady_clock::time_point next_expiry(void) const;
+};
@@ -0,0 +1,120 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <linux/if.h>
+#include <linux/if_tun.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include "tun_dev.h"
+
+tun_dev::tun_dev(const char *name) : name(name)
+{
+}
+
+tun_dev::~tun_dev()
+{
+    close();
+}
+
+void tun_dev::set_debug_level(const int level)
+{
+    debug_level = level;
+}
+
+// Creates the interface, assigns the point-to-point addresses (network byte
+// order) and brings it up.
+bool tun_dev::open(in_addr_t local, in_addr_t peer, int mtu)
+{
+    if (fd >= 0) {
+        return true;
+    }
+
+    fd = ::open("/dev/net/tun", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        printf("tun_dev: open(/dev/net/tun): %s\n", std::strerror(errno));
+        return false;
+    }
+
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
+    strncpy(ifr.ifr_name, name.c_str(), IFNAMSIZ - 1);
+    if (ioctl(fd, TUNSETIFF, &ifr) < 0) {
+        printf("tun_dev: ioctl(TUNSETIFF): %s\n", std::strerror(errno));
+        close();
+        return false;
+    }
+    name = ifr.ifr_name;
+
+    if (!configure(local, peer, mtu)) {
+        close();
+        return false;
+    }
+    if (debug_level >= 1) {printf("tun_dev: %s is up.\n", name.c_str());}
+    return true;
+}
+
+bool tun_dev::configure(in_addr_t local, in_addr_t peer, int mtu)
+{
+    const int sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        printf("tun_dev: socket(): %s\n", std::strerror(errno));
+        return false;
+    }
+
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, name.c_str(), IFNAMSIZ - 1);
+    auto addr = reinterpret_cast<struct sockaddr_in *>(&ifr.ifr_addr);
+    addr->sin_family = AF_INET;
+
+    const struct {
+        unsigned long request;
+        const char *request_name;
+        in_addr_t value;
+    } addresses[] = {
+        {SIOCSIFADDR,    "SIOCSIFADDR",    local},
+        {SIOCSIFDSTADDR, "SIOCSIFDSTADDR", peer},
+        {SIOCSIFNETMASK, "SIOCSIFNETMASK", INADDR_BROADCAST},
+    };
+    for (const auto &a : addresses) {
+        addr->sin_addr.s_addr = a.value;
+        if (ioctl(sock, a.request, &ifr) < 0) {
+            printf("tun_dev: ioctl(%s): %s\n", a.request_name, std::strerror(errno));
+            ::close(sock);
+            return false;
+        }
+    }
+
+    ifr.ifr_mtu = mtu;
+    if (ioctl(sock, SIOCSIFMTU, &ifr) < 0) {
+        printf("tun_dev: ioctl(SIOCSIFMTU): %s\n", std::strerror(errno));
+    }
+
+    if (ioctl(sock, SIOCGIFFLAGS, &ifr) < 0) {
+        printf("tun_dev: ioctl(SIOCGIFFLAGS): %s\n", std::strerror(errno));
+        ::close(sock);
+        return false;
+    }
+    ifr.ifr_flags |= IFF_UP | IFF_RUNNING | IFF_POINTOPOINT;
+    if (ioctl(sock, SIOCSIFFLAGS, &ifr) < 0) {
+        printf("tun_dev: ioctl(SIOCSIFFLAGS): %s\n", std::strerror(errno));
+        ::close(sock);
+        return false;
+    }
+
+    ::close(sock);
+    return true;
+}
+
+void tun_dev::close(void)
+{
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <netinet/in.h>
+
+// Layer 3 TUN interface (no packet information header): every read() returns
+// one IP packet and every write() injects one.
+class tun_dev {
+    private:
+        int fd = -1;
+        std::string name;
+        int debug_level = 0;
+        bool configure(in_addr_t local, in_addr_t peer, int mtu);
+    public:
+        tun_dev(const char *name);
+        ~tun_dev();
+        void set_debug_level(const int level);
+        bool open(in_addr_t local, in_addr_t peer, int mtu);
+        void close(void);
+        int get_fd(void) const {return fd;}
+        const std::string &get_name(void) const {return name;}
+};
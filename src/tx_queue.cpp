@@ -0,0 +1,109 @@
+#include <algorithm>
+
+#include "tx_queue.h"
+
+// how often a blocked push() schedules another flush: a flush that finds the
+// connection gone discards the queue, which releases the producer
+constexpr auto TX_QUEUE_RETRY = std::chrono::milliseconds(100);
+
+tx_queue::tx_queue(const char *name, io_reactor *reactor, size_t size, std::function<void(void)> flush)
+    : buffer(size)
+{
+    tx_queue::name = name;
+    tx_queue::reactor = reactor;
+    flush_func = std::move(flush);
+}
+
+tx_queue::~tx_queue()
+{
+    const auto timer = flush_timer.load();
+    if (timer != 0) {
+        reactor->cancel_timer(timer);
+    }
+}
+
+void tx_queue::set_window(const std::chrono::microseconds &window)
+{
+    tx_queue::window = window;
+}
+
+// Producer side. Blocks until all of the data is queued.
+void tx_queue::push(const char *data, size_t length)
+{
+    while (true) {
+        const auto queued = buffer.enqueue(data, length);
+        schedule();
+        data += queued;
+        length -= queued;
+        if (length == 0) {
+            return;
+        }
+
+        // wait for room for the rest, or a good part of the queue
+        const auto wanted = std::min(length, buffer.get_buffer_size() / 4);
+        std::unique_lock<std::mutex> lock(space_mtx);
+        space_cv.wait_for(lock, TX_QUEUE_RETRY, [this, wanted]{
+            return buffer.get_buffer_size() - buffer.get_count() >= wanted;
+        });
+    }
+}
+
+// Runs flush_func on the reactor thread once the window has passed, unless a
+// flush is already scheduled. The flag is cleared before flushing, so data
+// pushed during a flush schedules the next one.
+void tx_queue::schedule(void)
+{
+    if (flush_scheduled.exchange(true)) {
+        return;
+    }
+    flush_timer.store(reactor->add_timer(window, [this]{
+        flush_timer.store(0);
+        flush_scheduled.store(false);
+        flush_func();
+    }));
+}
+
+bool tx_queue::is_empty(void) const
+{
+    return buffer.is_empty();
+}
+
+// Consumer side: fills iov with the queued data and returns the iovec count.
+int tx_queue::peek(struct iovec (&iov)[2])
+{
+    char *spans[2];
+    size_t lengths[2];
+    if (buffer.peek(spans, lengths) == 0) {
+        return 0;
+    }
+    iov[0].iov_base = spans[0];
+    iov[0].iov_len = lengths[0];
+    iov[1].iov_base = spans[1];
+    iov[1].iov_len = lengths[1];
+    return (lengths[1] != 0) ? 2 : 1;
+}
+
+void tx_queue::consume(size_t length)
+{
+    buffer.consume(length);
+    signal_space();
+}
+
+// Consumer side: drops everything, e.g. after the connection went away.
+void tx_queue::discard(void)
+{
+    char *spans[2];
+    size_t lengths[2];
+    buffer.consume(buffer.peek(spans, lengths));
+    signal_space();
+}
+
+// Taking the lock orders the wakeup after a producer that just found the
+// queue full has started waiting.
+void tx_queue::signal_space(void)
+{
+    {
+        std::lock_guard<std::mutex> lock(space_mtx);
+    }
+    space_cv.notify_one();
+}
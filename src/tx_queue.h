@@ -0,0 +1,41 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <sys/uio.h>
+#include "io_reactor.h"
+#include "spsc_ring_buffer.h"
+
+// Outbound data from a bulk OUT endpoint thread to the reactor thread. push()
+// queues the data and schedules flush_func on the reactor after the
+// coalescing window, so everything that arrived meanwhile goes out with one
+// writev()/sendmsg(). While the queue is full push() waits for the reactor to
+// drain it, so the OUT thread stops reading and the host stops sending.
+class tx_queue {
+    private:
+        const char *name;
+        io_reactor *reactor;
+        spsc_ring_buffer<char> buffer;
+        std::function<void(void)> flush_func;
+        std::chrono::microseconds window{0};
+        std::atomic<bool> flush_scheduled{false};
+        std::atomic<io_reactor::timer_id_t> flush_timer{0};
+        std::mutex space_mtx;
+        std::condition_variable space_cv; // signalled when the consumer frees space
+        void signal_space(void);
+    public:
+        tx_queue(const char *name, io_reactor *reactor, size_t size, std::function<void(void)> flush);
+        ~tx_queue();
+        tx_queue(const tx_queue &) = delete;
+        tx_queue &operator=(const tx_queue &) = delete;
+        void set_window(const std::chrono::microseconds &window);
+        void push(const char *data, size_t length);
+        void schedule(void);
+        bool is_empty(void) const;
+        int peek(struct iovec (&iov)[2]);
+        void consume(size_t length);
+        void discard(void);
+};
@@ -0,0 +1,589 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include "udp_sock.h"
+
+enum {
+    UDP_TYPE_HELLO     = 1,
+    UDP_TYPE_HELLO_ACK = 2,
+    UDP_TYPE_DATA      = 3,
+    UDP_TYPE_ACK       = 4,
+    UDP_TYPE_BYE       = 5,
+    UDP_TYPE_PING      = 6, // keeps the session alive while no data flows
+};
+
+struct udp_header {
+    uint8_t type;
+    uint8_t flags;
+    uint16_t length; // payload length
+    uint32_t seq;
+    uint32_t ack;    // next sequence number expected from the peer
+} __attribute__ ((packed));
+
+constexpr auto UDP_MAX_PAYLOAD = 1024U;
+constexpr auto UDP_MAX_UNACKED = 512U;
+constexpr auto UDP_FAST_RETRANSMIT_COUNT = 4U; // datagrams resent on duplicate acks or timeout
+constexpr auto UDP_INITIAL_RTO = std::chrono::milliseconds(200);
+constexpr auto UDP_MIN_RTO = std::chrono::milliseconds(20);
+constexpr auto UDP_MAX_RTO = std::chrono::seconds(2);
+constexpr auto UDP_RTO_SLACK = std::chrono::milliseconds(10); // floor of the variance term
+constexpr auto UDP_WARN_RETRIES = 10U;
+constexpr auto UDP_HANDSHAKE_INTERVAL = std::chrono::milliseconds(250);
+
+void udp_sock::recv_handler(uint32_t events)
+{
+    // on hang_up (EPOLLERR), recvfrom() below collects the pending error
+    if (flow.check(sock_fd, events, *recv_buffer) == recv_flow_control::action::paused) {
+        // datagrams queue up in the socket buffer; lost ones are retransmitted
+        return;
+    }
+
+    char buf[sizeof(struct udp_header) + UDP_MAX_PAYLOAD];
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    auto len = recvfrom(sock_fd, buf, sizeof(buf), MSG_DONTWAIT, reinterpret_cast<struct sockaddr *>(&from), &from_len);
+    if (len < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            printf("udp_sock: recvfrom(): %s\n", std::strerror(errno));
+        }
+        return;
+    }
+    if (len < static_cast<ssize_t>(sizeof(struct udp_header))) {
+        return;
+    }
+
+    struct udp_header header;
+    memcpy(&header, buf, sizeof(header));
+    const auto payload_length = std::min<size_t>(ntohs(header.length), len - sizeof(header));
+    const auto seq = ntohl(header.seq);
+    const auto ack = ntohl(header.ack);
+
+    if (header.type == UDP_TYPE_HELLO || header.type == UDP_TYPE_HELLO_ACK) {
+        handle_hello(&from, header.type == UDP_TYPE_HELLO_ACK);
+        return;
+    }
+
+    // everything else must come from the current peer
+    if (!connected.load() || from.sin_addr.s_addr != peer_addr.sin_addr.s_addr || from.sin_port != peer_addr.sin_port) {
+        return;
+    }
+    last_heard = std::chrono::steady_clock::now();
+
+    switch (header.type) {
+        case UDP_TYPE_DATA:
+            handle_ack(ack, false);
+            handle_data(seq, &buf[sizeof(header)], payload_length);
+            break;
+        case UDP_TYPE_ACK:
+            handle_ack(ack, true);
+            break;
+        case UDP_TYPE_BYE:
+            peer_lost("connection closed.");
+            break;
+        default:
+            break;
+    }
+}
+
+void udp_sock::handle_hello(const struct sockaddr_in *from, bool is_ack)
+{
+    if (is_ack) {
+        // client side: the server accepted our HELLO
+        io_reactor::timer_id_t timer;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (!dialing) {
+                return;
+            }
+            dialing = false;
+            timer = hello_timer;
+            hello_timer = 0;
+        }
+        if (timer != 0) {
+            reactor->cancel_timer(timer);
+        }
+        auto done = take_dial_callback();
+        if (done) {
+            connected.store(true);
+            start_heartbeat();
+            done(0);
+        }
+        return;
+    }
+
+    if (!is_server) {
+        return;
+    }
+
+    const auto is_peer = connected.load()
+        && from->sin_addr.s_addr == peer_addr.sin_addr.s_addr && from->sin_port == peer_addr.sin_port;
+    if (connected.load() && !is_peer) {
+        // a session is already running
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!is_peer) {
+            memcpy(&peer_addr, from, sizeof(peer_addr));
+        }
+        // a HELLO from the current peer means it restarted the session
+        reset_session_without_lock();
+    }
+    send_control(UDP_TYPE_HELLO_ACK);
+
+    if (!connected.exchange(true)) {
+        if (debug_level >= 1) {printf("udp_sock: client connected.\n");}
+        start_heartbeat();
+        (*ring_callback)();
+    }
+}
+
+// Only pure ACKs count as duplicates: the ack on DATA repeats whenever both
+// ends send, and says nothing about a gap.
+void udp_sock::handle_ack(uint32_t ack, bool is_pure_ack)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+
+    if (ack == last_ack) {
+        // duplicate ack while data is outstanding: the peer is missing the oldest datagram
+        if (is_pure_ack && !unacked.empty() && ++dup_acks == 2 && !recovering) {
+            if (debug_level >= 2) {printf("udp_sock: fast retransmit from seq %u.\n", unacked.front().seq);}
+            recovering = true;
+            recover_seq = next_seq;
+            retransmit_without_lock(UDP_FAST_RETRANSMIT_COUNT, srtt);
+        }
+        return;
+    }
+    if (static_cast<int32_t>(ack - last_ack) < 0) {
+        return; // stale
+    }
+
+    last_ack = ack;
+    dup_acks = 0;
+    const auto now = std::chrono::steady_clock::now();
+    bool has_sample = false;
+    std::chrono::steady_clock::time_point sent_at;
+    while (!unacked.empty() && static_cast<int32_t>(ack - unacked.front().seq) > 0) {
+        // Karn: a resent datagram does not tell which copy was acked
+        has_sample = (unacked.front().retries == 0);
+        sent_at = unacked.front().sent_at;
+        unacked.pop_front();
+    }
+    if (has_sample) {
+        sample_rtt_without_lock(now - sent_at);
+    }
+    if (recovering && static_cast<int32_t>(ack - recover_seq) >= 0) {
+        // everything that was in flight when the loss was noticed has arrived
+        recovering = false;
+    } else if (recovering) {
+        // partial ack: the datagrams after the repaired gap were likely lost too
+        retransmit_without_lock(UDP_FAST_RETRANSMIT_COUNT, srtt);
+    }
+    if (!tx.is_empty()) {
+        // the send window has room again
+        tx.schedule();
+    }
+}
+
+// RFC 6298 estimate; a new sample also undoes the backoff of timeouts.
+void udp_sock::sample_rtt_without_lock(const std::chrono::steady_clock::duration &rtt)
+{
+    if (srtt.count() == 0) {
+        srtt = rtt;
+        rttvar = rtt / 2;
+    } else {
+        const auto error = (srtt > rtt) ? srtt - rtt : rtt - srtt;
+        rttvar = (rttvar * 3 + error) / 4;
+        srtt = (srtt * 7 + rtt) / 8;
+    }
+    const std::chrono::steady_clock::duration slack = UDP_RTO_SLACK;
+    rto = std::min<std::chrono::steady_clock::duration>(
+        std::max<std::chrono::steady_clock::duration>(srtt + std::max(slack, rttvar * 4), UDP_MIN_RTO), UDP_MAX_RTO);
+}
+
+// A datagram counts as received, and is acked, only once all of its payload
+// is in recv_buffer. One that does not fit waits in reorder while the socket
+// is paused until the IN endpoints drain the buffer.
+void udp_sock::handle_data(uint32_t seq, const char *payload, size_t length)
+{
+    bool blocked;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+
+        const auto distance = static_cast<int32_t>(seq - expected_seq);
+        if (distance == 0 && deliver(payload, length)) {
+            reorder.erase(seq); // a copy kept while the buffer was full
+            expected_seq++;
+        } else if (distance >= 0 && distance < static_cast<int32_t>(UDP_MAX_UNACKED)) {
+            reorder.emplace(seq, std::vector<char>(payload, payload + length));
+        }
+        // drain whatever the gap or the full buffer was holding back
+        blocked = !deliver_reordered_without_lock();
+    }
+
+    if (blocked) {
+        // no ack: the sender keeps the data and retransmits it after the pause
+        flow.pause(sock_fd, *recv_buffer);
+        return;
+    }
+    // ack every datagram; a repeated ack tells the sender about a gap
+    send_control(UDP_TYPE_ACK);
+}
+
+// Delivers the datagrams in reorder that are next in sequence; false if the
+// next one does not fit into recv_buffer.
+bool udp_sock::deliver_reordered_without_lock(void)
+{
+    for (auto it = reorder.find(expected_seq); it != reorder.end(); it = reorder.find(expected_seq)) {
+        if (!deliver(it->second.data(), it->second.size())) {
+            return false;
+        }
+        reorder.erase(it);
+        expected_seq++;
+    }
+    return true;
+}
+
+void udp_sock::send_control(uint8_t type)
+{
+    struct udp_header header;
+    header.type = type;
+    header.flags = 0;
+    header.length = 0;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        header.seq = htonl(next_seq);
+        header.ack = htonl(expected_seq);
+    }
+
+    auto ret = sendto(sock_fd, &header, sizeof(header), MSG_NOSIGNAL,
+        reinterpret_cast<const struct sockaddr *>(&peer_addr), sizeof(peer_addr));
+    if (ret < 0 && debug_level >= 1) {
+        printf("udp_sock: sendto(): %s\n", std::strerror(errno));
+    }
+}
+
+// Repeats HELLO every UDP_HANDSHAKE_INTERVAL until HELLO_ACK or the dial timeout.
+void udp_sock::send_hello(void)
+{
+    send_control(UDP_TYPE_HELLO);
+
+    std::lock_guard<std::mutex> lock(mtx);
+    if (!dialing) {
+        return;
+    }
+    hello_timer = reactor->add_timer(UDP_HANDSHAKE_INTERVAL, [this]{
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            hello_timer = 0;
+            if (!dialing) {
+                return;
+            }
+        }
+        send_hello();
+    });
+}
+
+void udp_sock::transmit(const std::vector<char> &packet)
+{
+    auto ret = sendto(sock_fd, packet.data(), packet.size(), MSG_NOSIGNAL,
+        reinterpret_cast<const struct sockaddr *>(&peer_addr), sizeof(peer_addr));
+    if (ret < 0 && debug_level >= 1) {
+        printf("udp_sock: sendto(): %s\n", std::strerror(errno));
+    }
+}
+
+// Resends up to count of the oldest datagrams that were last sent at least
+// min_age ago; younger ones cannot have been acked yet.
+void udp_sock::retransmit_without_lock(size_t count, const std::chrono::steady_clock::duration &min_age)
+{
+    const auto now = std::chrono::steady_clock::now();
+    for (auto it = unacked.begin(); it != unacked.end() && count > 0; ++it) {
+        if (now - it->sent_at < min_age) {
+            continue;
+        }
+        // refresh the piggybacked ack
+        struct udp_header header;
+        memcpy(&header, it->packet.data(), sizeof(header));
+        header.ack = htonl(expected_seq);
+        memcpy(it->packet.data(), &header, sizeof(header));
+
+        it->retries++;
+        it->sent_at = now;
+        transmit(it->packet);
+        count--;
+    }
+}
+
+// The timer runs out when the oldest datagram has waited one RTO. Acks only
+// move that deadline later, so an early expiry just arms the timer again.
+void udp_sock::arm_retransmit_timer_without_lock(void)
+{
+    if (retransmit_timer != 0 || unacked.empty()) {
+        return;
+    }
+    const auto now = std::chrono::steady_clock::now();
+    const auto due = unacked.front().sent_at + rto;
+    retransmit_timer = reactor->add_timer((due > now) ? due - now : std::chrono::steady_clock::duration(0), [this]{
+        std::lock_guard<std::mutex> lock(mtx);
+        retransmit_timer = 0;
+        if (unacked.empty()) {
+            return;
+        }
+        if (std::chrono::steady_clock::now() - unacked.front().sent_at >= rto) {
+            if (unacked.front().retries == UDP_WARN_RETRIES) {
+                printf("udp_sock: peer is not acknowledging data.\n");
+            }
+            retransmit_without_lock(UDP_FAST_RETRANSMIT_COUNT, rto);
+            rto = std::min<std::chrono::steady_clock::duration>(rto * 2, UDP_MAX_RTO);
+        }
+        arm_retransmit_timer_without_lock();
+    });
+}
+
+void udp_sock::reset_session_without_lock(void)
+{
+    next_seq = 1;
+    expected_seq = 1;
+    last_ack = 1;
+    dup_acks = 0;
+    recovering = false;
+    recover_seq = 1;
+    srtt = rttvar = std::chrono::steady_clock::duration(0);
+    rto = UDP_INITIAL_RTO;
+    unacked.clear();
+    reorder.clear();
+}
+
+// With a peer timeout, a PING goes out every quarter of it and a peer that
+// stays silent for the whole timeout is considered gone.
+void udp_sock::start_heartbeat(void)
+{
+    last_heard = std::chrono::steady_clock::now();
+    if (peer_timeout.count() <= 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mtx);
+    if (heartbeat_timer == 0) {
+        heartbeat_timer = reactor->add_timer(peer_timeout / 4, [this]{heartbeat();});
+    }
+}
+
+void udp_sock::stop_heartbeat(void)
+{
+    io_reactor::timer_id_t timer;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        timer = heartbeat_timer;
+        heartbeat_timer = 0;
+    }
+    if (timer != 0) {
+        reactor->cancel_timer(timer);
+    }
+}
+
+void udp_sock::heartbeat(void)
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        heartbeat_timer = 0;
+    }
+    if (!connected.load()) {
+        return;
+    }
+    const auto now = std::chrono::steady_clock::now();
+    if (!recv_buffer->is_empty()) {
+        // the host has not taken everything yet, so flow control may be
+        // holding the peer's PINGs in the socket buffer
+        last_heard = now;
+    }
+    if (now - last_heard > peer_timeout) {
+        peer_lost("peer timed out.");
+        return;
+    }
+    send_control(UDP_TYPE_PING);
+
+    // connected is cleared before stop_heartbeat() reads the timer id
+    std::lock_guard<std::mutex> lock(mtx);
+    if (connected.load()) {
+        heartbeat_timer = reactor->add_timer(peer_timeout / 4, [this]{heartbeat();});
+    }
+}
+
+// Ends the session from the reactor thread and reports the hangup.
+void udp_sock::peer_lost(const char *reason)
+{
+    if (!connected.exchange(false)) {
+        return;
+    }
+    printf("udp_sock: %s\n", reason);
+    stop_heartbeat();
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        reset_session_without_lock();
+    }
+    if (!is_server) {
+        close_socket();
+    }
+    if (hangup_callback != nullptr) {(*hangup_callback)();}
+}
+
+void udp_sock::close_socket(void)
+{
+    if (sock_fd < 0) {
+        return;
+    }
+    reactor->remove(sock_fd);
+    ::close(sock_fd);
+    sock_fd = -1;
+}
+
+udp_sock::udp_sock(io_reactor *reactor, bool is_server, const char *ip_addr, uint16_t port)
+    : net_sock("udp_sock", reactor, ip_addr, port)
+{
+    udp_sock::is_server = is_server;
+    memset(&peer_addr, 0, sizeof(peer_addr));
+
+    if (is_server) {
+        sock_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (sock_fd < 0) {
+            throw std::runtime_error((std::string) "udp_sock: socket(): " + std::strerror(errno));
+        }
+
+        auto ret = bind(sock_fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+        if (ret < 0) {
+            ::close(sock_fd);
+            throw std::runtime_error((std::string) "udp_sock: bind(): " + std::strerror(errno));
+        }
+
+        reactor->add(sock_fd, EPOLLIN, [this](uint32_t events){recv_handler(events);});
+    }
+}
+
+udp_sock::~udp_sock()
+{
+    cancel_connect();
+    disconnect();
+    close_socket();
+    if (retransmit_timer != 0) {
+        reactor->cancel_timer(retransmit_timer);
+    }
+}
+
+// The relay server only speaks TCP.
+bool udp_sock::set_session_code(const std::string &code)
+{
+    if (!code.empty()) {
+        printf("udp_sock: relay sessions need TCP.\n");
+        return false;
+    }
+    return true;
+}
+
+bool udp_sock::is_connected()
+{
+    return connected.load();
+}
+
+void udp_sock::connect(const std::chrono::milliseconds &timeout, dial_callback_t done)
+{
+    if (is_server) {
+        // the server socket answers whoever says HELLO first
+        done(EISCONN);
+        return;
+    }
+
+    close_socket();
+    sock_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sock_fd < 0) {
+        throw std::runtime_error((std::string) "udp_sock: socket(): " + std::strerror(errno));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        memcpy(&peer_addr, &addr, sizeof(peer_addr));
+        reset_session_without_lock();
+        dialing = true;
+    }
+    begin_dial(timeout, std::move(done));
+    reactor->add(sock_fd, EPOLLIN, [this](uint32_t events){recv_handler(events);});
+    send_hello();
+}
+
+void udp_sock::abort_dial(void)
+{
+    io_reactor::timer_id_t timer;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        dialing = false;
+        timer = hello_timer;
+        hello_timer = 0;
+    }
+    if (timer != 0) {
+        reactor->cancel_timer(timer);
+    }
+    close_socket();
+}
+
+void udp_sock::disconnect()
+{
+    if (!connected.exchange(false)) {
+        return;
+    }
+    stop_heartbeat();
+    send_control(UDP_TYPE_BYE);
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        reset_session_without_lock();
+    }
+    if (!is_server) {
+        close_socket();
+    }
+}
+
+// Packs the queued USB OUT data into datagrams on the reactor thread, as far
+// as the send window allows; handle_ack() calls this again as it opens.
+void udp_sock::flush_tx(void)
+{
+    if (!connected.load()) {
+        tx.discard();
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mtx);
+    struct iovec iov[2];
+    while (unacked.size() < UDP_MAX_UNACKED && tx.peek(iov) > 0) {
+        const auto payload_length = std::min<size_t>(iov[0].iov_len + iov[1].iov_len, UDP_MAX_PAYLOAD);
+        struct udp_header header;
+        header.type = UDP_TYPE_DATA;
+        header.flags = 0;
+        header.length = htons(payload_length);
+        header.seq = htonl(next_seq);
+        header.ack = htonl(expected_seq);
+
+        datagram d;
+        d.seq = next_seq++;
+        d.retries = 0;
+        d.sent_at = std::chrono::steady_clock::now();
+        d.packet.resize(sizeof(header) + payload_length);
+        memcpy(d.packet.data(), &header, sizeof(header));
+        const auto first = std::min(payload_length, iov[0].iov_len);
+        memcpy(d.packet.data() + sizeof(header), iov[0].iov_base, first);
+        memcpy(d.packet.data() + sizeof(header) + first, iov[1].iov_base, payload_length - first);
+        tx.consume(payload_length);
+
+        transmit(d.packet);
+        unacked.push_back(std::move(d));
+    }
+    arm_retransmit_timer_without_lock();
+}
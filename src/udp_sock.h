@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <vector>
+#include "net_sock.h"
+
+// Datagram transport for low-latency play. Every datagram carries a sequence
+// number and a cumulative ack; the receiver delivers in order from a small
+// reorder buffer, and the sender retransmits the oldest unacked datagrams on
+// duplicate acks (fast retransmit) or once they are older than a
+// retransmission timeout estimated from the measured round trip time.
+class udp_sock : public net_sock {
+    private:
+        struct datagram {
+            uint32_t seq;
+            unsigned int retries;
+            std::chrono::steady_clock::time_point sent_at; // last transmission
+            std::vector<char> packet; // header and payload
+        };
+        int sock_fd = -1;
+        bool is_server;
+        std::atomic<bool> connected{false};
+        struct sockaddr_in peer_addr;
+        std::mutex mtx;
+        bool dialing = false; // HELLO is being repeated until the server answers
+        io_reactor::timer_id_t hello_timer = 0;
+        uint32_t next_seq = 1;     // sequence number of the next datagram sent
+        uint32_t expected_seq = 1; // sequence number of the next datagram delivered
+        uint32_t last_ack = 1;
+        unsigned int dup_acks = 0;
+        bool recovering = false; // resend the next gap on every partial ack
+        uint32_t recover_seq = 1; // recovery ends once this is acked
+        std::chrono::steady_clock::duration srtt{0}, rttvar{0}, rto{0}; // srtt is 0 until the first sample
+        std::deque<datagram> unacked;
+        std::map<uint32_t, std::vector<char>> reorder;
+        io_reactor::timer_id_t retransmit_timer = 0;
+        io_reactor::timer_id_t heartbeat_timer = 0;
+        std::chrono::steady_clock::time_point last_heard; // only used on the reactor thread
+        void recv_handler(uint32_t events);
+        void handle_hello(const struct sockaddr_in *from, bool is_ack);
+        void handle_ack(uint32_t ack, bool is_pure_ack);
+        void sample_rtt_without_lock(const std::chrono::steady_clock::duration &rtt);
+        void handle_data(uint32_t seq, const char *payload, size_t length);
+        bool deliver_reordered_without_lock(void);
+        void send_control(uint8_t type);
+        void send_hello(void);
+        void transmit(const std::vector<char> &packet);
+        void retransmit_without_lock(size_t count, const std::chrono::steady_clock::duration &min_age);
+        void arm_retransmit_timer_without_lock(void);
+        void reset_session_without_lock(void);
+        void start_heartbeat(void);
+        void stop_heartbeat(void);
+        void heartbeat(void);
+        void peer_lost(const char *reason);
+        void close_socket(void);
+        void abort_dial(void) override;
+        void flush_tx(void) override;
+    public:
+        udp_sock(io_reactor *reactor, bool is_server, const char *ip_addr, uint16_t port);
+        ~udp_sock();
+        bool is_connected() override;
+        void connect(const std::chrono::milliseconds &timeout, dial_callback_t done) override;
+        bool set_session_code(const std::string &code) override;
+        void disconnect() override;
+};
@@ -0,0 +1,28 @@
+#include <cctype>
+#include <cstdio>
+
+#include "usb_gadget.h"
+
+void usb_gadget::dump_hex_and_ascii(const void *data, const size_t length)
+{
+    const uint8_t *c = reinterpret_cast<const uint8_t *>(data);
+    for (size_t offset = 0; offset < length; offset += 16) {
+        printf("  %04lx: ", offset);
+        for (size_t p = 0; p < 16; p++) {
+            if (offset + p < length) {
+                printf("%02x ", c[offset + p]);
+            } else {
+                printf("   ");
+            }
+        }
+        for (size_t p = 0; p < 16 && offset + p < length; p++) {
+            printf("%c", isprint(c[offset + p]) ? c[offset + p] : '.');
+        }
+        printf("\n");
+    }
+}
+
+void usb_gadget::set_debug_level(const int level)
+{
+    debug_level = level;
+}
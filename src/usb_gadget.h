@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <linux/usb/raw_gadget.h>
+
+// Device side of the USB link as seen by the control loop and the endpoint
+// threads, shaped after the Raw Gadget ioctls. usb_raw_gadget drives a real
+// UDC; usb_loopback_gadget keeps everything in memory for tests and
+// benchmarks. Errors are thrown as std::runtime_error.
+class usb_gadget
+{
+    protected:
+        int debug_level = 0;
+        void dump_hex_and_ascii(const void *data, const size_t length);
+    public:
+        virtual ~usb_gadget() = default;
+        void set_debug_level(const int level);
+        virtual void init(enum usb_device_speed speed) = 0;
+        virtual void run(void) = 0;
+        virtual void close(void) = 0;
+        virtual void event_fetch(struct usb_raw_event *event) = 0;
+        virtual int eps_info(struct usb_raw_eps_info *info) = 0;
+        virtual int ep0_write(struct usb_raw_ep_io *io) = 0;
+        virtual int ep0_read(struct usb_raw_ep_io *io) = 0;
+        virtual void ep0_stall(void) = 0;
+        virtual int ep_enable(struct usb_endpoint_descriptor *desc) = 0;
+        virtual int ep_write(struct usb_raw_ep_io *io) = 0;
+        virtual int ep_read(struct usb_raw_ep_io *io) = 0;
+        virtual void vbus_draw(uint32_t bMaxPower) = 0;
+        virtual void configure() = 0;
+};
@@ -0,0 +1,297 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "usb_loopback_gadget.h"
+
+usb_loopback_gadget::usb_loopback_gadget()
+{
+}
+
+usb_loopback_gadget::~usb_loopback_gadget()
+{
+    close();
+}
+
+void usb_loopback_gadget::check_closed(void)
+{
+    if (closed) {
+        throw std::runtime_error("usb_loopback_gadget: closed");
+    }
+}
+
+usb_loopback_gadget::endpoint &usb_loopback_gadget::get_endpoint(int ep)
+{
+    if (ep < 0 || ep >= endpoint_count.load(std::memory_order_acquire)) {
+        throw std::runtime_error("usb_loopback_gadget: invalid endpoint " + std::to_string(ep));
+    }
+    return endpoints[ep];
+}
+
+// Host side: the endpoint with the address, waiting for the configuration
+// to enable it. nullptr on timeout.
+usb_loopback_gadget::endpoint *usb_loopback_gadget::find_endpoint(uint8_t address, const std::chrono::milliseconds &timeout)
+{
+    if (!wait_configured(timeout)) {
+        return nullptr;
+    }
+    const auto count = endpoint_count.load(std::memory_order_acquire);
+    for (int i = 0; i < count; i++) {
+        if (endpoints[i].address.load() == address) {
+            return &endpoints[i];
+        }
+    }
+    return nullptr;
+}
+
+void usb_loopback_gadget::init(enum usb_device_speed speed)
+{
+    (void)speed;
+}
+
+void usb_loopback_gadget::run(void)
+{
+}
+
+// Wakes every blocked call; the gadget side throws from then on.
+void usb_loopback_gadget::close(void)
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        closed = true;
+    }
+    cv.notify_all();
+    for (auto &ep : endpoints) {
+        {
+            std::lock_guard<std::mutex> lock(ep.mtx);
+        }
+        ep.cv.notify_all();
+    }
+}
+
+void usb_loopback_gadget::event_fetch(struct usb_raw_event *event)
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    if (in_control) {
+        // back for the next event: the previous request is done
+        in_control = false;
+        completed++;
+        cv.notify_all();
+    }
+    cv.wait(lock, [this]{return closed || !events.empty();});
+    check_closed();
+
+    auto &next = events.front();
+    const auto header = reinterpret_cast<const struct usb_raw_event *>(next.data());
+    const auto length = std::min<uint32_t>(header->length, event->length);
+    event->type = header->type;
+    event->length = length;
+    memcpy(event->data, next.data() + sizeof(struct usb_raw_event), length);
+    in_control = (header->type == USB_RAW_EVENT_CONTROL);
+    events.pop_front();
+}
+
+int usb_loopback_gadget::eps_info(struct usb_raw_eps_info *info)
+{
+    memset(info, 0, sizeof(*info));
+    return 0;
+}
+
+int usb_loopback_gadget::ep0_write(struct usb_raw_ep_io *io)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    check_closed();
+    ep0_in.assign(reinterpret_cast<const char *>(io->data), reinterpret_cast<const char *>(io->data) + io->length);
+    if (debug_level >= 1) {printf("ep0: write: transferred %d bytes.\n", io->length);}
+    if (debug_level >= 3) {dump_hex_and_ascii(io->data, io->length);}
+    return io->length;
+}
+
+int usb_loopback_gadget::ep0_read(struct usb_raw_ep_io *io)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    check_closed();
+    const auto length = std::min<size_t>(io->length, ep0_out.size());
+    memcpy(io->data, ep0_out.data(), length);
+    if (debug_level >= 1) {printf("ep0: read: transferred %zu bytes.\n", length);}
+    if (debug_level >= 3) {dump_hex_and_ascii(io->data, length);}
+    return length;
+}
+
+void usb_loopback_gadget::ep0_stall(void)
+{
+    if (debug_level >= 1) {printf("ep0: stall\n");}
+    std::lock_guard<std::mutex> lock(mtx);
+    check_closed();
+    stalled = true;
+}
+
+int usb_loopback_gadget::ep_enable(struct usb_endpoint_descriptor *desc)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    check_closed();
+    const auto ep = endpoint_count.load();
+    if (ep >= USB_LOOPBACK_MAX_ENDPOINTS) {
+        throw std::runtime_error("usb_loopback_gadget: too many endpoints");
+    }
+    endpoints[ep].address.store(desc->bEndpointAddress);
+    endpoint_count.store(ep + 1, std::memory_order_release);
+    return ep;
+}
+
+int usb_loopback_gadget::ep_write(struct usb_raw_ep_io *io)
+{
+    auto &ep = get_endpoint(io->ep);
+    {
+        std::unique_lock<std::mutex> lock(ep.mtx);
+        ep.cv.wait(lock, [this, &ep]{return closed || ep.packets.size() < USB_LOOPBACK_QUEUE_PACKETS;});
+        check_closed();
+        const auto data = reinterpret_cast<const char *>(io->data);
+        ep.packets.emplace_back(data, data + io->length);
+    }
+    ep.cv.notify_all();
+    if (debug_level >= 1) {printf("ep%d: write: transferred %d bytes.\n", io->ep, io->length);}
+    if (debug_level >= 3) {dump_hex_and_ascii(io->data, io->length);}
+    return io->length;
+}
+
+int usb_loopback_gadget::ep_read(struct usb_raw_ep_io *io)
+{
+    auto &ep = get_endpoint(io->ep);
+    size_t length;
+    {
+        std::unique_lock<std::mutex> lock(ep.mtx);
+        ep.cv.wait(lock, [this, &ep]{return closed || !ep.packets.empty();});
+        check_closed();
+        auto &packet = ep.packets.front();
+        length = std::min<size_t>(io->length, packet.size());
+        memcpy(io->data, packet.data(), length);
+        ep.packets.pop_front();
+    }
+    ep.cv.notify_all();
+    if (debug_level >= 1) {printf("ep%d: read: transferred %zu bytes.\n", io->ep, length);}
+    if (debug_level >= 3) {dump_hex_and_ascii(io->data, length);}
+    return length;
+}
+
+void usb_loopback_gadget::vbus_draw(uint32_t bMaxPower)
+{
+    (void)bMaxPower;
+}
+
+void usb_loopback_gadget::configure()
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        check_closed();
+        configured = true;
+    }
+    cv.notify_all();
+}
+
+void usb_loopback_gadget::connect(void)
+{
+    std::vector<char> event(sizeof(struct usb_raw_event));
+    reinterpret_cast<struct usb_raw_event *>(event.data())->type = USB_RAW_EVENT_CONNECT;
+    reinterpret_cast<struct usb_raw_event *>(event.data())->length = 0;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        events.push_back(std::move(event));
+    }
+    cv.notify_all();
+}
+
+// Runs one control transfer through event_usb_control_loop(). data holds the
+// OUT data stage or receives the IN data stage (wLength bytes at most).
+// Returns the IN length (0 for OUT requests), -1 on a stall or timeout.
+// One host thread at a time.
+int usb_loopback_gadget::control(const struct usb_ctrlrequest &ctrl, void *data, const std::chrono::milliseconds &timeout)
+{
+    const auto length = __le16_to_cpu(ctrl.wLength);
+    const bool is_in = (ctrl.bRequestType & USB_DIR_IN) != 0;
+
+    std::vector<char> event(sizeof(struct usb_raw_event) + sizeof(ctrl));
+    reinterpret_cast<struct usb_raw_event *>(event.data())->type = USB_RAW_EVENT_CONTROL;
+    reinterpret_cast<struct usb_raw_event *>(event.data())->length = sizeof(ctrl);
+    memcpy(event.data() + sizeof(struct usb_raw_event), &ctrl, sizeof(ctrl));
+
+    std::unique_lock<std::mutex> lock(mtx);
+    // the loop handles one request at a time; wait for ours to come up
+    if (!cv.wait_for(lock, timeout, [this]{return closed || completed == injected;})) {
+        return -1;
+    }
+    if (closed) {
+        return -1;
+    }
+    ep0_in.clear();
+    ep0_out.clear();
+    if (!is_in && length > 0) {
+        ep0_out.assign(reinterpret_cast<const char *>(data), reinterpret_cast<const char *>(data) + length);
+    }
+    stalled = false;
+    events.push_back(std::move(event));
+    const auto id = ++injected;
+    cv.notify_all();
+
+    if (!cv.wait_for(lock, timeout, [this, id]{return closed || completed >= id;})) {
+        return -1;
+    }
+    if (closed || stalled) {
+        return -1;
+    }
+    if (!is_in) {
+        return 0;
+    }
+    const auto in_length = std::min<size_t>(length, ep0_in.size());
+    memcpy(data, ep0_in.data(), in_length);
+    return in_length;
+}
+
+bool usb_loopback_gadget::wait_configured(const std::chrono::milliseconds &timeout)
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    return cv.wait_for(lock, timeout, [this]{return closed || configured;}) && !closed;
+}
+
+// Host side OUT transfer of one packet.
+int usb_loopback_gadget::bulk_write(uint8_t address, const void *data, size_t length, const std::chrono::milliseconds &timeout)
+{
+    auto ep = find_endpoint(address, timeout);
+    if (ep == nullptr) {
+        return -1;
+    }
+    {
+        std::unique_lock<std::mutex> lock(ep->mtx);
+        if (!ep->cv.wait_for(lock, timeout, [this, ep]{return closed || ep->packets.size() < USB_LOOPBACK_QUEUE_PACKETS;}) || closed) {
+            return -1;
+        }
+        const auto bytes = reinterpret_cast<const char *>(data);
+        ep->packets.emplace_back(bytes, bytes + length);
+    }
+    ep->cv.notify_all();
+    return length;
+}
+
+// Host side IN transfer of one packet; a zero-length packet returns 0.
+int usb_loopback_gadget::bulk_read(uint8_t address, void *data, size_t max_length, const std::chrono::milliseconds &timeout)
+{
+    auto ep = find_endpoint(address, timeout);
+    if (ep == nullptr) {
+        return -1;
+    }
+    size_t length;
+    {
+        std::unique_lock<std::mutex> lock(ep->mtx);
+        if (!ep->cv.wait_for(lock, timeout, [this, ep]{return closed || !ep->packets.empty();}) || closed) {
+            return -1;
+        }
+        auto &packet = ep->packets.front();
+        length = std::min(max_length, packet.size());
+        memcpy(data, packet.data(), length);
+        ep->packets.pop_front();
+    }
+    ep->cv.notify_all();
+    return length;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "usb_gadget.h"
+
+constexpr auto USB_LOOPBACK_MAX_ENDPOINTS = 16;
+constexpr size_t USB_LOOPBACK_QUEUE_PACKETS = 16; // writers block beyond this, as if the other side stopped polling
+
+// In-memory gadget for running the control loop and the modem threads
+// without a UDC. The gadget side is the usb_gadget interface; the host side
+// below injects control requests and exchanges bulk/interrupt packets with
+// the enabled endpoints, addressed by bEndpointAddress. Each call moves one
+// USB packet. Host calls return -1 on timeout or stall; gadget calls throw
+// once close() was called, like the ioctls of a removed UDC.
+class usb_loopback_gadget : public usb_gadget
+{
+    private:
+        struct endpoint {
+            std::atomic<uint8_t> address{0};
+            std::mutex mtx;
+            std::condition_variable cv;
+            std::deque<std::vector<char>> packets;
+        };
+        std::mutex mtx; // guards everything but the endpoint queues
+        std::condition_variable cv;
+        std::atomic<bool> closed{false};
+        bool configured = false;
+        std::deque<std::vector<char>> events; // struct usb_raw_event followed by its data
+        uint64_t injected = 0;   // control requests queued by the host
+        uint64_t completed = 0;  // of those, the ones the control loop is done with
+        bool in_control = false; // the control loop is handling a request
+        std::vector<char> ep0_out;  // data stage of the current OUT request
+        std::vector<char> ep0_in;   // reply to the current IN request
+        bool stalled = false;
+        std::array<endpoint, USB_LOOPBACK_MAX_ENDPOINTS> endpoints;
+        std::atomic<int> endpoint_count{0};
+        endpoint *find_endpoint(uint8_t address, const std::chrono::milliseconds &timeout);
+        endpoint &get_endpoint(int ep);
+        void check_closed(void);
+    public:
+        usb_loopback_gadget();
+        ~usb_loopback_gadget();
+        void init(enum usb_device_speed speed) override;
+        void run(void) override;
+        void close(void) override;
+        void event_fetch(struct usb_raw_event *event) override;
+        int eps_info(struct usb_raw_eps_info *info) override;
+        int ep0_write(struct usb_raw_ep_io *io) override;
+        int ep0_read(struct usb_raw_ep_io *io) override;
+        void ep0_stall(void) override;
+        int ep_enable(struct usb_endpoint_descriptor *desc) override;
+        int ep_write(struct usb_raw_ep_io *io) override;
+        int ep_read(struct usb_raw_ep_io *io) override;
+        void vbus_draw(uint32_t bMaxPower) override;
+        void configure() override;
+
+        // host side
+        void connect(void);
+        int control(const struct usb_ctrlrequest &ctrl, void *data,
+            const std::chrono::milliseconds &timeout = std::chrono::milliseconds(1000));
+        bool wait_configured(const std::chrono::milliseconds &timeout);
+        int bulk_write(uint8_t address, const void *data, size_t length, const std::chrono::milliseconds &timeout);
+        int bulk_read(uint8_t address, void *data, size_t max_length, const std::chrono::milliseconds &timeout);
+};
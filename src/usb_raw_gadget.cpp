@@ -11,25 +11,6 @@
 
 #include "usb_raw_gadget.h"
 
-void usb_raw_gadget::dump_hex_and_ascii(void *data, const size_t length)
-{
-    uint8_t *c = reinterpret_cast<uint8_t *>(data);
-    for (size_t offset = 0; offset < length; offset += 16) {
-        printf("  %04lx: ", offset);
-        for (size_t p = 0; p < 16; p++) {
-            if (offset + p < length) {
-                printf("%02x ", c[offset + p]);
-            } else {
-                printf("   ");
-            }
-        }
-        for (size_t p = 0; p < 16 && offset + p < length; p++) {
-            printf("%c", isprint(c[offset + p]) ? c[offset + p] : '.');
-        }
-        printf("\n");
-    }
-}
-
 usb_raw_gadget::usb_raw_gadget(const char *file)
 {
     fd = open(file, O_RDWR);
@@ -43,11 +24,6 @@ usb_raw_gadget::~usb_raw_gadget(void)
     close();
 }
 
-void usb_raw_gadget::set_debug_level(const int level)
-{
-    debug_level = level;
-}
-
 bool get_udc_driver(char *out, size_t out_size)
 {
     if (!out || out_size == 0)
@@ -4,27 +4,26 @@
 
 #include <linux/usb/raw_gadget.h>
 
-class usb_raw_gadget
+#include "usb_gadget.h"
+
+class usb_raw_gadget : public usb_gadget
 {
     private:
         int fd;
-        int debug_level = 0;
-        void dump_hex_and_ascii(void *data, const size_t length);
     public:
         usb_raw_gadget(const char *file);
         ~usb_raw_gadget();
-        void set_debug_level(const int level);
-        void init(enum usb_device_speed speed);
-        void run(void);
-        void close(void);
-        void event_fetch(struct usb_raw_event *event);
-        int eps_info(struct usb_raw_eps_info *info);
-        int ep0_write(struct usb_raw_ep_io *io);
-        int ep0_read(struct usb_raw_ep_io *io);
-        void ep0_stall(void);
-        int ep_enable(struct usb_endpoint_descriptor *desc);
-        int ep_write(struct usb_raw_ep_io *io);
-        int ep_read(struct usb_raw_ep_io *io);
-        void vbus_draw(uint32_t bMaxPower);
-        void configure();
+        void init(enum usb_device_speed speed) override;
+        void run(void) override;
+        void close(void) override;
+        void event_fetch(struct usb_raw_event *event) override;
+        int eps_info(struct usb_raw_eps_info *info) override;
+        int ep0_write(struct usb_raw_ep_io *io) override;
+        int ep0_read(struct usb_raw_ep_io *io) override;
+        void ep0_stall(void) override;
+        int ep_enable(struct usb_endpoint_descriptor *desc) override;
+        int ep_write(struct usb_raw_ep_io *io) override;
+        int ep_read(struct usb_raw_ep_io *io) override;
+        void vbus_draw(uint32_t bMaxPower) override;
+        void configure() override;
 };